@@ -3,6 +3,7 @@
 #include "common.h"
 
 #include "Wormhole.h"
+#include "OutputProjection.h"
 
 struct Camera
 {
@@ -19,7 +20,9 @@ public:
 		m_rotateRate(1.0f),
 		width(1280),
 		height(720),
-		l(1.0f)
+		l(1.0f),
+		m_projection(OutputProjection::Pinhole),
+		m_fisheyeFov(XM_PI)
 	{
 
 	}
@@ -69,6 +72,23 @@ public:
 		m_fovX = fov * XM_PI / 180.0f;
 		m_fovY = m_fovX * static_cast<float>(height) / static_cast<float>(width);
 	}
+	// fovX and fovY given directly, as the shaders use them (cameras built from a RayCamera)
+	void SetResolutionFOV(UINT width, UINT height, float fovX, float fovY)
+	{
+		this->width = width;
+		this->height = height;
+		m_aspect = static_cast<float>(width) / static_cast<float>(height);
+		m_fovX = fovX;
+		m_fovY = fovY;
+	}
+	// how pixels map to rays, the fisheye angle is the full angle of its circle in radians
+	void SetOutputProjection(OutputProjection projection, float fisheyeFov = XM_PI)
+	{
+		m_projection = projection;
+		m_fisheyeFov = fisheyeFov;
+	}
+	OutputProjection GetOutputProjection() const { return m_projection; }
+	float GetFisheyeFov() const { return m_fisheyeFov; }
 	void SetNearZ(float nearZ)
 	{
 		m_nearZ = nearZ;
@@ -103,6 +123,17 @@ public:
 		r = XMVector3Length(pos).m128_f32[0];
 		l = XMVector3Length(pos).m128_f32[0] * Sign(l); // change magnitude, keep sign
 	}
+	// set look and up directly without touching position and l, used by camera path playback
+	void SetOrientation(XMFLOAT3 lookDir, XMFLOAT3 upDir)
+	{
+		XMVECTOR look = XMVector3Normalize(XMLoadFloat3(&lookDir));
+		XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&upDir), look));
+		XMVECTOR up = XMVector3Cross(look, right);
+
+		XMStoreFloat3(&m_right, right);
+		XMStoreFloat3(&m_up, up);
+		XMStoreFloat3(&m_look, look);
+	}
 	void LookAt(XMFLOAT3 pos, XMFLOAT3 lookAt, const XMFLOAT3 &worldUp)
 	{
 		XMVECTOR p = XMLoadFloat3(&pos);
@@ -319,5 +350,8 @@ private:
 
 	float		l; // wormhole parameter
 	float		r; // camera distance to center
+
+	OutputProjection	m_projection;
+	float				m_fisheyeFov;
 };
 
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "common.h"
+#include "Wormhole.h"
+#include "Camera.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// One keyframe of a camera path. Position, fov and wormhole parameters are interpolated with
+// Catmull-Rom splines, orientation with quaternion squad. side is the sign of l (which space
+// the camera is in) and is held constant over a segment.
+struct CameraKeyframe
+{
+	float time; // seconds
+	XMFLOAT3 position;
+	XMFLOAT3 look;
+	XMFLOAT3 up;
+	float fov; // horizontal, degrees
+	Wormhole wormhole;
+	float side;
+};
+
+// Text format, one keyframe per line, '#' starts a comment:
+// time px py pz lookx looky lookz upx upy upz fov mass radius length [side]
+struct CameraPath
+{
+	std::vector<CameraKeyframe> keyframes;
+
+	CameraPath()
+	{
+		;
+	}
+
+	CameraPath(LPCWSTR filename)
+	{
+		std::ifstream file(filename);
+		if (!file)
+			throw std::runtime_error("failed to open camera path");
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			auto comment(line.find('#'));
+			if (comment != std::string::npos)
+				line.resize(comment);
+			std::istringstream ss(line);
+			CameraKeyframe key{};
+			if (!(ss >> key.time))
+				continue; // empty line
+			ss >> key.position.x >> key.position.y >> key.position.z
+				>> key.look.x >> key.look.y >> key.look.z
+				>> key.up.x >> key.up.y >> key.up.z
+				>> key.fov
+				>> key.wormhole.mass >> key.wormhole.radius >> key.wormhole.length;
+			if (!ss)
+				throw std::runtime_error("malformed camera path keyframe: " + line);
+			if (!(ss >> key.side))
+				key.side = 1.0f;
+			keyframes.push_back(key);
+		}
+		if (keyframes.empty())
+			throw std::runtime_error("camera path has no keyframes");
+
+		std::stable_sort(keyframes.begin(), keyframes.end(), [](auto const &a, auto const &b) { return a.time < b.time; });
+	}
+
+	float Duration() const
+	{
+		return keyframes.empty() ? 0.0f : keyframes.back().time;
+	}
+
+	static XMVECTOR Orientation(CameraKeyframe const &key)
+	{
+		XMVECTOR look = XMVector3Normalize(XMLoadFloat3(&key.look));
+		XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&key.up), look));
+		XMVECTOR up = XMVector3Cross(look, right);
+		XMMATRIX basis(right, up, look, g_XMIdentityR3);
+		return XMQuaternionNormalize(XMQuaternionRotationMatrix(basis));
+	}
+
+	static XMVECTOR Params(CameraKeyframe const &key)
+	{
+		return XMVectorSet(key.fov, key.wormhole.mass, key.wormhole.radius, key.wormhole.length);
+	}
+
+	CameraKeyframe Evaluate(float t) const
+	{
+		if (keyframes.size() == 1 || t <= keyframes.front().time)
+			return keyframes.front();
+		if (t >= keyframes.back().time)
+			return keyframes.back();
+
+		std::size_t i1(std::upper_bound(keyframes.begin(), keyframes.end(), t, [](float t, auto const &k) { return t < k.time; }) - keyframes.begin() - 1);
+		std::size_t i2(i1 + 1);
+		std::size_t i0(i1 > 0 ? i1 - 1 : i1);
+		std::size_t i3(std::min(i2 + 1, keyframes.size() - 1));
+		auto const &k0(keyframes[i0]), &k1(keyframes[i1]), &k2(keyframes[i2]), &k3(keyframes[i3]);
+
+		float span(k2.time - k1.time);
+		float u(span > 0.0f ? (t - k1.time) / span : 0.0f);
+
+		CameraKeyframe result(k1);
+		result.time = t;
+
+		XMStoreFloat3(&result.position, XMVectorCatmullRom(
+			XMLoadFloat3(&k0.position), XMLoadFloat3(&k1.position), XMLoadFloat3(&k2.position), XMLoadFloat3(&k3.position), u));
+
+		// keep consecutive quaternions in the same hemisphere so squad takes the short way round
+		XMVECTOR q0(Orientation(k0)), q1(Orientation(k1)), q2(Orientation(k2)), q3(Orientation(k3));
+		if (XMVectorGetX(XMQuaternionDot(q0, q1)) < 0.0f) q0 = -q0;
+		if (XMVectorGetX(XMQuaternionDot(q1, q2)) < 0.0f) q2 = -q2;
+		if (XMVectorGetX(XMQuaternionDot(q2, q3)) < 0.0f) q3 = -q3;
+		XMVECTOR a, b, c;
+		XMQuaternionSquadSetup(&a, &b, &c, q0, q1, q2, q3);
+		XMMATRIX basis(XMMatrixRotationQuaternion(XMQuaternionSquad(q1, a, b, c, u)));
+		XMStoreFloat3(&result.up, basis.r[1]);
+		XMStoreFloat3(&result.look, basis.r[2]);
+
+		// clamp to the ranges of the control sliders, splines can overshoot
+		XMVECTOR params(XMVectorCatmullRom(Params(k0), Params(k1), Params(k2), Params(k3), u));
+		params = XMVectorMax(params, XMVectorSet(1.0f, 0.00001f, 0.00001f, 0.0f));
+		result.fov = XMVectorGetX(params);
+		result.wormhole.mass = XMVectorGetY(params);
+		result.wormhole.radius = XMVectorGetZ(params);
+		result.wormhole.length = XMVectorGetW(params);
+		return result;
+	}
+};
+
+// Steps a camera path with a fixed timestep, independent of wall clock, so every run renders
+// exactly the same sequence of frames.
+struct CameraPathPlayer
+{
+	CameraPath path;
+	float timestep; // seconds per frame
+	std::uint64_t frameIndex;
+
+	CameraPathPlayer() :timestep(1.0f / 60.0f), frameIndex(0)
+	{
+		;
+	}
+
+	CameraPathPlayer(CameraPath path, float timestep) :path(std::move(path)), timestep(timestep), frameIndex(0)
+	{
+		;
+	}
+
+	bool Active() const { return !path.keyframes.empty(); }
+	float Time() const { return static_cast<float>(static_cast<double>(frameIndex) * timestep); }
+	bool Finished() const { return Time() > path.Duration(); }
+	std::uint64_t FrameCount() const { return static_cast<std::uint64_t>(path.Duration() / timestep) + 1; }
+
+	void Rewind()
+	{
+		frameIndex = 0;
+	}
+
+	// apply the current frame to camera and wormhole, then advance
+	void Step(Camera &cam, Wormhole &wormhole)
+	{
+		auto key(path.Evaluate(Time()));
+		wormhole = key.wormhole;
+		cam.SetResolutionFOV(cam.GetWidth(), cam.GetHeight(), key.fov);
+		cam.SetOrientation(key.look, key.up);
+		cam.SetL(key.side);
+		cam.SetPosition(key.position, wormhole);
+		++frameIndex;
+	}
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+// RenderBackend on the CPU: images are plain float arrays, the phi table is built by
+// BuildPhiTable and the per pixel pass by RenderTiles, both on every hardware thread. Work runs
+// synchronously, Readback only copies. With progressive tables BuildPhiTable only builds a coarse
+// table when the parameters change and RenderPixels uses whichever table ProgressivePhiTable has
+// swapped in by then. With a PhiTableCache BuildPhiTable takes the table from it when one for
+// the parameters is cached and adds the ones it builds. With a TileCache RenderPixels only
+// traces the tiles whose inputs changed since the last frame (TileCache.h), tileStats of the
+// last frame counts the tiles it skipped. With a NumaTileScheduler the tiles are traced by its
+// pinned workers from per node copies of the skymaps instead of the shared queue.
+
+#include "RenderBackend.h"
+#include "PhiTable.h"
+#include "PhiTableCache.h"
+#include "ProgressivePhiTable.h"
+#include "NumaTileScheduler.h"
+#include "TileRenderer.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+struct CpuBackend : RenderBackend
+{
+	struct Image
+	{
+		std::vector<float> data;
+		std::uint32_t width, height;
+
+		SkyView View() const
+		{
+			return { data.data(), width, height };
+		}
+	};
+
+	std::vector<Image> images;
+	std::shared_ptr<PhiTable const> table;
+	std::unique_ptr<ProgressivePhiTable> progressive; // instead of table when enabled
+	PhiTableCache *cache; // optional, may be shared with other backends
+	std::unique_ptr<TileCache> tileCache; // optional, one target image at a time
+	std::unique_ptr<NumaTileScheduler> numa; // optional, its threads replace threads for the per pixel pass
+	std::vector<float> tight; // cam.width wide pixels of a render into a wider target, kept for the tile cache
+	TileStats tileStats; // of the last RenderPixels
+	unsigned threads; // 0 uses every hardware thread
+	CpuTimestampBackend timestamps;
+
+	explicit CpuBackend(unsigned threads = 0, bool progressiveTables = false, PhiTableCache *cache = nullptr, bool reuseTiles = false)
+		:cache(cache), tileStats{}, threads(threads)
+	{
+		if (progressiveTables)
+			progressive = std::make_unique<ProgressivePhiTable>(512, g_PhiCacheSize, threads, cache);
+		if (reuseTiles)
+			tileCache = std::make_unique<TileCache>();
+	}
+
+	char const *Name() const override
+	{
+		return "CPU";
+	}
+
+	BackendImage CreateImage(std::uint32_t width, std::uint32_t height) override
+	{
+		images.push_back({ std::vector<float>(static_cast<std::size_t>(width) * height * 4, 0.0f), width, height });
+		return static_cast<BackendImage>(images.size() - 1);
+	}
+
+	void Upload(BackendImage image, float const *rgba) override
+	{
+		auto &img(images.at(image));
+		std::copy(rgba, rgba + img.data.size(), img.data.begin());
+		if (tileCache)
+			tileCache->InvalidateAll();
+		if (numa)
+			numa->Invalidate();
+	}
+
+	void BuildPhiTable(Wormhole const &wormhole, float l, float r, std::uint32_t size) override
+	{
+		ScopedTimestamp timestamp(&timestamps, RenderPass::PhiCache);
+		if (progressive)
+		{
+			progressive->fullSize = size;
+			progressive->Request(wormhole, l, r);
+		}
+		else if (cache)
+			table = cache->Get(wormhole, l, r, size, [&] { return ::BuildPhiTable(wormhole, l, r, size, threads); });
+		else
+			table = std::make_shared<PhiTable const>(::BuildPhiTable(wormhole, l, r, size, threads));
+	}
+
+	void RenderPixels(BackendImage sky1, BackendImage sky2, BackendImage dst, RayCamera const &cam, Foveation const &foveation) override
+	{
+		ScopedTimestamp timestamp(&timestamps, RenderPass::Wormhole);
+		auto &target(images.at(dst));
+		if (cam.width > target.width || cam.height > target.height)
+			throw std::runtime_error("camera larger than the target image");
+		std::shared_ptr<PhiTable const> current(progressive ? progressive->Current() : table);
+		if (!current)
+			throw std::runtime_error("RenderPixels before BuildPhiTable");
+		PhiTable const &table(*current);
+		if (cam.width == target.width)
+		{
+			tileStats = TraceTiles(table, images.at(sky1).View(), images.at(sky2).View(), cam, foveation, target.data.data());
+			return;
+		}
+		// the top left part of a wider image, through a tight buffer
+		tight.resize(static_cast<std::size_t>(cam.width) * cam.height * 4);
+		tileStats = TraceTiles(table, images.at(sky1).View(), images.at(sky2).View(), cam, foveation, tight.data());
+		for (std::uint32_t y(0); y < cam.height; ++y)
+			std::copy_n(tight.data() + static_cast<std::size_t>(y) * cam.width * 4, cam.width * 4, target.data.data() + static_cast<std::size_t>(y) * target.width * 4);
+	}
+
+	void Readback(BackendImage image, float *rgba) override
+	{
+		auto const &img(images.at(image));
+		std::copy(img.data.begin(), img.data.end(), rgba);
+	}
+
+	void BeginFrame() override
+	{
+		timestamps.BeginFrame(0);
+	}
+
+	void EndFrame() override
+	{
+		timestamps.EndFrame();
+	}
+
+	TimestampBackend &Timestamps() override
+	{
+		return timestamps;
+	}
+
+	TileStats TraceTiles(PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam, Foveation const &foveation, float *dst)
+	{
+		if (numa)
+			return RenderTiles(*numa, KernelOptions{ cam.projection, SkyFilter::Bilinear, PixelFormat::RGBA32F, 1 }, table, sky1, sky2, cam, foveation, dst, tileCache.get());
+		return RenderTiles(table, sky1, sky2, cam, foveation, dst, threads, tileCache.get());
+	}
+};
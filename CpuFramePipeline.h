@@ -0,0 +1,236 @@
+#pragma once
+
+// Frames in flight for the CPU renderer, the counterpart of g_NumFrames on the GPU path. A frame
+// goes through four stages in order: phi table build, per pixel trace, post-process (exposure and
+// RGBA8 quantization) and output (present, encode or write, a callback). Each stage runs on its
+// own thread and takes frames in submission order, so frame N+1's table build overlaps frame N's
+// trace and frame N-1's output, and throughput is bounded by the slowest stage rather than their
+// sum. Every frame in flight has its own resource set (table, float and RGBA8 images) from a ring
+// of framesInFlight; Submit blocks until the output stage has released the oldest set, which is
+// the only dependency besides a frame's own stage order. One frame in flight is the sequential
+// renderer. A table whose wormhole and l match the previous frame's is shared, not rebuilt, and
+// with a PhiTableCache one for parameters seen recently is taken from the cache.
+
+#include "PhiTable.h"
+#include "PhiTableCache.h"
+#include "TileRenderer.h"
+#include "Profiler.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class CpuStage : std::uint32_t
+{
+	Table,
+	Trace,
+	Post,
+	Output,
+	Count
+};
+
+std::size_t constexpr g_CpuStageCount = static_cast<std::size_t>(CpuStage::Count);
+
+inline char const *CpuStageName(CpuStage stage)
+{
+	static char const *names[g_CpuStageCount] = { "table", "trace", "post", "output" };
+	return names[static_cast<std::size_t>(stage)];
+}
+
+// resource set of one frame in flight
+struct CpuFrame
+{
+	std::uint64_t index;
+	Wormhole wormhole;
+	float l, r;
+	RayCamera cam;
+	Foveation foveation;
+	std::shared_ptr<PhiTable const> table;
+	bool tableShared;				// reused the previous frame's table
+	std::vector<float> pixels;		// trace output, RGBA32F
+	std::vector<std::uint8_t> rgba8;	// post-process output
+	std::array<double, g_CpuStageCount> stageMs;
+};
+
+// Blocking queue of resource set indices between two stages; Close wakes the consumer for good.
+struct CpuFrameQueue
+{
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<std::uint32_t> slots;
+	bool closed = false;
+
+	void Push(std::uint32_t slot)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots.push_back(slot);
+		}
+		ready.notify_one();
+	}
+
+	// false once closed and drained
+	bool Pop(std::uint32_t &slot)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this] { return closed || !slots.empty(); });
+		if (slots.empty())
+			return false;
+		slot = slots.front();
+		slots.pop_front();
+		return true;
+	}
+
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+};
+
+struct CpuFramePipeline
+{
+	using Output = std::function<void(CpuFrame const &)>;
+
+	SkyView sky1, sky2;
+	std::uint32_t tableSize;
+	float exposure;
+	unsigned tableThreads, traceThreads;	// workers of the table build and the trace, 0 every hardware thread
+	PhiTableCache *cache;					// optional, set before the first Submit
+	Output output;
+
+	std::vector<CpuFrame> frames;
+	std::array<CpuFrameQueue, g_CpuStageCount + 1> queues;	// input of each stage, the last holds free sets
+	std::array<std::thread, g_CpuStageCount> threads;
+	std::array<double, g_CpuStageCount> busyMs;			// per stage totals, written by the stage only
+
+	std::mutex doneMutex;
+	std::condition_variable doneChanged;
+	std::uint64_t submitted, done;
+
+	CpuFramePipeline(SkyView sky1, SkyView sky2, std::uint32_t framesInFlight, Output output,
+					 std::uint32_t tableSize = g_PhiCacheSize, unsigned tableThreads = 0, unsigned traceThreads = 0)
+		:sky1(sky1), sky2(sky2), tableSize(tableSize), exposure(1.0f), tableThreads(tableThreads), traceThreads(traceThreads), cache(nullptr),
+		output(std::move(output)), frames(std::max(framesInFlight, 1u)), busyMs(), submitted(0), done(0)
+	{
+		for (std::uint32_t i(0); i < frames.size(); ++i)
+			queues[g_CpuStageCount].Push(i);
+		for (std::size_t s(0); s < g_CpuStageCount; ++s)
+			threads[s] = std::thread([this, s] { RunStage(static_cast<CpuStage>(s)); });
+	}
+
+	~CpuFramePipeline()
+	{
+		for (auto &queue : queues)
+			queue.Close();
+		for (auto &thread : threads)
+			thread.join();
+	}
+
+	CpuFramePipeline(CpuFramePipeline const &) = delete;
+	CpuFramePipeline &operator=(CpuFramePipeline const &) = delete;
+
+	std::uint32_t FramesInFlight() const
+	{
+		return static_cast<std::uint32_t>(frames.size());
+	}
+
+	// queues a frame, waiting for a free resource set when framesInFlight frames are in the pipeline
+	void Submit(Wormhole const &wormhole, float l, float r, RayCamera const &cam, Foveation const &foveation)
+	{
+		std::uint32_t slot;
+		if (!queues[g_CpuStageCount].Pop(slot))
+			return;
+		CpuFrame &frame(frames[slot]);
+		frame.index = submitted++;
+		frame.wormhole = wormhole;
+		frame.l = l;
+		frame.r = r;
+		frame.cam = cam;
+		frame.foveation = foveation;
+		queues[0].Push(slot);
+	}
+
+	// waits until every submitted frame went through the output stage
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneChanged.wait(lock, [this] { return done == submitted; });
+	}
+
+private:
+	void RunStage(CpuStage stage)
+	{
+		std::size_t const s(static_cast<std::size_t>(stage));
+		std::shared_ptr<PhiTable const> lastTable; // table stage only
+		std::uint32_t slot;
+		while (queues[s].Pop(slot))
+		{
+			CpuFrame &frame(frames[slot]);
+			auto begin(std::chrono::steady_clock::now());
+			switch (stage)
+			{
+			case CpuStage::Table:
+			{
+				PROFILE_ZONE("CPU phi table");
+				frame.tableShared = lastTable && lastTable->l == frame.l && lastTable->size == tableSize && SameWormhole(lastTable->wormhole, frame.wormhole);
+				if (!frame.tableShared)
+				{
+					auto build([&] { return BuildPhiTable(frame.wormhole, frame.l, frame.r, tableSize, tableThreads); });
+					lastTable = cache ? cache->Get(frame.wormhole, frame.l, frame.r, tableSize, build) : std::make_shared<PhiTable const>(build());
+				}
+				frame.table = lastTable;
+				break;
+			}
+			case CpuStage::Trace:
+			{
+				PROFILE_ZONE("CPU trace");
+				frame.pixels.resize(static_cast<std::size_t>(frame.cam.width) * frame.cam.height * 4);
+				RenderTiles(*frame.table, sky1, sky2, frame.cam, frame.foveation, frame.pixels.data(), traceThreads);
+				frame.table.reset(); // the table stage may be holding a newer one already
+				break;
+			}
+			case CpuStage::Post:
+			{
+				PROFILE_ZONE("CPU post");
+				frame.rgba8.resize(frame.pixels.size());
+				for (std::size_t i(0); i < frame.pixels.size(); ++i)
+					frame.rgba8[i] = static_cast<std::uint8_t>(std::min(std::max(frame.pixels[i] * exposure, 0.0f), 1.0f) * 255.0f + 0.5f);
+				break;
+			}
+			default:
+			{
+				PROFILE_ZONE("CPU output");
+				if (output)
+					output(frame);
+				break;
+			}
+			}
+			frame.stageMs[s] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+			busyMs[s] += frame.stageMs[s];
+			queues[s + 1].Push(slot);
+			if (stage == CpuStage::Output)
+			{
+				{
+					std::lock_guard<std::mutex> lock(doneMutex);
+					++done;
+				}
+				doneChanged.notify_all();
+			}
+		}
+	}
+
+	static bool SameWormhole(Wormhole const &a, Wormhole const &b)
+	{
+		return a.mass == b.mass && a.radius == b.radius && a.length == b.length;
+	}
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+// RenderBackend on D3D12 through WormholeRender, with its own device, queue and command list so
+// tools can use it without a window. Work is recorded until Readback or EndFrame, which submit
+// it and wait for the fence. Descriptor heap: the phi table SRV/UAV live at 0-1, 2-3 are scratch
+// for image creation, and each RenderPixels until the next Submit writes its skymap SRVs and
+// target UAV to a range of its own from 4 on, since the dispatches read them when they execute.
+// RenderPixels submits first when all renderSlots ranges are taken.
+// With a PhiTableCache, BuildPhiTable uploads cached tables and the ones it traces are read back
+// into the cache at the next Submit, so the CPU backend can use them too.
+
+#include "common.h"
+#include "RenderBackend.h"
+#include "DescriptorHeap.h"
+#include "RGBAImage.h"
+#include "WormholeRender.h"
+#include "GpuTimer.h"
+
+struct D3D12Backend : RenderBackend
+{
+	ComPtr<ID3D12Device2> device;
+	ComPtr<ID3D12CommandQueue> commandQueue;
+	ComPtr<ID3D12CommandAllocator> commandAllocator;
+	ComPtr<ID3D12GraphicsCommandList> commandList;
+	ComPtr<ID3D12Fence> fence;
+	HANDLE fenceEvent;
+	std::uint64_t fenceValue;
+
+	DescriptorHeapWrapper heap;
+	WormholeRender wormholeRender;
+	std::vector<std::unique_ptr<RGBAImageGPU>> images;
+	std::unique_ptr<D3D12TimestampBackend> timestamps;
+	Wormhole wormhole;		// of the last BuildPhiTable
+	float phiL, phiR;
+	std::size_t renderSlot;	// next descriptor range of RenderPixels, back to 0 at Submit
+
+	static std::size_t constexpr phiHeapOffset = 0;
+	static std::size_t constexpr scratchHeapOffset = 2;
+	static std::size_t constexpr renderHeapOffset = 4;	// skymap SRVs and target UAV of each RenderPixels
+	static std::size_t constexpr renderSlotSize = 3;
+	static std::size_t constexpr renderSlots = 16;
+
+	// warp selects the software rasterizer, for machines without a D3D12 GPU
+	explicit D3D12Backend(bool warp = false, PhiTableCache *cache = nullptr) :fenceEvent(nullptr), fenceValue(0), phiL(0.0f), phiR(0.0f), renderSlot(0)
+	{
+		ComPtr<IDXGIFactory4> factory;
+		ThrowIfFailed(CreateDXGIFactory2(0, IID_PPV_ARGS(&factory)));
+		if (warp)
+		{
+			ComPtr<IDXGIAdapter1> adapter;
+			ThrowIfFailed(factory->EnumWarpAdapter(IID_PPV_ARGS(&adapter)));
+			ThrowIfFailed(D3D12CreateDevice(adapter.Get(), D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&device)));
+		}
+		else
+			ThrowIfFailed(D3D12CreateDevice(nullptr, D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&device)));
+
+		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+		queueDesc.Priority = D3D12_COMMAND_QUEUE_PRIORITY_NORMAL;
+		queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+		ThrowIfFailed(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&commandQueue)));
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&commandAllocator)));
+		ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocator.Get(), nullptr, IID_PPV_ARGS(&commandList)));
+		ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+		fenceEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (!fenceEvent)
+			throw std::runtime_error("failed to create fence event");
+
+		heap = DescriptorHeapWrapper(device, renderHeapOffset + renderSlots * renderSlotSize, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+		wormholeRender = WormholeRender(device, commandList, heap, phiHeapOffset);
+		if (cache)
+			wormholeRender.EnablePhiTableCache(device, cache, 1);
+		timestamps = std::make_unique<D3D12TimestampBackend>(device, commandQueue, commandList, 1);
+	}
+
+	~D3D12Backend()
+	{
+		if (fenceEvent)
+		{
+			Submit();
+			::CloseHandle(fenceEvent);
+		}
+	}
+
+	D3D12Backend(D3D12Backend const &) = delete;
+	D3D12Backend &operator=(D3D12Backend const &) = delete;
+
+	// executes what was recorded, waits for it and reopens the command list
+	void Submit()
+	{
+		ThrowIfFailed(commandList->Close());
+		ID3D12CommandList *const lists[] = { commandList.Get() };
+		commandQueue->ExecuteCommandLists(_countof(lists), lists);
+		ThrowIfFailed(commandQueue->Signal(fence.Get(), ++fenceValue));
+		if (fence->GetCompletedValue() < fenceValue)
+		{
+			ThrowIfFailed(fence->SetEventOnCompletion(fenceValue, fenceEvent));
+			::WaitForSingleObject(fenceEvent, INFINITE);
+		}
+		ThrowIfFailed(commandAllocator->Reset());
+		ThrowIfFailed(commandList->Reset(commandAllocator.Get(), nullptr));
+		wormholeRender.BeginPhiTableFrame(0);
+		renderSlot = 0;
+	}
+
+	char const *Name() const override
+	{
+		return "D3D12";
+	}
+
+	BackendImage CreateImage(std::uint32_t width, std::uint32_t height) override
+	{
+		images.push_back(std::make_unique<RGBAImageGPU>(device, width, height, heap.at_cpu(scratchHeapOffset), heap.at_cpu(scratchHeapOffset + 1)));
+		return static_cast<BackendImage>(images.size() - 1);
+	}
+
+	void Upload(BackendImage image, float const *rgba) override
+	{
+		auto &img(*images.at(image));
+		RGBAImage staging;
+		staging.Setup(img.width, img.height);
+		std::copy(rgba, rgba + static_cast<std::size_t>(img.width) * img.height * 4, staging.data);
+		img.Upload(device, commandList, staging);
+		Submit(); // the upload buffer and the staging copy must outlive the copy
+	}
+
+	void BuildPhiTable(Wormhole const &w, float l, float r, std::uint32_t size) override
+	{
+		wormhole = w;
+		phiL = l;
+		phiR = r;
+		Camera cam;
+		cam.LookAtXM(XMVectorSet(r, 0.0f, 0.0f, 0.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		cam.SetL(l);
+		wormholeRender.phiTableSize = std::min(size, g_PhiCacheSize);
+		wormholeRender.FillPhiCache(commandList, cam, wormhole, heap, phiHeapOffset, timestamps.get());
+	}
+
+	void RenderPixels(BackendImage sky1, BackendImage sky2, BackendImage dst, RayCamera const &rayCam, Foveation const &foveation) override
+	{
+		auto &target(*images.at(dst));
+		if (rayCam.width > target.width || rayCam.height > target.height)
+			throw std::runtime_error("camera larger than the target image");
+		if (renderSlot == renderSlots)
+			Submit();
+		std::size_t skymapHeapOffset(renderHeapOffset + renderSlot++ * renderSlotSize), targetHeapOffset(skymapHeapOffset + 2);
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		BackendImage skymaps[2] = { sky1, sky2 };
+		for (std::size_t i(0); i < 2; ++i)
+		{
+			auto &sky(*images.at(skymaps[i]));
+			device->CreateShaderResourceView(sky.texture.Get(), &srvDesc, heap.at_cpu(skymapHeapOffset + i));
+			sky.AsComputeSRV(commandList);
+		}
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+		device->CreateUnorderedAccessView(target.texture.Get(), nullptr, &uavDesc, heap.at_cpu(targetHeapOffset));
+		target.AsUAV(commandList);
+
+		Camera cam;
+		XMVECTOR position(XMVectorSet(rayCam.position.x, rayCam.position.y, rayCam.position.z, 0.0f));
+		XMVECTOR forward(XMVectorSet(rayCam.forward.x, rayCam.forward.y, rayCam.forward.z, 0.0f));
+		cam.LookAtXM(position, position + forward, XMVectorSet(rayCam.up.x, rayCam.up.y, rayCam.up.z, 0.0f));
+		cam.SetL(phiL);
+		cam.SetResolutionFOV(rayCam.width, rayCam.height, rayCam.fovX, rayCam.fovY);
+		cam.SetOutputProjection(rayCam.projection, rayCam.fisheyeFov);
+		wormholeRender.foveation = foveation;
+		wormholeRender.jitterX = rayCam.jitterX;
+		wormholeRender.jitterY = rayCam.jitterY;
+		wormholeRender.Dispatch(commandList, cam, wormhole, heap, skymapHeapOffset, targetHeapOffset, phiHeapOffset, timestamps.get());
+	}
+
+	void Readback(BackendImage image, float *rgba) override
+	{
+		auto &img(*images.at(image));
+		img.Download(device, commandList);
+		Submit();
+		img.ReadDownloaded(rgba);
+	}
+
+	void BeginFrame() override
+	{
+		timestamps->BeginFrame(0);
+	}
+
+	void EndFrame() override
+	{
+		timestamps->EndFrame();
+		Submit();
+		// one slot: beginning it again reads back what the frame just resolved
+		timestamps->BeginFrame(0);
+	}
+
+	TimestampBackend &Timestamps() override
+	{
+		return *timestamps;
+	}
+};
@@ -0,0 +1,741 @@
+#pragma once
+
+// Frame sequences rendered by the CPU tile renderer of several processes or hosts. A coordinator
+// accepts worker connections over TCP and hands out work items, a rectangle of one frame
+// (64x64 pixels by default, whole 8x8 tiles) with its camera and foveation. Skymaps and phi
+// tables are named by a hash of their contents: before an item that needs one the worker does not
+// have yet, the coordinator sends it once, and each worker keeps what it was sent (the oldest
+// tables are evicted past tablesPerWorker), so a sequence with a fixed sky and a few camera
+// distances only moves work items and the traced pixels. Each worker has depth items in flight
+// to hide the round trip, answers them in order, and the items of a worker that disconnects are
+// handed to the others. Frames are delivered as soon as their last item arrives, not necessarily
+// in order. Messages are the raw structs, coordinator and workers must share the architecture
+// and build. On Windows include this before anything that includes Windows.h.
+
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "TileRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(_WIN32)
+using SocketHandle = SOCKET;
+SocketHandle constexpr g_InvalidSocket = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+SocketHandle constexpr g_InvalidSocket = -1;
+#endif
+
+// WSAStartup for the lifetime of the process's sockets, nothing elsewhere
+struct SocketLibrary
+{
+	SocketLibrary()
+	{
+#if defined(_WIN32)
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data))
+			throw std::runtime_error("WSAStartup failed");
+#endif
+	}
+
+	~SocketLibrary()
+	{
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+	}
+
+	SocketLibrary(SocketLibrary const &) = delete;
+	SocketLibrary &operator=(SocketLibrary const &) = delete;
+};
+
+// blocking TCP stream, Send and Receive throw std::runtime_error once the connection is gone
+struct TileSocket
+{
+	SocketHandle handle;
+
+	TileSocket() :handle(g_InvalidSocket)
+	{
+		;
+	}
+
+	explicit TileSocket(SocketHandle handle) :handle(handle)
+	{
+		;
+	}
+
+	~TileSocket()
+	{
+		Close();
+	}
+
+	TileSocket(TileSocket const &) = delete;
+	TileSocket &operator=(TileSocket const &) = delete;
+
+	TileSocket(TileSocket &&a) noexcept :handle(a.handle)
+	{
+		a.handle = g_InvalidSocket;
+	}
+
+	TileSocket &operator=(TileSocket &&a) noexcept
+	{
+		if (this != std::addressof(a))
+		{
+			Close();
+			handle = a.handle;
+			a.handle = g_InvalidSocket;
+		}
+		return *this;
+	}
+
+	void Close()
+	{
+		if (handle == g_InvalidSocket)
+			return;
+#if defined(_WIN32)
+		closesocket(handle);
+#else
+		close(handle);
+#endif
+		handle = g_InvalidSocket;
+	}
+
+	// port 0 picks a free port, see Port. loopback only accepts connections from this host.
+	static TileSocket Listen(std::uint16_t port, bool loopback)
+	{
+		TileSocket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+		if (socket.handle == g_InvalidSocket)
+			throw std::runtime_error("socket failed");
+		int reuse(1);
+		setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const *>(&reuse), sizeof(reuse));
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK : INADDR_ANY);
+		address.sin_port = htons(port);
+		if (bind(socket.handle, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) || listen(socket.handle, SOMAXCONN))
+			throw std::runtime_error("cannot listen on port " + std::to_string(port));
+		return socket;
+	}
+
+	std::uint16_t Port() const
+	{
+		sockaddr_in address{};
+		socklen_t length(sizeof(address));
+		getsockname(handle, reinterpret_cast<sockaddr *>(&address), &length);
+		return ntohs(address.sin_port);
+	}
+
+	TileSocket Accept() const
+	{
+		TileSocket connection(accept(handle, nullptr, nullptr));
+		if (connection.handle == g_InvalidSocket)
+			throw std::runtime_error("accept failed");
+		connection.NoDelay();
+		return connection;
+	}
+
+	static TileSocket Connect(std::string const &host, std::uint16_t port)
+	{
+		addrinfo hints{}, *found(nullptr);
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) || !found)
+			throw std::runtime_error("cannot resolve " + host);
+		TileSocket socket(::socket(found->ai_family, found->ai_socktype, found->ai_protocol));
+		bool connected(socket.handle != g_InvalidSocket && connect(socket.handle, found->ai_addr, static_cast<socklen_t>(found->ai_addrlen)) == 0);
+		freeaddrinfo(found);
+		if (!connected)
+			throw std::runtime_error("cannot connect to " + host + ":" + std::to_string(port));
+		socket.NoDelay();
+		return socket;
+	}
+
+	void Send(void const *data, std::size_t bytes)
+	{
+		char const *p(static_cast<char const *>(data));
+		while (bytes)
+		{
+			int chunk(static_cast<int>(std::min<std::size_t>(bytes, 1 << 30)));
+#if defined(MSG_NOSIGNAL)
+			auto sent(send(handle, p, chunk, MSG_NOSIGNAL));
+#else
+			auto sent(send(handle, p, chunk, 0));
+#endif
+			if (sent <= 0)
+				throw std::runtime_error("connection lost while sending");
+			p += sent;
+			bytes -= static_cast<std::size_t>(sent);
+		}
+	}
+
+	void Receive(void *data, std::size_t bytes)
+	{
+		char *p(static_cast<char *>(data));
+		while (bytes)
+		{
+			auto received(recv(handle, p, static_cast<int>(std::min<std::size_t>(bytes, 1 << 30)), 0));
+			if (received <= 0)
+				throw std::runtime_error("connection lost while receiving");
+			p += received;
+			bytes -= static_cast<std::size_t>(received);
+		}
+	}
+
+	template<typename T>
+	void Send(T const &value)
+	{
+		Send(&value, sizeof(T));
+	}
+
+	template<typename T>
+	T Receive()
+	{
+		T value;
+		Receive(&value, sizeof(T));
+		return value;
+	}
+
+private:
+	void NoDelay()
+	{
+		int on(1);
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const *>(&on), sizeof(on));
+	}
+};
+
+// 64 bit multiply-xor hash of bytes, 8 at a time, to name skymaps and tables by their contents
+inline std::uint64_t ContentHash(void const *data, std::size_t bytes, std::uint64_t h = 14695981039346656037ull)
+{
+	unsigned char const *p(static_cast<unsigned char const *>(data));
+	for (; bytes >= 8; p += 8, bytes -= 8)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, p, 8);
+		h = (h ^ word) * 1099511628211ull;
+		h ^= h >> 29;
+	}
+	for (; bytes; ++p, --bytes)
+		h = (h ^ *p) * 1099511628211ull;
+	return h;
+}
+
+inline std::uint64_t ContentHash(SkyView const &sky)
+{
+	std::uint32_t size[2] = { sky.width, sky.height };
+	return ContentHash(sky.data, static_cast<std::size_t>(sky.width) * sky.height * 4 * sizeof(float), ContentHash(size, sizeof(size)));
+}
+
+inline std::uint64_t ContentHash(PhiTable const &table)
+{
+	float parameters[5] = { table.wormhole.mass, table.wormhole.radius, table.wormhole.length, table.l, table.r };
+	std::uint64_t h(ContentHash(parameters, sizeof(parameters), ContentHash(&table.size, sizeof(table.size))));
+	return ContentHash(table.entries.data(), table.entries.size() * sizeof(table.entries[0]), h);
+}
+
+enum class TileMessage : std::uint32_t
+{
+	Sky,	// coordinator: TileSkyHeader and the floats
+	Table,	// coordinator: TileTableHeader and the entries
+	Evict,	// coordinator: hash of a table the worker may drop
+	Work,	// coordinator: TileWorkItem
+	Pixels,	// worker: TilePixelsHeader and the floats of the rectangle
+	Done	// coordinator: no more work, the worker returns
+};
+
+struct TileMessageHeader
+{
+	TileMessage type;
+	std::uint32_t pad;
+	std::uint64_t bytes; // of the payload that follows
+};
+
+struct TileSkyHeader
+{
+	std::uint64_t hash;
+	std::uint32_t width, height;
+};
+
+struct TileTableHeader
+{
+	std::uint64_t hash;
+	std::uint32_t size, entries;
+	Wormhole wormhole;
+	float l, r;
+};
+
+struct TileWorkItem
+{
+	std::uint64_t id; // the coordinator's, echoed back
+	std::uint32_t frame;
+	std::uint32_t x, y, width, height; // pixels of the frame, x and y multiples of g_TileSize
+	RayCamera camera;
+	Foveation foveation;
+	std::uint64_t sky1, sky2, table; // content hashes
+};
+
+struct TilePixelsHeader
+{
+	std::uint64_t id;
+	std::uint32_t width, height;
+	std::uint64_t rays;
+};
+
+// Hands out the tiles of a rectangle of the image, whole tiles from (x, y) in tiles
+struct TileRectQueue : SharedTileQueue
+{
+	std::uint32_t tilesX, x, y, columns, count;
+
+	TileRectQueue(SkyView const &sky1, SkyView const &sky2, unsigned threads, std::uint32_t tilesX, std::uint32_t x, std::uint32_t y, std::uint32_t columns, std::uint32_t rows)
+		:SharedTileQueue(sky1, sky2, threads), tilesX(tilesX), x(x), y(y), columns(columns), count(columns * rows)
+	{
+		;
+	}
+
+	bool Next(unsigned, std::uint32_t &tile)
+	{
+		std::uint32_t i(next++);
+		if (i >= count)
+			return false;
+		tile = (y + i / columns) * tilesX + x + i % columns;
+		return true;
+	}
+
+	template<typename Work>
+	void Run(std::uint32_t, std::uint32_t, Work const &work)
+	{
+		SharedTileQueue::Run(count, count, work);
+	}
+};
+
+// largest frame or skymap side a worker accepts, the D3D12 texture limit
+std::uint32_t constexpr g_TileMaxSide = 16384;
+
+struct TileWorkerStats
+{
+	std::uint64_t items, skies, tables, evictions, rays;
+};
+
+// Serves a coordinator until it sends Done: renders its work items with threads workers (0 every
+// hardware thread) and sends back their pixels. Throws if the connection is lost, and closes it
+// and throws on a message whose sizes do not match its payload or whose skymap, table or item
+// rectangle does not fit the sizes it declares, before anything is allocated or written for it.
+// drop, if set, is called with each work item before it is rendered; returning true closes the
+// connection without answering, as a worker that dies would, to exercise the coordinator's retry.
+inline TileWorkerStats ServeTiles(TileSocket &socket, unsigned threads = 0, std::function<bool(TileWorkItem const &)> const &drop = nullptr)
+{
+	TileWorkerStats stats{};
+	std::unordered_map<std::uint64_t, std::pair<std::vector<float>, SkyView>> skies;
+	std::unordered_map<std::uint64_t, PhiTable> tables;
+	std::vector<float> frame, rect; // frame sized target of the kernel, the item's pixels copied out of it
+	auto check([&](bool valid, char const *what) {
+		if (valid)
+			return;
+		socket.Close();
+		throw std::runtime_error(what);
+	});
+	for (;;)
+	{
+		auto header(socket.Receive<TileMessageHeader>());
+		switch (header.type)
+		{
+		case TileMessage::Sky:
+		{
+			check(header.bytes >= sizeof(TileSkyHeader), "malformed skymap message");
+			auto sky(socket.Receive<TileSkyHeader>());
+			check(sky.width != 0 && sky.height != 0 && sky.width <= g_TileMaxSide && sky.height <= g_TileMaxSide &&
+				  header.bytes == sizeof(TileSkyHeader) + static_cast<std::uint64_t>(sky.width) * sky.height * 4 * sizeof(float), "malformed skymap message");
+			auto &entry(skies[sky.hash]);
+			entry.first.resize(static_cast<std::size_t>(sky.width) * sky.height * 4);
+			socket.Receive(entry.first.data(), entry.first.size() * sizeof(float));
+			entry.second = { entry.first.data(), sky.width, sky.height };
+			++stats.skies;
+			break;
+		}
+		case TileMessage::Table:
+		{
+			check(header.bytes >= sizeof(TileTableHeader), "malformed phi table message");
+			auto info(socket.Receive<TileTableHeader>());
+			check(info.size >= 2 && info.size <= g_PhiCacheSize && info.size % 2 == 0 && info.entries == PhiTableStoredEntries(info.size) &&
+				  header.bytes == sizeof(TileTableHeader) + static_cast<std::uint64_t>(info.entries) * sizeof(decltype(PhiTable::entries)::value_type), "malformed phi table message");
+			PhiTable &table(tables[info.hash]);
+			table.size = info.size;
+			table.wormhole = info.wormhole;
+			table.l = info.l;
+			table.r = info.r;
+			table.entries.resize(info.entries);
+			socket.Receive(table.entries.data(), table.entries.size() * sizeof(table.entries[0]));
+			++stats.tables;
+			break;
+		}
+		case TileMessage::Evict:
+			check(header.bytes == sizeof(std::uint64_t), "malformed evict message");
+			tables.erase(socket.Receive<std::uint64_t>());
+			++stats.evictions;
+			break;
+		case TileMessage::Work:
+		{
+			check(header.bytes == sizeof(TileWorkItem), "malformed work item message");
+			auto item(socket.Receive<TileWorkItem>());
+			RayCamera const &cam(item.camera);
+			check(cam.width != 0 && cam.height != 0 && cam.width <= g_TileMaxSide && cam.height <= g_TileMaxSide && item.x % g_TileSize == 0 && item.y % g_TileSize == 0 &&
+				  item.width != 0 && item.height != 0 && item.x < cam.width && item.y < cam.height && item.width <= cam.width - item.x && item.height <= cam.height - item.y,
+				  "work item outside its frame");
+			auto sky1(skies.find(item.sky1)), sky2(skies.find(item.sky2));
+			auto table(tables.find(item.table));
+			check(sky1 != skies.end() && sky2 != skies.end() && table != tables.end(), "work item for a skymap or table the worker was not sent");
+			if (drop && drop(item))
+			{
+				socket.Close();
+				return stats;
+			}
+			frame.resize(static_cast<std::size_t>(cam.width) * cam.height * 4);
+			std::uint32_t tilesX((cam.width + g_TileSize - 1) / g_TileSize);
+			TileRectQueue queue(sky1->second.second, sky2->second.second, threads, tilesX, item.x / g_TileSize, item.y / g_TileSize,
+								(item.width + g_TileSize - 1) / g_TileSize, (item.height + g_TileSize - 1) / g_TileSize);
+			TileStats tileStats(SpecializeTileKernel(KernelOptions{ cam.projection, SkyFilter::Bilinear, PixelFormat::RGBA32F, 1 }, [&](auto const &constant) {
+				return RenderTilesScheduled(constant, table->second, sky1->second.second, sky2->second.second, cam, item.foveation, frame.data(), queue);
+			}));
+			rect.resize(static_cast<std::size_t>(item.width) * item.height * 4);
+			for (std::uint32_t y(0); y < item.height; ++y)
+				std::copy_n(frame.data() + ((static_cast<std::size_t>(item.y) + y) * cam.width + item.x) * 4, item.width * 4, rect.data() + static_cast<std::size_t>(y) * item.width * 4);
+			TilePixelsHeader pixels{ item.id, item.width, item.height, tileStats.rays };
+			socket.Send(TileMessageHeader{ TileMessage::Pixels, 0, sizeof(pixels) + rect.size() * sizeof(float) });
+			socket.Send(pixels);
+			socket.Send(rect.data(), rect.size() * sizeof(float));
+			++stats.items;
+			stats.rays += tileStats.rays;
+			break;
+		}
+		case TileMessage::Done:
+			check(header.bytes == 0, "malformed done message");
+			return stats;
+		default:
+			check(false, "unknown message");
+		}
+	}
+}
+
+// one frame of a sequence, the skymaps and table must outlive RenderFrames
+struct TileFrame
+{
+	RayCamera camera;
+	Foveation foveation;
+	std::shared_ptr<PhiTable const> table;
+	SkyView sky1, sky2;
+};
+
+struct TileCoordinatorStats
+{
+	std::uint64_t items, retried, rays;
+	std::uint64_t skyBytes, tableBytes, workBytes, pixelBytes; // sent and received over all connections
+};
+
+struct TileCoordinator
+{
+	std::vector<TileSocket> workers;
+	std::uint32_t itemSize;			// pixels per side of a work item, a multiple of g_TileSize
+	unsigned depth;					// work items in flight per worker
+	std::size_t tablesPerWorker;	// kept by each worker before the oldest is evicted
+	TileCoordinatorStats stats;
+
+	explicit TileCoordinator(std::uint32_t itemSize = 64, unsigned depth = 2, std::size_t tablesPerWorker = 8)
+		:itemSize(std::max(itemSize / g_TileSize, 1u) * g_TileSize), depth(std::max(depth, 1u)), tablesPerWorker(std::max<std::size_t>(tablesPerWorker, 1)), stats{}
+	{
+		;
+	}
+
+	// waits for count workers to connect
+	void Accept(TileSocket const &listener, unsigned count)
+	{
+		for (unsigned i(0); i < count; ++i)
+			workers.push_back(listener.Accept());
+	}
+
+	// Renders every frame on the workers, calling done(frame index, RGBA floats) once per frame as
+	// it completes, from the connection threads one at a time. A connection with nothing left to
+	// take waits while other connections have items in flight, since their workers may still
+	// disconnect and hand the items back. Throws if items were left over because every worker
+	// that could take them disconnected.
+	void RenderFrames(std::vector<TileFrame> const &frames, std::function<void(std::uint32_t, float const *)> const &done)
+	{
+		if (frames.empty())
+			return;
+		Run run(*this, frames, done);
+		std::vector<std::thread> connections;
+		for (auto &worker : workers)
+			connections.emplace_back([&run, &worker] { run.Serve(worker); });
+		for (auto &connection : connections)
+			connection.join();
+		std::uint64_t lost(run.Remaining());
+		workers.erase(std::remove_if(workers.begin(), workers.end(), [](TileSocket const &s) { return s.handle == g_InvalidSocket; }), workers.end());
+		if (lost)
+			throw std::runtime_error(std::to_string(lost) + " work items lost, no worker left to take them");
+	}
+
+	// tells the workers to return from ServeTiles
+	void Finish()
+	{
+		for (auto &worker : workers)
+		{
+			try
+			{
+				worker.Send(TileMessageHeader{ TileMessage::Done, 0, 0 });
+			}
+			catch (std::runtime_error const &)
+			{
+				;
+			}
+		}
+		workers.clear();
+	}
+
+private:
+	// state of one RenderFrames call, shared by the connection threads
+	struct Run
+	{
+		TileCoordinator &coordinator;
+		std::vector<TileFrame> const &frames;
+		std::function<void(std::uint32_t, float const *)> const &done;
+		std::uint32_t itemsX, itemsY;
+		std::uint64_t itemCount;
+		std::vector<std::uint64_t> skyHashes, tableHashes; // per frame, sky1 and sky2 interleaved
+
+		std::mutex mutex; // everything below, and the stats
+		std::condition_variable changed; // items to retry, or busy reached 0
+		std::uint64_t next;
+		std::vector<std::uint64_t> retry; // items of disconnected workers
+		unsigned busy; // connections with items in flight
+		std::uint64_t completed;
+		std::vector<std::vector<float>> pixels; // per frame, allocated by its first item
+		std::vector<std::uint32_t> pending; // items per frame still outstanding
+		std::mutex deliver; // done one frame at a time
+
+		Run(TileCoordinator &coordinator, std::vector<TileFrame> const &frames, std::function<void(std::uint32_t, float const *)> const &done)
+			:coordinator(coordinator), frames(frames), done(done), next(0), busy(0), completed(0), pixels(frames.size())
+		{
+			// every frame of a run has the resolution of the first
+			RayCamera const &cam(frames.front().camera);
+			itemsX = (cam.width + coordinator.itemSize - 1) / coordinator.itemSize;
+			itemsY = (cam.height + coordinator.itemSize - 1) / coordinator.itemSize;
+			itemCount = static_cast<std::uint64_t>(itemsX) * itemsY * frames.size();
+			pending.assign(frames.size(), itemsX * itemsY);
+			std::unordered_map<float const *, std::uint64_t> skyByData;
+			std::unordered_map<PhiTable const *, std::uint64_t> tableByPointer;
+			for (auto const &frame : frames)
+			{
+				if (frame.camera.width != cam.width || frame.camera.height != cam.height)
+					throw std::runtime_error("frames of one run must have the same resolution");
+				for (SkyView const *sky : { &frame.sky1, &frame.sky2 })
+				{
+					auto found(skyByData.find(sky->data));
+					skyHashes.push_back(found != skyByData.end() ? found->second : (skyByData[sky->data] = ContentHash(*sky)));
+				}
+				auto found(tableByPointer.find(frame.table.get()));
+				tableHashes.push_back(found != tableByPointer.end() ? found->second : (tableByPointer[frame.table.get()] = ContentHash(*frame.table)));
+			}
+		}
+
+		std::uint64_t Remaining()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return itemCount - completed;
+		}
+
+		// the next item for a connection, which counts as busy from then on (counted)
+		bool Take(std::uint64_t &item, bool &counted)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!retry.empty())
+			{
+				item = retry.back();
+				retry.pop_back();
+				++coordinator.stats.retried;
+			}
+			else if (next < itemCount)
+				item = next++;
+			else
+				return false;
+			if (!counted)
+			{
+				++busy;
+				counted = true;
+			}
+			return true;
+		}
+
+		// for a connection with nothing in flight and nothing to take: false once no other
+		// connection can hand items back, true when there are items to retry
+		bool WaitForRetry(bool &counted)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (counted)
+			{
+				counted = false;
+				if (--busy == 0)
+					changed.notify_all();
+			}
+			changed.wait(lock, [this] { return !retry.empty() || busy == 0; });
+			return !retry.empty();
+		}
+
+		TileWorkItem Item(std::uint64_t id) const
+		{
+			std::uint32_t frame(static_cast<std::uint32_t>(id / (static_cast<std::uint64_t>(itemsX) * itemsY)));
+			std::uint32_t index(static_cast<std::uint32_t>(id % (static_cast<std::uint64_t>(itemsX) * itemsY)));
+			RayCamera const &cam(frames[frame].camera);
+			std::uint32_t x(index % itemsX * coordinator.itemSize), y(index / itemsX * coordinator.itemSize);
+			return { id, frame, x, y, std::min(coordinator.itemSize, cam.width - x), std::min(coordinator.itemSize, cam.height - y), cam, frames[frame].foveation,
+					 skyHashes[frame * 2], skyHashes[frame * 2 + 1], tableHashes[frame] };
+		}
+
+		// the connection's side of the worker cache: what it was sent, tables oldest first
+		struct Sent
+		{
+			std::unordered_set<std::uint64_t> hashes;
+			std::deque<std::uint64_t> tables;
+		};
+
+		void SendResources(TileSocket &socket, Sent &sent, TileWorkItem const &item)
+		{
+			TileFrame const &frame(frames[item.frame]);
+			for (auto sky : { std::make_pair(item.sky1, &frame.sky1), std::make_pair(item.sky2, &frame.sky2) })
+			{
+				if (!sent.hashes.insert(sky.first).second)
+					continue;
+				std::size_t floats(static_cast<std::size_t>(sky.second->width) * sky.second->height * 4);
+				socket.Send(TileMessageHeader{ TileMessage::Sky, 0, sizeof(TileSkyHeader) + floats * sizeof(float) });
+				socket.Send(TileSkyHeader{ sky.first, sky.second->width, sky.second->height });
+				socket.Send(sky.second->data, floats * sizeof(float));
+				std::lock_guard<std::mutex> lock(mutex);
+				coordinator.stats.skyBytes += floats * sizeof(float);
+			}
+			if (sent.hashes.insert(item.table).second)
+			{
+				PhiTable const &table(*frame.table);
+				std::size_t entryBytes(table.entries.size() * sizeof(table.entries[0]));
+				socket.Send(TileMessageHeader{ TileMessage::Table, 0, sizeof(TileTableHeader) + entryBytes });
+				socket.Send(TileTableHeader{ item.table, table.size, static_cast<std::uint32_t>(table.entries.size()), table.wormhole, table.l, table.r });
+				socket.Send(table.entries.data(), entryBytes);
+				sent.tables.push_back(item.table);
+				// the worker handles messages in order, items already sent still find an evicted table
+				while (sent.tables.size() > coordinator.tablesPerWorker)
+				{
+					socket.Send(TileMessageHeader{ TileMessage::Evict, 0, sizeof(std::uint64_t) });
+					socket.Send(sent.tables.front());
+					sent.hashes.erase(sent.tables.front());
+					sent.tables.pop_front();
+				}
+				std::lock_guard<std::mutex> lock(mutex);
+				coordinator.stats.tableBytes += entryBytes;
+			}
+		}
+
+		void Serve(TileSocket &socket)
+		{
+			Sent sent;
+			std::deque<TileWorkItem> inFlight;
+			std::vector<float> rect;
+			bool counted(false); // in busy
+			try
+			{
+				for (;;)
+				{
+					std::uint64_t id;
+					while (inFlight.size() < coordinator.depth && Take(id, counted))
+					{
+						inFlight.push_back(Item(id));
+						SendResources(socket, sent, inFlight.back());
+						socket.Send(TileMessageHeader{ TileMessage::Work, 0, sizeof(TileWorkItem) });
+						socket.Send(inFlight.back());
+						std::lock_guard<std::mutex> lock(mutex);
+						coordinator.stats.workBytes += sizeof(TileWorkItem);
+					}
+					if (inFlight.empty())
+					{
+						if (!WaitForRetry(counted))
+							return;
+						continue;
+					}
+
+					auto header(socket.Receive<TileMessageHeader>());
+					auto answer(socket.Receive<TilePixelsHeader>());
+					TileWorkItem const &item(inFlight.front());
+					if (header.type != TileMessage::Pixels || answer.id != item.id || answer.width != item.width || answer.height != item.height ||
+						header.bytes != sizeof(TilePixelsHeader) + static_cast<std::uint64_t>(item.width) * item.height * 4 * sizeof(float))
+						throw std::runtime_error("unexpected answer from a worker");
+					rect.resize(static_cast<std::size_t>(item.width) * item.height * 4);
+					socket.Receive(rect.data(), rect.size() * sizeof(float));
+					Complete(item, rect, answer.rays);
+					inFlight.pop_front();
+				}
+			}
+			catch (std::runtime_error const &)
+			{
+				// the worker is gone, its items go to the others
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto const &item : inFlight)
+					retry.push_back(item.id);
+				if (counted)
+					--busy;
+				changed.notify_all();
+				socket.Close();
+			}
+		}
+
+		void Complete(TileWorkItem const &item, std::vector<float> const &rect, std::uint64_t rays)
+		{
+			std::uint32_t width(frames[item.frame].camera.width);
+			float *target;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto &frame(pixels[item.frame]);
+				if (frame.empty())
+					frame.resize(static_cast<std::size_t>(width) * frames[item.frame].camera.height * 4);
+				target = frame.data();
+			}
+			// items of a frame cover disjoint rectangles
+			for (std::uint32_t y(0); y < item.height; ++y)
+				std::copy_n(rect.data() + static_cast<std::size_t>(y) * item.width * 4, item.width * 4, target + ((static_cast<std::size_t>(item.y) + y) * width + item.x) * 4);
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				++completed;
+				++coordinator.stats.items;
+				coordinator.stats.rays += rays;
+				coordinator.stats.pixelBytes += rect.size() * sizeof(float);
+				last = --pending[item.frame] == 0;
+			}
+			if (!last)
+				return;
+			{
+				std::lock_guard<std::mutex> lock(deliver);
+				done(item.frame, target);
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<float>().swap(pixels[item.frame]);
+		}
+	};
+};
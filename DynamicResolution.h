@@ -0,0 +1,74 @@
+#pragma once
+
+// Scales the internal render resolution (and the phi table with it) to keep the measured GPU
+// time of the frame at a target. The cost of the scaled passes goes roughly with the pixel
+// count, scale², so the controller steps scale by sqrt(budget / cost), with a dead band so it
+// does not oscillate and a limited step per update. Timings arrive g_NumFrames late, after a
+// change it waits that many updates before judging the new resolution.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+struct DynamicResolution
+{
+	float targetMs;		// whole frame, GPU
+	float minScale, maxScale;
+	float scale;		// of the full internal resolution, per axis
+	float deadBand;		// relative error of the cost left alone
+	float maxStep;		// relative change of scale per update
+	std::uint32_t settleFrames;
+	std::uint32_t waiting;
+	float smoothedMs;	// scaled passes, exponential average
+
+	DynamicResolution(float targetMs = 1000.0f / 60.0f, std::uint32_t settleFrames = 3) :
+		targetMs(targetMs), minScale(0.25f), maxScale(1.0f), scale(1.0f), deadBand(0.1f), maxStep(0.15f),
+		settleFrames(settleFrames), waiting(0), smoothedMs(0.0f)
+	{
+		;
+	}
+
+	// scaledMs: passes whose cost follows the resolution, fixedMs: the rest (screen quad, UI)
+	// returns true if the scale changed
+	bool Update(float scaledMs, float fixedMs)
+	{
+		if (scaledMs <= 0.0f)
+			return false;
+		if (waiting)
+		{
+			--waiting;
+			smoothedMs = scaledMs;
+			return false;
+		}
+		smoothedMs = smoothedMs > 0.0f ? smoothedMs + (scaledMs - smoothedMs) * 0.3f : scaledMs;
+
+		float budget(std::max(targetMs - fixedMs, targetMs * 0.1f));
+		float ratio(budget / smoothedMs);
+		if (std::abs(ratio - 1.0f) < deadBand)
+			return false;
+
+		float step(std::min(std::max(std::sqrt(ratio), 1.0f - maxStep), 1.0f + maxStep));
+		float next(std::min(std::max(scale * step, minScale), maxScale));
+		next = std::round(next * 64.0f) / 64.0f; // coarse steps, fewer resolution changes
+		if (next == scale)
+			return false;
+		scale = next;
+		waiting = settleFrames;
+		return true;
+	}
+
+	// multiple of 8 so the 32x32 groups of the wormhole pass stay mostly full
+	std::uint32_t Scaled(std::uint32_t full) const
+	{
+		auto v(static_cast<std::uint32_t>(std::lround(static_cast<float>(full) * scale / 8.0f)) * 8u);
+		return std::min(std::max(v, 8u), full);
+	}
+
+	// the table needs about as many entries per radian as the screen has pixels, even and at
+	// least a quarter of the full size
+	std::uint32_t PhiTableSize(std::uint32_t full) const
+	{
+		auto v(static_cast<std::uint32_t>(std::lround(static_cast<float>(full) * scale / 256.0f)) * 256u);
+		return std::min(std::max(v, full / 4), full);
+	}
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+// The lensed sky depends on the camera position (l, r and the direction to the throat) and the
+// wormhole, not on where the camera looks. EnvironmentCache traces it once over the whole sphere
+// into an environment map (wormhole_environment.hlsl, dir2uv parameterization) and renders each
+// frame by resampling that map with the camera orientation (environment_resample.hlsl), so mouse
+// look and roll cost a texture fetch per pixel instead of the full per pixel pass.
+//
+// The map is slightly denser than the default view along the equator (denser still towards the
+// poles), 75M texels or the rays of about 36 frames at 1080p. It is only traced once the camera
+// has stayed at the same position for a frame, and then g_EnvironmentRowsPerFrame rows per frame:
+// a rebuild spreads over 24 frames that each cost a direct frame plus a band of about 1.5
+// frames, instead of one frame tracing the whole sphere. Until the map is complete, and while
+// moving, frames are rendered directly by WormholeRender as before.
+
+#include "common.h"
+#include "Wormhole.h"
+#include "Camera.h"
+#include "DescriptorHeap.h"
+#include "GpuTimer.h"
+#include "WormholeRender.h"
+
+// 34 texels per degree along the equator, vs 30 pixels per degree of the 1920 wide 65 degree view
+// (a wider window or a narrower field of view undersamples the map). 288 MB in RGBA8.
+std::uint32_t constexpr g_EnvironmentWidth = 12288;
+std::uint32_t constexpr g_EnvironmentHeight = 6144;
+// rows traced per frame while the map is built, a multiple of the 32 rows of a thread group
+std::uint32_t constexpr g_EnvironmentRowsPerFrame = 256;
+
+// everything the lensed environment depends on
+struct EnvironmentKey
+{
+	XMFLOAT3 position;
+	float l;
+	Wormhole wormhole;
+
+	EnvironmentKey() :position(), l(0.0f), wormhole()
+	{
+		;
+	}
+
+	EnvironmentKey(Camera const &cam, Wormhole const &wormhole) :position(cam.GetPosition()), l(cam.GetL()), wormhole(wormhole)
+	{
+		;
+	}
+
+	bool operator==(EnvironmentKey const &o) const
+	{
+		return position.x == o.position.x && position.y == o.position.y && position.z == o.position.z && l == o.l &&
+			wormhole.mass == o.wormhole.mass && wormhole.radius == o.wormhole.radius && wormhole.length == o.wormhole.length;
+	}
+
+	bool operator!=(EnvironmentKey const &o) const
+	{
+		return !(*this == o);
+	}
+};
+
+struct EnvironmentCache
+{
+	ComPtr<ID3D12PipelineState> pipelineStateTrace; // uses the root signature of WormholeRender
+	ComPtr<ID3D12PipelineState> pipelineStateResample;
+	ComPtr<ID3D12RootSignature> rootSignatureResample;
+	ComPtr<ID3D12Resource> environment;
+	D3D12_RESOURCE_STATES state;
+
+	bool valid;
+	std::uint32_t tracedRows;	// rows of the map traced so far for cached, all of them when valid
+	EnvironmentKey cached;		// what the environment map holds (when valid) or is being traced for
+	EnvironmentKey lastFrame;	// position of the previous frame, to tell a stationary camera
+
+	EnvironmentCache() :state(D3D12_RESOURCE_STATE_COMMON), valid(false), tracedRows(0)
+	{
+		;
+	}
+
+	EnvironmentCache(EnvironmentCache const &a) = delete;
+	EnvironmentCache &operator=(EnvironmentCache const &a) = delete;
+
+	EnvironmentCache(EnvironmentCache &&a) noexcept
+	{
+		*this = std::move(a);
+	}
+
+	EnvironmentCache &operator=(EnvironmentCache &&a) noexcept
+	{
+		if (this != std::addressof(a))
+		{
+			pipelineStateTrace = std::move(a.pipelineStateTrace);
+			pipelineStateResample = std::move(a.pipelineStateResample);
+			rootSignatureResample = std::move(a.rootSignatureResample);
+			environment = std::move(a.environment);
+			state = a.state;
+			valid = a.valid;
+			tracedRows = a.tracedRows;
+			cached = a.cached;
+			lastFrame = a.lastFrame;
+			a.state = D3D12_RESOURCE_STATE_COMMON;
+			a.valid = false;
+			a.tracedRows = 0;
+		}
+		return *this;
+	}
+
+	// SRV of the environment map at heapOffset, UAV at heapOffset + 1
+	EnvironmentCache(ComPtr<ID3D12Device2> device, WormholeRender const &wormholeRender, DescriptorHeapWrapper &heap, std::size_t heapOffset) :state(D3D12_RESOURCE_STATE_COMMON), valid(false), tracedRows(0)
+	{
+		D3D12_RESOURCE_DESC textureDesc = {};
+		textureDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+		textureDesc.Alignment = 0;
+		textureDesc.Width = g_EnvironmentWidth;
+		textureDesc.Height = g_EnvironmentHeight;
+		textureDesc.DepthOrArraySize = 1;
+		textureDesc.MipLevels = 1;
+		textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; // the skymaps are 8 bit, float4 would be 512 MB
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.SampleDesc.Quality = 0;
+		textureDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+		textureDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+		THROW(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&textureDesc,
+			state,
+			nullptr,
+			IID_PPV_ARGS(&environment)
+		));
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = textureDesc.Format;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		device->CreateShaderResourceView(environment.Get(), &srvDesc, heap.at_cpu(heapOffset));
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.Format = textureDesc.Format;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+		uavDesc.Texture2D.MipSlice = 0;
+		device->CreateUnorderedAccessView(environment.Get(), nullptr, &uavDesc, heap.at_cpu(heapOffset + 1));
+
+		// the trace has the bindings of wormhole.hlsl
+		{
+			ComPtr<ID3DBlob> computeShaderBlob;
+			ThrowIfFailed(D3DReadFileToBlob(L"wormhole_environment.cso", &computeShaderBlob));
+
+			D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+			psoDesc.pRootSignature = wormholeRender.rootSignature.Get();
+			psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+			ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStateTrace)));
+		}
+
+		ComPtr<ID3DBlob> computeShaderBlob;
+		ThrowIfFailed(D3DReadFileToBlob(L"environment_resample.cso", &computeShaderBlob));
+
+		D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+		if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+			featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+		D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
+
+		CD3DX12_ROOT_PARAMETER1 rootParameters[3] = {};
+
+		rootParameters[0].InitAsConstants(20, 0); // camera
+		auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+		rootParameters[1].InitAsDescriptorTable(1, std::addressof(r1));
+		auto r2 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+		rootParameters[2].InitAsDescriptorTable(1, std::addressof(r2));
+
+		// wraps around in azimuth, clamps at the poles
+		D3D12_STATIC_SAMPLER_DESC sampler = {};
+		sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+		sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+		sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+		sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+		sampler.MipLODBias = 0;
+		sampler.MaxAnisotropy = 0;
+		sampler.ComparisonFunc = D3D12_COMPARISON_FUNC_NEVER;
+		sampler.BorderColor = D3D12_STATIC_BORDER_COLOR_TRANSPARENT_BLACK;
+		sampler.MinLOD = 0.0f;
+		sampler.MaxLOD = D3D12_FLOAT32_MAX;
+		sampler.ShaderRegister = 0;
+		sampler.RegisterSpace = 0;
+		sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+		CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription{};
+		rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 1, std::addressof(sampler), rootSignatureFlags);
+
+		ComPtr<ID3DBlob> rootSignatureBlob;
+		ComPtr<ID3DBlob> errorBlob;
+		auto hr = D3DX12SerializeVersionedRootSignature(&rootSignatureDescription,
+			featureData.HighestVersion, &rootSignatureBlob, &errorBlob);
+		if (FAILED(hr))
+		{
+			std::string errorString;
+
+			if (errorBlob)
+			{
+				errorString.append(": ");
+
+				errorString.append(
+					reinterpret_cast<char *>(
+					errorBlob->GetBufferPointer()),
+					errorBlob->GetBufferSize());
+				MessageBoxA(NULL, errorString.c_str(), "EnvironmentCache", MB_OK | MB_ICONERROR);
+			}
+			__debugbreak();
+		}
+		ThrowIfFailed(device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(),
+			rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&rootSignatureResample)));
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+		psoDesc.pRootSignature = rootSignatureResample.Get();
+		psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+
+		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStateResample)));
+	}
+
+	void Invalidate()
+	{
+		valid = false;
+		tracedRows = 0;
+	}
+
+	void Transition(ComPtr<ID3D12GraphicsCommandList> commandList, D3D12_RESOURCE_STATES to)
+	{
+		if (state != to)
+			commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(environment.Get(), state, to));
+		state = to;
+	}
+
+	// Same arguments as WormholeRender::Render plus the environment SRV offset (UAV follows it).
+	// Renders into the same destination, directly while the camera moves and while the map is
+	// being traced.
+	void Render(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		WormholeRender &wormholeRender,
+		Camera &cam,
+		Wormhole &wormhole,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t srcTextureSRVHeapOffset,
+		std::size_t dstTextureUAVHeapOffset,
+		std::size_t emptyPhiCacheUAVHeapOffset,
+		std::size_t environmentSRVHeapOffset,
+		TimestampBackend *timestamps = nullptr
+	)
+	{
+		EnvironmentKey key(cam, wormhole);
+		bool stationary(key == lastFrame);
+		lastFrame = key;
+		if (!valid || key != cached)
+		{
+			valid = false;
+			if (!stationary)
+			{
+				tracedRows = 0;
+				wormholeRender.Render(commandList, cam, wormhole, textureHeap, srcTextureSRVHeapOffset, dstTextureUAVHeapOffset, emptyPhiCacheUAVHeapOffset, timestamps);
+				return;
+			}
+			if (key != cached)
+			{
+				cached = key;
+				tracedRows = 0;
+			}
+			wormholeRender.FillPhiCache(commandList, cam, wormhole, textureHeap, emptyPhiCacheUAVHeapOffset, timestamps);
+			Trace(commandList, wormholeRender, cam, wormhole, textureHeap, srcTextureSRVHeapOffset, emptyPhiCacheUAVHeapOffset, environmentSRVHeapOffset, timestamps);
+			if (tracedRows < g_EnvironmentHeight)
+			{
+				wormholeRender.Dispatch(commandList, cam, wormhole, textureHeap, srcTextureSRVHeapOffset, dstTextureUAVHeapOffset, emptyPhiCacheUAVHeapOffset, timestamps);
+				return;
+			}
+			valid = true;
+		}
+		Resample(commandList, cam, textureHeap, dstTextureUAVHeapOffset, environmentSRVHeapOffset, timestamps);
+	}
+
+	// the next g_EnvironmentRowsPerFrame rows of the map, with the phi table of the last FillPhiCache
+
+	void Trace(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		WormholeRender &wormholeRender,
+		Camera &cam,
+		Wormhole &wormhole,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t srcTextureSRVHeapOffset,
+		std::size_t emptyPhiCacheUAVHeapOffset,
+		std::size_t environmentSRVHeapOffset,
+		TimestampBackend *timestamps
+	)
+	{
+		PROFILE_ZONE("Environment trace");
+		ScopedTimestamp timestamp(timestamps, RenderPass::Environment);
+		Transition(commandList, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		commandList->SetPipelineState(pipelineStateTrace.Get());
+		commandList->SetComputeRootSignature(wormholeRender.rootSignature.Get());
+
+		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
+		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+		// the camera constants of wormhole.hlsl with only the position, the first row of the band
+		// and the size of the map
+		std::uint32_t rows(std::min(g_EnvironmentRowsPerFrame, g_EnvironmentHeight - tracedRows));
+		struct
+		{
+			XMVECTOR position;
+			std::uint32_t firstRow;
+			std::uint32_t pad[13];
+			float width;
+			float height;
+		} cam_data{ cam.GetPositionXM(),tracedRows,{},static_cast<float>(g_EnvironmentWidth),static_cast<float>(g_EnvironmentHeight) };
+
+		struct
+		{
+			std::uint32_t size;
+			std::uint32_t pad1, pad2, pad3;
+		} cache_size{ wormholeRender.phiTableSize, 0, 0, 0 };
+
+		static_assert(sizeof(cam_data) == 20 * 4);
+
+		commandList->SetComputeRoot32BitConstants(0, 20, &cam_data, 0);
+		commandList->SetComputeRoot32BitConstants(1, 4, &wormhole, 0);
+		commandList->SetComputeRoot32BitConstants(2, 4, &cache_size, 0);
+		commandList->SetComputeRootDescriptorTable(3, textureHeap.at_gpu(srcTextureSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(4, textureHeap.at_gpu(environmentSRVHeapOffset + 1));
+		commandList->SetComputeRootDescriptorTable(5, textureHeap.at_gpu(emptyPhiCacheUAVHeapOffset));
+
+		commandList->Dispatch((g_EnvironmentWidth - 1) / 32 + 1, (rows - 1) / 32 + 1, 1);
+		tracedRows += rows;
+	}
+
+	void Resample(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		Camera &cam,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t dstTextureUAVHeapOffset,
+		std::size_t environmentSRVHeapOffset,
+		TimestampBackend *timestamps
+	)
+	{
+		PROFILE_ZONE("Environment resample");
+		ScopedTimestamp timestamp(timestamps, RenderPass::EnvironmentResample);
+		Transition(commandList, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		commandList->SetPipelineState(pipelineStateResample.Get());
+		commandList->SetComputeRootSignature(rootSignatureResample.Get());
+
+		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
+		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+		struct
+		{
+			XMVECTOR position;
+			XMVECTOR forward;
+			XMVECTOR up;
+			XMVECTOR right;
+			float fovX;
+			float fovY;
+			float width;
+			float height;
+		} cam_data{ cam.GetPositionXM(),cam.GetLookDirXM(),cam.GetUpXM(),cam.GetRightXM(),cam.GetFovX(),cam.GetFovY(),static_cast<float>(cam.GetWidth()),static_cast<float>(cam.GetHeight()) };
+
+		static_assert(sizeof(cam_data) == 20 * 4);
+
+		commandList->SetComputeRoot32BitConstants(0, 20, &cam_data, 0);
+		commandList->SetComputeRootDescriptorTable(1, textureHeap.at_gpu(environmentSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(2, textureHeap.at_gpu(dstTextureUAVHeapOffset));
+
+		UINT groupX(((cam.GetWidth() - 1) / 32) + 1);
+		UINT groupY(((cam.GetHeight() - 1) / 32) + 1);
+
+		commandList->Dispatch(groupX, groupY, 1);
+	}
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+// Shading rate of the 8x8 tiles of the per pixel pass, shared by the CPU tile renderer and
+// wormhole_foveated.hlsl (which repeats Rate).
+
+#include <cmath>
+#include <cstdint>
+
+std::uint32_t constexpr g_TileSize = 8;
+
+struct Foveation
+{
+	bool enabled;
+	float centerX, centerY;				// fovea, fractions of the width and height
+	float innerRadius, outerRadius;		// fractions of the height, full rate inside inner, quarter rate beyond outer
+	float refineAngle;					// traced angle difference between samples that forces full rate, in sample spacings
+
+	Foveation() :enabled(false), centerX(0.5f), centerY(0.5f), innerRadius(0.2f), outerRadius(0.45f), refineAngle(8.0f)
+	{
+		;
+	}
+
+	// pixels per traced sample along each axis for the tile whose top left pixel is (x, y)
+	std::uint32_t Rate(std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height) const
+	{
+		if (!enabled)
+			return 1;
+		float dx((static_cast<float>(x + g_TileSize / 2) - centerX * static_cast<float>(width)) / static_cast<float>(height));
+		float dy((static_cast<float>(y + g_TileSize / 2) - centerY * static_cast<float>(height)) / static_cast<float>(height));
+		float d(std::sqrt(dx * dx + dy * dy));
+		return d < innerRadius ? 1 : (d < outerRadius ? 2 : 4);
+	}
+};
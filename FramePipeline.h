@@ -0,0 +1,141 @@
+#pragma once
+
+// Update and render on separate threads: the update thread samples input, moves the camera and
+// publishes an immutable frame snapshot into a triple buffer at its own rate, the render thread
+// takes the newest snapshot right before recording a frame. Neither waits for the other, so
+// input is sampled after the render thread's fence wait instead of before it, and a slow frame
+// never stalls input polling. Free of D3D12, main.cc and the headless tool share it.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Single producer, single consumer triple buffer. The writer fills Back() and publishes it, the
+// reader picks up the newest published slot; both only swap indices, nothing is copied or locked.
+template<typename T>
+struct TripleBuffer
+{
+	static std::uint32_t constexpr freshBit = 4;	// the middle slot was published since the reader last took it
+	static std::uint32_t constexpr indexMask = 3;
+
+	std::array<T, 3> slots;
+	std::atomic<std::uint32_t> middle;
+	std::uint32_t back;		// writer's slot
+	std::uint32_t front;	// reader's slot
+
+	TripleBuffer() :slots(), middle(1), back(0), front(2)
+	{
+		;
+	}
+
+	TripleBuffer(TripleBuffer const &) = delete;
+	TripleBuffer &operator=(TripleBuffer const &) = delete;
+
+	// writer side
+	T &Back()
+	{
+		return slots[back];
+	}
+
+	void Publish()
+	{
+		back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+	}
+
+	// reader side, true if Front() changed to a newer snapshot
+	bool Acquire()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & freshBit))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+
+	T const &Front() const
+	{
+		return slots[front];
+	}
+};
+
+// Calls tick(seconds since the last call) on its own thread hz times a second until Stop. A late
+// tick is not made up for, the next one is scheduled from now.
+struct FixedRateThread
+{
+	std::thread thread;
+	std::atomic<bool> running;
+
+	FixedRateThread() :running(false)
+	{
+		;
+	}
+
+	~FixedRateThread()
+	{
+		Stop();
+	}
+
+	FixedRateThread(FixedRateThread const &) = delete;
+	FixedRateThread &operator=(FixedRateThread const &) = delete;
+
+	void Start(double hz, std::function<void(double)> tick)
+	{
+		Stop();
+		running = true;
+		thread = std::thread([this, hz, tick] {
+			using Clock = std::chrono::steady_clock;
+			auto interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz)));
+			auto last(Clock::now()), next(last);
+			while (running.load(std::memory_order_relaxed))
+			{
+				auto now(Clock::now());
+				tick(std::chrono::duration<double>(now - last).count());
+				last = now;
+				next += interval;
+				if (next < Clock::now())
+					next = Clock::now() + interval;
+				std::this_thread::sleep_until(next);
+			}
+		});
+	}
+
+	void Stop()
+	{
+		running = false;
+		if (thread.joinable())
+			thread.join();
+	}
+};
+
+// Age of a snapshot's input when its frame is submitted (input to submit latency), mean and max
+// over the frames since the last Reset.
+struct SnapshotLatency
+{
+	double sumMs, maxMs;
+	std::uint64_t frames;
+
+	SnapshotLatency() :sumMs(0.0), maxMs(0.0), frames(0)
+	{
+		;
+	}
+
+	void Add(std::chrono::steady_clock::time_point sampled)
+	{
+		double ms(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sampled).count());
+		sumMs += ms;
+		maxMs = maxMs > ms ? maxMs : ms;
+		++frames;
+	}
+
+	double MeanMs() const
+	{
+		return frames ? sumMs / static_cast<double>(frames) : 0.0;
+	}
+
+	void Reset()
+	{
+		*this = SnapshotLatency();
+	}
+};
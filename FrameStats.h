@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <cmath>
+
+// per-frame timing samples in milliseconds and the summary we compare between runs
+struct FrameTimingStats
+{
+	std::vector<float> frameTimes; // ms
+
+	struct Summary
+	{
+		std::size_t frames;
+		float mean;
+		float p50;
+		float p99;
+		float max;
+	};
+
+	void Reset()
+	{
+		frameTimes.clear();
+	}
+
+	void Add(float frameTime_ms)
+	{
+		frameTimes.push_back(frameTime_ms);
+	}
+
+	std::size_t Count() const { return frameTimes.size(); }
+
+	// nearest-rank percentile, p in [0, 100]
+	static float Percentile(std::vector<float> const &sorted, float p)
+	{
+		if (sorted.empty())
+			return 0.0f;
+		std::size_t rank(static_cast<std::size_t>(std::ceil(p / 100.0f * static_cast<float>(sorted.size()))));
+		rank = std::min(std::max<std::size_t>(rank, 1), sorted.size());
+		return sorted[rank - 1];
+	}
+
+	Summary Summarize() const
+	{
+		Summary s{ frameTimes.size(), 0.0f, 0.0f, 0.0f, 0.0f };
+		if (frameTimes.empty())
+			return s;
+		std::vector<float> sorted(frameTimes);
+		std::sort(sorted.begin(), sorted.end());
+		s.mean = static_cast<float>(std::accumulate(sorted.begin(), sorted.end(), 0.0) / static_cast<double>(sorted.size()));
+		s.p50 = Percentile(sorted, 50.0f);
+		s.p99 = Percentile(sorted, 99.0f);
+		s.max = sorted.back();
+		return s;
+	}
+
+	std::string FormatSummary() const
+	{
+		auto s(Summarize());
+		char buffer[256];
+		std::snprintf(buffer, sizeof(buffer), "frames: %zu, mean: %.3f ms, p50: %.3f ms, p99: %.3f ms, max: %.3f ms\n",
+					  s.frames, s.mean, s.p50, s.p99, s.max);
+		return buffer;
+	}
+
+	// summary plus the raw samples, so runs can be diffed frame by frame
+	bool WriteJSON(std::string const &filename) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+			return false;
+		auto s(Summarize());
+		file << std::fixed << std::setprecision(4);
+		file << "{\n";
+		file << "  \"frames\": " << s.frames << ",\n";
+		file << "  \"mean_ms\": " << s.mean << ",\n";
+		file << "  \"p50_ms\": " << s.p50 << ",\n";
+		file << "  \"p99_ms\": " << s.p99 << ",\n";
+		file << "  \"max_ms\": " << s.max << ",\n";
+		file << "  \"frame_times_ms\": [";
+		for (std::size_t i(0); i < frameTimes.size(); ++i)
+			file << (i ? ", " : "") << frameTimes[i];
+		file << "]\n}\n";
+		return static_cast<bool>(file);
+	}
+};
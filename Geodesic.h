@@ -0,0 +1,273 @@
+#pragma once
+
+// CPU port of the equatorial geodesic tracing in equatorial_phi_mapping.hlsl. Kept free of
+// Windows and D3D headers so tools and the CPU renderers can share it.
+
+#include "Wormhole.h"
+#include "SimdMath.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace geodesic
+{
+	template<typename T>
+	T constexpr Pi = static_cast<T>(3.141592653589793238462643383279502884197169399375105820974);
+	template<typename T>
+	T constexpr TwoPi = static_cast<T>(6.283185307179586476925286766559005768394338798750211641949);
+
+	// (l, φ, p_l) of a ray in the equatorial plane
+	template<typename T>
+	struct State
+	{
+		T l, phi, pl;
+
+		State operator+(State const &o) const { return { l + o.l, phi + o.phi, pl + o.pl }; }
+		State operator*(T s) const { return { l * s, phi * s, pl * s }; }
+	};
+
+	// what the phi table stores: direction in the camera plane and l at the end of the trace
+	template<typename T>
+	struct Traced
+	{
+		T phi, l;
+	};
+
+	// per ray constants of motion, b = p_φ and B² = r² n_φ² at the camera
+	template<typename T>
+	struct Ray
+	{
+		T b, B_sqr;
+	};
+
+	template<typename T>
+	T Sign(T x)
+	{
+		return static_cast<T>((x > T(0)) - (x < T(0)));
+	}
+
+	template<typename T>
+	State<T> NullGeodesic2D(State<T> const &s, T a, T M, T rho, Ray<T> const &ray)
+	{
+		T outside_wormhole(std::abs(s.l) > a ? T(1) : T(0));
+
+		T x(T(2) * (std::abs(s.l) - a) / (Pi<T> * M));
+		T atanx(std::atan(x));
+
+		// r (5)
+		T r(rho + outside_wormhole * (M * (x * atanx - T(0.5) * std::log(T(1) + x * x))));
+		// dr/dl
+		T dr_dl(outside_wormhole * (atanx * T(2) * Sign(s.l) / Pi<T>));
+
+		// dl/dt (A.7a), dφ/dt (A.7c), dp_l/dt (A.7d)
+		return { s.pl, ray.b / (r * r), ray.B_sqr * dr_dl / (r * r * r) };
+	}
+
+	template<typename T>
+	State<T> RK4Step(State<T> const &s, T h, Wormhole const &w, Ray<T> const &ray)
+	{
+		T a(w.length), M(w.mass), rho(w.radius);
+		State<T> k1(NullGeodesic2D(s, a, M, rho, ray) * h);
+		State<T> k2(NullGeodesic2D(s + k1 * T(0.5), a, M, rho, ray) * h);
+		State<T> k3(NullGeodesic2D(s + k2 * T(0.5), a, M, rho, ray) * h);
+		State<T> k4(NullGeodesic2D(s + k3, a, M, rho, ray) * h);
+		return s + (k1 + k2 * T(2) + k3 * T(2) + k4) * (T(1) / T(6));
+	}
+
+	template<typename T>
+	Ray<T> MakeRay(T phi, T r, State<T> &start, T l)
+	{
+		T n_l(std::cos(phi));
+		T n_phi(-std::sin(phi));
+		start = { l, T(0), n_l };
+		return { r * n_phi, r * r * (n_phi * n_phi) };
+	}
+
+	// direction of the chord between two states, folded like the shader does
+	template<typename T>
+	Traced<T> ChordDirection(State<T> const &s1, State<T> const &s2)
+	{
+		T x1(s1.l * std::cos(s1.phi)), y1(s1.l * std::sin(s1.phi));
+		T x2(s2.l * std::cos(s2.phi)), y2(s2.l * std::sin(s2.phi));
+		T phi_traced(std::fmod(std::atan2(y2 - y1, x2 - x1) + TwoPi<T>, TwoPi<T>));
+		return { -phi_traced, s2.l };
+	}
+
+	// Fixed step RK4, the shader uses steps = 10000 and h = 0.01, then one step of 10h for the
+	// outgoing direction. phi is the ray direction at the camera, l and r the camera position.
+	// steps may be a std::integral_constant to give the loop a compile time trip count.
+	template<typename T, typename Steps = int>
+	Traced<T> PhiMapping(T phi, T l, T r, Wormhole const &w, Steps steps = 10000, T h = T(0.01))
+	{
+		State<T> s;
+		Ray<T> ray(MakeRay(phi, r, s, l));
+		for (int i(0); i < steps; ++i)
+			s = RK4Step(s, h, w, ray);
+		return ChordDirection(s, RK4Step(s, h * T(10), w, ray));
+	}
+
+	// One Dormand-Prince 5(4) step from s with k1 = f(s). Returns the 5th order solution, k7 = f(next)
+	// (first same as last) and the difference to the embedded 4th order solution.
+	template<typename T, typename F>
+	State<T> DormandPrinceStep(F &&f, State<T> const &s, State<T> const &k1, T h, State<T> &k7, State<T> &error)
+	{
+		State<T> k2(f(s + k1 * (h * T(1.0 / 5))));
+		State<T> k3(f(s + (k1 * T(3.0 / 40) + k2 * T(9.0 / 40)) * h));
+		State<T> k4(f(s + (k1 * T(44.0 / 45) + k2 * T(-56.0 / 15) + k3 * T(32.0 / 9)) * h));
+		State<T> k5(f(s + (k1 * T(19372.0 / 6561) + k2 * T(-25360.0 / 2187) + k3 * T(64448.0 / 6561) + k4 * T(-212.0 / 729)) * h));
+		State<T> k6(f(s + (k1 * T(9017.0 / 3168) + k2 * T(-355.0 / 33) + k3 * T(46732.0 / 5247) + k4 * T(49.0 / 176) + k5 * T(-5103.0 / 18656)) * h));
+		State<T> next(s + (k1 * T(35.0 / 384) + k3 * T(500.0 / 1113) + k4 * T(125.0 / 192) + k5 * T(-2187.0 / 6784) + k6 * T(11.0 / 84)) * h);
+		k7 = f(next);
+		error = (k1 * T(71.0 / 57600) + k3 * T(-71.0 / 16695) + k4 * T(71.0 / 1920) + k5 * T(-17253.0 / 339200) + k6 * T(22.0 / 525) + k7 * T(-1.0 / 40)) * h;
+		return next;
+	}
+
+	// error norm of a step, <= 1 accepts it
+	template<typename T>
+	T StepError(State<T> const &s, State<T> const &next, State<T> const &e, T absolute, T relative)
+	{
+		T scale_l(absolute + relative * std::max(std::abs(s.l), std::abs(next.l)));
+		T scale_phi(absolute + relative * std::max(std::abs(s.phi), std::abs(next.phi)));
+		T scale_pl(absolute + relative * std::max(std::abs(s.pl), std::abs(next.pl)));
+		return std::max({ std::abs(e.l) / scale_l, std::abs(e.phi) / scale_phi, std::abs(e.pl) / scale_pl });
+	}
+
+	// direction of motion in the (l cos φ, l sin φ) plane, folded like ChordDirection
+	template<typename T>
+	Traced<T> TangentDirection(State<T> const &s, State<T> const &d)
+	{
+		T c(std::cos(s.phi)), sn(std::sin(s.phi));
+		T dx(d.l * c - s.l * sn * d.phi), dy(d.l * sn + s.l * c * d.phi);
+		T phi_traced(std::fmod(std::atan2(dy, dx) + TwoPi<T>, TwoPi<T>));
+		return { -phi_traced, s.l };
+	}
+
+	// Dormand-Prince 5(4) with step size control over the same affine parameter range as the
+	// fixed step version. Far from the throat the ray is nearly straight and steps grow large.
+	template<typename T>
+	Traced<T> PhiMappingAdaptive(T phi, T l, T r, Wormhole const &w, T tolerance = T(1e-5), T t_end = T(100), int *evaluations = nullptr)
+	{
+		T a(w.length), M(w.mass), rho(w.radius);
+		State<T> s;
+		Ray<T> ray(MakeRay(phi, r, s, l));
+		auto f([&](State<T> const &x) { return NullGeodesic2D(x, a, M, rho, ray); });
+
+		T t(0), h(T(0.01));
+		int evals(1);
+		State<T> k1(f(s));
+		while (t < t_end)
+		{
+			h = std::min(h, t_end - t);
+			State<T> k7, e;
+			State<T> next(DormandPrinceStep(f, s, k1, h, k7, e));
+			evals += 6;
+
+			T err(StepError(s, next, e, tolerance, tolerance));
+			if (err <= T(1))
+			{
+				t += h;
+				s = next;
+				k1 = k7;
+			}
+			T factor(err > T(0) ? T(0.9) * std::pow(err, T(-0.2)) : T(5));
+			h *= std::min(T(5), std::max(T(0.2), factor));
+			h = std::max(h, T(1e-6));
+		}
+		if (evaluations)
+			*evaluations = evals;
+		return TangentDirection(s, k1);
+	}
+
+	// signed difference of two directions wrapped to [-π, π]
+	template<typename T>
+	T AngleDifference(T a, T b)
+	{
+		T d(std::fmod(a - b, TwoPi<T>));
+		if (d > Pi<T>)
+			d -= TwoPi<T>;
+		else if (d < -Pi<T>)
+			d += TwoPi<T>;
+		return d;
+	}
+
+#if defined(WORMHOLE_SSE2)
+	// four rays per call, one per lane
+	struct State4
+	{
+		__m128 l, phi, pl;
+
+		State4 operator+(State4 const &o) const { return { _mm_add_ps(l, o.l), _mm_add_ps(phi, o.phi), _mm_add_ps(pl, o.pl) }; }
+		State4 operator*(__m128 s) const { return { _mm_mul_ps(l, s), _mm_mul_ps(phi, s), _mm_mul_ps(pl, s) }; }
+	};
+
+	struct Ray4
+	{
+		__m128 b, B_sqr;
+	};
+
+	inline State4 NullGeodesic2D(State4 const &s, __m128 a, __m128 M, __m128 rho, Ray4 const &ray)
+	{
+		__m128 abs_l(simd::abs_ps(s.l));
+		__m128 outside_wormhole(_mm_cmpgt_ps(abs_l, a));
+
+		__m128 x(_mm_div_ps(_mm_mul_ps(_mm_set1_ps(2.0f), _mm_sub_ps(abs_l, a)), _mm_mul_ps(_mm_set1_ps(Pi<float>), M)));
+		__m128 atanx(simd::atan_ps(x));
+		__m128 log_term(simd::log_ps(_mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x, x))));
+
+		__m128 r_outside(_mm_mul_ps(M, _mm_sub_ps(_mm_mul_ps(x, atanx), _mm_mul_ps(_mm_set1_ps(0.5f), log_term))));
+		__m128 r(_mm_add_ps(rho, _mm_and_ps(outside_wormhole, r_outside)));
+		__m128 dr_dl(_mm_and_ps(outside_wormhole, _mm_mul_ps(_mm_mul_ps(atanx, _mm_set1_ps(2.0f / Pi<float>)), simd::sign_ps(s.l))));
+
+		__m128 r_sqr(_mm_mul_ps(r, r));
+		return { s.pl, _mm_div_ps(ray.b, r_sqr), _mm_div_ps(_mm_mul_ps(ray.B_sqr, dr_dl), _mm_mul_ps(r_sqr, r)) };
+	}
+
+	inline State4 RK4Step(State4 const &s, __m128 h, __m128 a, __m128 M, __m128 rho, Ray4 const &ray)
+	{
+		__m128 half(_mm_set1_ps(0.5f)), two(_mm_set1_ps(2.0f));
+		State4 k1(NullGeodesic2D(s, a, M, rho, ray) * h);
+		State4 k2(NullGeodesic2D(s + k1 * half, a, M, rho, ray) * h);
+		State4 k3(NullGeodesic2D(s + k2 * half, a, M, rho, ray) * h);
+		State4 k4(NullGeodesic2D(s + k3, a, M, rho, ray) * h);
+		return s + (k1 + k2 * two + k3 * two + k4) * _mm_set1_ps(1.0f / 6.0f);
+	}
+
+	// PhiMapping<float> for four rays at once, each lane with its own camera (l, r)
+	inline void PhiMapping4(float const phi[4], float const l[4], float const r[4], Wormhole const &w, Traced<float> out[4], int steps = 10000, float h = 0.01f)
+	{
+		alignas(16) float b[4], B_sqr[4], pl[4], l0[4];
+		for (int i(0); i < 4; ++i)
+		{
+			State<float> start;
+			Ray<float> ray(MakeRay(phi[i], r[i], start, l[i]));
+			b[i] = ray.b;
+			B_sqr[i] = ray.B_sqr;
+			pl[i] = start.pl;
+			l0[i] = l[i];
+		}
+		Ray4 ray{ _mm_load_ps(b), _mm_load_ps(B_sqr) };
+		State4 s{ _mm_load_ps(l0), _mm_setzero_ps(), _mm_load_ps(pl) };
+		__m128 a(_mm_set1_ps(w.length)), M(_mm_set1_ps(w.mass)), rho(_mm_set1_ps(w.radius));
+
+		__m128 hv(_mm_set1_ps(h));
+		for (int i(0); i < steps; ++i)
+			s = RK4Step(s, hv, a, M, rho, ray);
+		State4 last(RK4Step(s, _mm_set1_ps(h * 10.0f), a, M, rho, ray));
+
+		alignas(16) float l1[4], phi1[4], l2[4], phi2[4];
+		_mm_store_ps(l1, s.l);
+		_mm_store_ps(phi1, s.phi);
+		_mm_store_ps(l2, last.l);
+		_mm_store_ps(phi2, last.phi);
+		for (int i(0); i < 4; ++i)
+			out[i] = ChordDirection(State<float>{ l1[i], phi1[i], 0.0f }, State<float>{ l2[i], phi2[i], 0.0f });
+	}
+
+	// four directions at once, same camera
+	inline void PhiMapping4(float const phi[4], float l, float r, Wormhole const &w, Traced<float> out[4], int steps = 10000, float h = 0.01f)
+	{
+		float const ls[4] = { l, l, l, l }, rs[4] = { r, r, r, r };
+		PhiMapping4(phi, ls, rs, w, out, steps, h);
+	}
+#endif
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "common.h"
+#include "PassTiming.h"
+
+// Timestamp queries written on the command list, resolved into a readback buffer with one
+// region per frame in flight, read back once the fence of that frame has been waited on. Each
+// Begin takes the next begin/end pair of the frame's region, so a pass timed twice reports the
+// sum of its intervals as on the CPU backend, and only pairs whose end was written are resolved.
+struct D3D12TimestampBackend : TimestampBackend
+{
+	ComPtr<ID3D12QueryHeap> queryHeap;
+	ComPtr<ID3D12Resource> readback;
+	ComPtr<ID3D12GraphicsCommandList> commandList;
+	std::uint64_t frequency; // ticks per second
+	std::uint32_t frameCount;
+	std::uint32_t currentSlot;
+	std::vector<std::vector<std::uint32_t>> intervals; // per slot, the pass of each pair ended that frame or noPass
+	std::vector<bool> resolved;
+	std::array<std::uint32_t, g_RenderPassCount> open; // pair of the pass begun and not ended, or noPass
+
+	PassTimes latest;
+	bool hasLatest;
+
+	static std::uint32_t constexpr intervalsPerFrame = static_cast<std::uint32_t>(g_RenderPassCount * 4);
+	static std::uint32_t constexpr queriesPerFrame = intervalsPerFrame * 2;
+	static std::uint32_t constexpr noPass = ~0u;
+
+	D3D12TimestampBackend(
+		ComPtr<ID3D12Device2> device,
+		ComPtr<ID3D12CommandQueue> commandQueue,
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		std::uint32_t frameCount
+	) :commandList(commandList), frequency(1), frameCount(frameCount), currentSlot(0), intervals(frameCount), resolved(frameCount, false), latest(), hasLatest(false)
+	{
+		open.fill(noPass);
+
+		D3D12_QUERY_HEAP_DESC heapDesc = {};
+		heapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		heapDesc.Count = queriesPerFrame * frameCount;
+		heapDesc.NodeMask = 0;
+		THROW(device->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(&queryHeap)));
+
+		THROW(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(sizeof(std::uint64_t) * queriesPerFrame * frameCount),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			nullptr,
+			IID_PPV_ARGS(&readback)));
+
+		THROW(commandQueue->GetTimestampFrequency(&frequency));
+	}
+
+	std::uint32_t QueryIndex(std::uint32_t interval, bool end) const
+	{
+		return currentSlot * queriesPerFrame + interval * 2 + (end ? 1 : 0);
+	}
+
+	void BeginFrame(std::uint32_t frameSlot) override
+	{
+		currentSlot = frameSlot % frameCount;
+		auto &slot(intervals[currentSlot]);
+		if (resolved[currentSlot] && !slot.empty())
+		{
+			std::size_t offset(sizeof(std::uint64_t) * queriesPerFrame * currentSlot);
+			D3D12_RANGE readRange{ offset, offset + sizeof(std::uint64_t) * slot.size() * 2 };
+			void *mapped(nullptr);
+			THROW(readback->Map(0, &readRange, &mapped));
+			auto const *ticks(reinterpret_cast<std::uint64_t const *>(static_cast<std::uint8_t const *>(mapped) + offset));
+			latest.fill(0.0f);
+			for (std::size_t i(0); i < slot.size(); ++i)
+				if (slot[i] != noPass && ticks[i * 2 + 1] > ticks[i * 2])
+					latest[slot[i]] += static_cast<float>(static_cast<double>(ticks[i * 2 + 1] - ticks[i * 2]) * 1000.0 / static_cast<double>(frequency));
+			D3D12_RANGE writeRange{ 0, 0 };
+			readback->Unmap(0, &writeRange);
+			hasLatest = true;
+		}
+		slot.clear();
+		resolved[currentSlot] = false;
+		open.fill(noPass);
+	}
+
+	void Begin(RenderPass pass) override
+	{
+		auto &slot(intervals[currentSlot]);
+		if (slot.size() == intervalsPerFrame)
+			return; // out of pairs, the interval is not timed
+		open[static_cast<std::size_t>(pass)] = static_cast<std::uint32_t>(slot.size());
+		slot.push_back(noPass);
+		commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, QueryIndex(static_cast<std::uint32_t>(slot.size() - 1), false));
+	}
+
+	void End(RenderPass pass) override
+	{
+		std::uint32_t &interval(open[static_cast<std::size_t>(pass)]);
+		if (interval == noPass)
+			return;
+		commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, QueryIndex(interval, true));
+		intervals[currentSlot][interval] = static_cast<std::uint32_t>(pass);
+		interval = noPass;
+	}
+
+	void EndFrame() override
+	{
+		// runs of ended pairs, a pair begun and never ended has no end timestamp to resolve
+		auto const &slot(intervals[currentSlot]);
+		for (std::uint32_t first(0); first < slot.size();)
+		{
+			if (slot[first] == noPass)
+			{
+				++first;
+				continue;
+			}
+			std::uint32_t last(first);
+			while (last < slot.size() && slot[last] != noPass)
+				++last;
+			commandList->ResolveQueryData(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, QueryIndex(first, false), (last - first) * 2,
+										  readback.Get(), sizeof(std::uint64_t) * QueryIndex(first, false));
+			first = last;
+		}
+		resolved[currentSlot] = true;
+	}
+
+	bool Collect(PassTimes &times) override
+	{
+		if (!hasLatest)
+			return false;
+		times = latest;
+		hasLatest = false;
+		return true;
+	}
+
+	char const *Name() const override
+	{
+		return "D3D12 timestamp queries";
+	}
+};
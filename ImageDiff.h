@@ -0,0 +1,48 @@
+#pragma once
+
+// Per channel comparison of two RGBA float images of the same size, for checking that two
+// backends (or a change to one of them) render the same frame. Alpha is ignored, the backends
+// do not agree on what they leave there.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+struct ImageDifference
+{
+	float maxError;				// largest absolute channel difference
+	float meanError;			// mean absolute channel difference
+	std::uint64_t differing;	// pixels with a channel differing by more than the threshold
+	float psnr;					// against a peak of 1, infinite for identical images
+};
+
+inline ImageDifference CompareImages(float const *a, float const *b, std::uint32_t width, std::uint32_t height, float threshold)
+{
+	ImageDifference diff{ 0.0f, 0.0f, 0, std::numeric_limits<float>::infinity() };
+	double sum(0.0), squared(0.0);
+	std::size_t const pixels(static_cast<std::size_t>(width) * height);
+	for (std::size_t i(0); i < pixels; ++i)
+	{
+		bool differs(false);
+		for (std::size_t c(0); c < 3; ++c)
+		{
+			float e(std::abs(a[i * 4 + c] - b[i * 4 + c]));
+			if (std::isnan(e))
+				e = std::numeric_limits<float>::infinity();
+			diff.maxError = std::max(diff.maxError, e);
+			differs = differs || e > threshold;
+			sum += e;
+			squared += static_cast<double>(e) * e;
+		}
+		diff.differing += differs ? 1 : 0;
+	}
+	if (pixels)
+	{
+		diff.meanError = static_cast<float>(sum / (pixels * 3));
+		double mse(squared / (pixels * 3));
+		if (mse > 0.0)
+			diff.psnr = static_cast<float>(-10.0 * std::log10(mse));
+	}
+	return diff;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+// CPU port of lensed_sky.hlsli and the ray setup of wormhole.hlsl, for the CPU renderers. Same
+// conventions as the shaders: a ray makes angle φ with the direction from the throat to the
+// camera, the phi table maps it to the traced angle in the plane of the two, and the traced
+// direction picks a texel of the skymap of the side it ends up on (dir2uv, bilinear with a
+// transparent black border like the static sampler).
+
+#include "PhiTable.h"
+#include "OutputProjection.h"
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+struct Vec3
+{
+	float x, y, z;
+};
+
+inline Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline float Dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 Cross(Vec3 a, Vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline Vec3 Normalize(Vec3 a) { return a * (1.0f / std::sqrt(Dot(a, a))); }
+
+struct Color
+{
+	float r, g, b, a;
+};
+
+inline Color operator+(Color a, Color b) { return { a.r + b.r, a.g + b.g, a.b + b.b, a.a + b.a }; }
+inline Color operator*(Color a, float s) { return { a.r * s, a.g * s, a.b * s, a.a * s }; }
+
+// RGBA float texels, row major, not owned (RGBAImage::data)
+struct SkyView
+{
+	float const *data;
+	std::uint32_t width, height;
+
+	Color Texel(int x, int y) const
+	{
+		if (x < 0 || y < 0 || x >= static_cast<int>(width) || y >= static_cast<int>(height))
+			return { 0.0f, 0.0f, 0.0f, 0.0f };
+		float const *p(data + (static_cast<std::size_t>(y) * width + x) * 4);
+		return { p[0], p[1], p[2], p[3] };
+	}
+
+	Color SampleNearest(float u, float v) const
+	{
+		return Texel(static_cast<int>(std::floor(u * static_cast<float>(width))), static_cast<int>(std::floor(v * static_cast<float>(height))));
+	}
+
+	// bilinear
+	Color Sample(float u, float v) const
+	{
+		float x(u * static_cast<float>(width) - 0.5f), y(v * static_cast<float>(height) - 0.5f);
+		float fx(std::floor(x)), fy(std::floor(y));
+		int x0(static_cast<int>(fx)), y0(static_cast<int>(fy));
+		float tx(x - fx), ty(y - fy);
+		Color top(Texel(x0, y0) * (1.0f - tx) + Texel(x0 + 1, y0) * tx);
+		Color bottom(Texel(x0, y0 + 1) * (1.0f - tx) + Texel(x0 + 1, y0 + 1) * tx);
+		return top * (1.0f - ty) + bottom * ty;
+	}
+};
+
+enum class SkyFilter : std::uint32_t
+{
+	Bilinear,	// the static sampler of the shaders
+	Nearest
+};
+
+template<SkyFilter F>
+using SkyFilterConstant = std::integral_constant<SkyFilter, F>;
+
+// camera constants of the shaders
+struct RayCamera
+{
+	Vec3 position, forward, up, right;
+	float fovX, fovY;
+	std::uint32_t width, height;
+	OutputProjection projection = OutputProjection::Pinhole;
+	float fisheyeFov = geodesic::Pi<float>; // full angle of the fisheye circle
+	float jitterX = 0.0f, jitterY = 0.0f; // sub-pixel offset of every ray, TemporalAccumulation.h
+
+	// ray through pixel (x, y), same as wormhole.hlsl
+	Vec3 Ray(float x, float y) const
+	{
+		return Ray(projection, x, y);
+	}
+
+	// with the projection given by the caller, an OutputProjectionConstant for the tile kernels
+	template<typename Projection>
+	Vec3 Ray(Projection p, float x, float y) const
+	{
+		float d[3];
+		ProjectionDirection(p, x + jitterX, y + jitterY, static_cast<float>(width), static_cast<float>(height), fovX, fovY, fisheyeFov, d);
+		return Normalize(right * d[0] + up * d[1] + forward * d[2]);
+	}
+
+	// false for pixels outside the image of the projection (the corners of the fisheye)
+	bool Covers(std::uint32_t x, std::uint32_t y) const
+	{
+		return Covers(projection, x, y);
+	}
+
+	template<typename Projection>
+	bool Covers(Projection p, std::uint32_t x, std::uint32_t y) const
+	{
+		if (p != OutputProjection::Fisheye)
+			return true;
+		float d[3];
+		return ProjectionDirection(p, static_cast<float>(x), static_cast<float>(y), static_cast<float>(width), static_cast<float>(height), fovX, fovY, fisheyeFov, d);
+	}
+};
+
+// dir2uv of skymap_panoramic.hlsli
+inline void DirectionToUV(Vec3 dir, float &u, float &v)
+{
+	using geodesic::TwoPi;
+	float phi(std::atan2(dir.x, dir.z));
+	u = std::fmod(phi + TwoPi<float>, TwoPi<float>) / TwoPi<float>;
+	v = (dir.y + 1.0f) * 0.5f;
+}
+
+struct LensedSample
+{
+	Color color;
+	geodesic::Traced<float> traced; // table entry the ray used
+};
+
+// lensed_sky of lensed_sky.hlsli; sky1 is the side of the camera (l >= 0), sky2 the other one.
+// filter is a SkyFilter or a SkyFilterConstant.
+template<typename Filter = SkyFilter>
+LensedSample LensedSky(PhiTable const &table, SkyView const &sky1, SkyView const &sky2, Vec3 position, Vec3 dir, Filter filter = SkyFilter::Bilinear)
+{
+	Vec3 x(Normalize(position));
+	float c(Dot(dir, x));
+	Vec3 y(dir - x * c); // towards the ray in its plane with the throat direction
+	float s(std::sqrt(Dot(y, y)));
+	if (s < 1e-6f) // looking along the throat direction, any plane containing it will do
+	{
+		y = Cross(x, std::abs(x.y) < 0.9f ? Vec3{ 0.0f, 1.0f, 0.0f } : Vec3{ 1.0f, 0.0f, 0.0f });
+		s = std::sqrt(Dot(y, y));
+	}
+	y = y * (1.0f / s);
+
+	LensedSample sample;
+	sample.traced = table.Lookup(std::atan2(s, c));
+	Vec3 traced(x * std::cos(sample.traced.phi) + y * std::sin(sample.traced.phi));
+	float u, v;
+	DirectionToUV(traced, u, v);
+	SkyView const &sky(sample.traced.l < 0.0f ? sky2 : sky1);
+	sample.color = filter == SkyFilter::Nearest ? sky.SampleNearest(u, v) : sky.Sample(u, v);
+	return sample;
+}
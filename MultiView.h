@@ -0,0 +1,126 @@
+#pragma once
+
+// Several views from nearby positions (stereo eyes, a camera rig) rendered as one batch. The
+// deflection table depends on the view only through l, so views whose l differ by less than
+// a tolerance share one table, and the remaining tables are built together: the entries of all
+// tables are interleaved so each SIMD call traces the same direction for up to four cameras.
+// MultiViewRender.h is the GPU version (one table dispatch and one pixel dispatch for all views).
+
+#include "TileRenderer.h"
+
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+std::uint32_t constexpr g_MaxViews = 4;
+
+struct ViewCamera
+{
+	RayCamera camera;
+	float l, r;
+};
+
+struct ViewTables
+{
+	std::vector<PhiTable> tables;
+	std::vector<std::uint32_t> viewTable; // table of each view
+};
+
+// table of each view: the first earlier table on the same side within tolerance of its l, or a
+// new one. l of every table is one of the views'.
+inline std::vector<std::uint32_t> ShareViewTables(std::vector<float> const &l, float tolerance, std::vector<float> &tableL)
+{
+	std::vector<std::uint32_t> viewTable(l.size());
+	tableL.clear();
+	for (std::size_t v(0); v < l.size(); ++v)
+	{
+		std::size_t t(0);
+		while (t < tableL.size() && ((tableL[t] < 0.0f) != (l[v] < 0.0f) || std::abs(tableL[t] - l[v]) > tolerance))
+			++t;
+		if (t == tableL.size())
+			tableL.push_back(l[v]);
+		viewTable[v] = static_cast<std::uint32_t>(t);
+	}
+	return viewTable;
+}
+
+// threads = 0 uses every hardware thread
+inline ViewTables BuildViewTables(Wormhole const &wormhole, std::vector<ViewCamera> const &views, float shareTolerance,
+								  std::uint32_t size = g_PhiCacheSize, unsigned threads = 0)
+{
+	std::vector<float> l, tableL;
+	for (auto const &v : views)
+		l.push_back(v.l);
+
+	ViewTables result;
+	result.viewTable = ShareViewTables(l, shareTolerance, tableL);
+	std::uint32_t tableCount(static_cast<std::uint32_t>(tableL.size()));
+	std::uint32_t stored(PhiTableStoredEntries(size));
+	result.tables.resize(tableCount);
+	for (std::uint32_t t(0); t < tableCount; ++t)
+	{
+		PhiTable &table(result.tables[t]);
+		table.size = size;
+		table.wormhole = wormhole;
+		table.l = tableL[t];
+		table.r = wormhole.radius + std::abs(tableL[t]);
+		table.closedForm = geodesic::ClosedFormApplies(wormhole);
+		table.entries.resize(stored);
+	}
+
+	// item k is entry k / tableCount of table k % tableCount, in groups of four
+	std::uint32_t items(stored * tableCount), groups((items + 3) / 4);
+	bool closedForm(geodesic::ClosedFormApplies(wormhole));
+	auto fill([&](std::uint32_t begin, std::uint32_t end) {
+		for (auto g(begin); g < end; ++g)
+		{
+			float phi[4], ls[4], rs[4];
+			PhiTable *tables[4];
+			std::uint32_t entries[4];
+			std::uint32_t lanes(std::min(4u, items - g * 4));
+			for (std::uint32_t i(0); i < 4; ++i)
+			{
+				std::uint32_t k(g * 4 + std::min(i, lanes - 1)); // repeat the last item in unused lanes
+				tables[i] = &result.tables[k % tableCount];
+				entries[i] = k / tableCount;
+				phi[i] = static_cast<float>(entries[i]) / static_cast<float>(size) * geodesic::TwoPi<float>;
+				ls[i] = tables[i]->l;
+				rs[i] = tables[i]->r;
+			}
+			geodesic::Traced<float> out[4];
+			bool traced(false);
+#if defined(WORMHOLE_SSE2)
+			if (!closedForm)
+			{
+				geodesic::PhiMapping4(phi, ls, rs, wormhole, out);
+				traced = true;
+			}
+#endif
+			for (std::uint32_t i(0); !traced && i < lanes; ++i)
+				out[i] = closedForm ? geodesic::PhiMappingClosedForm(phi[i], ls[i], rs[i], wormhole) : geodesic::PhiMapping(phi[i], ls[i], rs[i], wormhole);
+			for (std::uint32_t i(0); i < lanes; ++i)
+				tables[i]->entries[entries[i]] = out[i];
+		}
+	});
+
+	if (!threads)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1u, std::min(threads, groups));
+	std::vector<std::thread> workers;
+	for (unsigned t(1); t < threads; ++t)
+		workers.emplace_back(fill, static_cast<std::uint32_t>(std::uint64_t(groups) * t / threads), static_cast<std::uint32_t>(std::uint64_t(groups) * (t + 1) / threads));
+	fill(0, static_cast<std::uint32_t>(groups / threads));
+	for (auto &worker : workers)
+		worker.join();
+	return result;
+}
+
+// view v into dst[v], cam.width x cam.height RGBA floats each
+inline std::vector<TileStats> RenderViews(ViewTables const &tables, SkyView const &sky1, SkyView const &sky2, std::vector<ViewCamera> const &views,
+										  Foveation const &foveation, std::vector<float *> const &dst, unsigned threads = 0)
+{
+	std::vector<TileStats> stats;
+	for (std::size_t v(0); v < views.size(); ++v)
+		stats.push_back(RenderTiles(tables.tables[tables.viewTable[v]], sky1, sky2, views[v].camera, foveation, dst[v], threads));
+	return stats;
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+// GPU side of MultiView.h: up to g_MaxViews views that share orientation and field of view and
+// differ in position (stereo eyes) rendered with one table dispatch and one pixel dispatch.
+// Views with nearly the same l share a table (ShareViewTables); the tables that remain are
+// filled together by equatorial_phi_mapping_views.hlsl, a row of groups each. A single table
+// only launches PhiTableStoredEntries(size) threads, far from filling the GPU, so a second one
+// in the same dispatch costs much less than a second dispatch. wormhole_views.hlsl then shades
+// each pixel in all views one after another, side by side in the output.
+
+#include "common.h"
+#include "Wormhole.h"
+#include "Camera.h"
+#include "DescriptorHeap.h"
+#include "GpuTimer.h"
+#include "RGBAImage.h"
+#include "MultiView.h"
+
+struct MultiViewRender
+{
+	ComPtr<ID3D12PipelineState> pipelineStateTables;
+	ComPtr<ID3D12RootSignature> rootSignatureTables;
+	ComPtr<ID3D12PipelineState> pipelineStateViews;
+	ComPtr<ID3D12RootSignature> rootSignatureViews;
+	ComPtr<ID3D12Resource> phiTables; // g_MaxViews tables of PhiTableStoredEntries(g_PhiCacheSize)
+	RGBAImageGPU output; // maxViews * width x height, view v at columns [v * width, (v + 1) * width)
+
+	std::uint32_t maxViews;
+	std::uint32_t phiTableSize;
+	float shareTolerance; // views whose l differ by less share a table
+	std::uint32_t tables; // built by the last Render
+
+	MultiViewRender() :maxViews(0), phiTableSize(g_PhiCacheSize), shareTolerance(1e-3f), tables(0)
+	{
+		;
+	}
+
+	MultiViewRender(MultiViewRender const &a) = delete;
+	MultiViewRender &operator=(MultiViewRender const &a) = delete;
+
+	MultiViewRender(MultiViewRender &&a) noexcept
+	{
+		*this = std::move(a);
+	}
+
+	MultiViewRender &operator=(MultiViewRender &&a) noexcept
+	{
+		if (this != std::addressof(a))
+		{
+			pipelineStateTables = std::move(a.pipelineStateTables);
+			rootSignatureTables = std::move(a.rootSignatureTables);
+			pipelineStateViews = std::move(a.pipelineStateViews);
+			rootSignatureViews = std::move(a.rootSignatureViews);
+			phiTables = std::move(a.phiTables);
+			output = std::move(a.output);
+			maxViews = a.maxViews;
+			phiTableSize = a.phiTableSize;
+			shareTolerance = a.shareTolerance;
+			tables = a.tables;
+		}
+		return *this;
+	}
+
+	// phi tables SRV at heapOffset, UAV at heapOffset + 1, output SRV at heapOffset + 2, UAV at heapOffset + 3
+	MultiViewRender(ComPtr<ID3D12Device2> device, DescriptorHeapWrapper &heap, std::size_t heapOffset, std::uint32_t maxViews, std::uint32_t width, std::uint32_t height) :
+		output(device, maxViews * width, height, heap.at_cpu(heapOffset + 2), heap.at_cpu(heapOffset + 3)),
+		maxViews(std::min(maxViews, g_MaxViews)), phiTableSize(g_PhiCacheSize), shareTolerance(1e-3f), tables(0)
+	{
+		std::uint32_t entries(g_MaxViews * PhiTableStoredEntries(g_PhiCacheSize));
+
+		D3D12_RESOURCE_DESC phiTablesDesc = {};
+		phiTablesDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		phiTablesDesc.Alignment = 0;
+		phiTablesDesc.Width = entries * sizeof(float) * 2;
+		phiTablesDesc.Height = 1;
+		phiTablesDesc.DepthOrArraySize = 1;
+		phiTablesDesc.MipLevels = 1;
+		phiTablesDesc.Format = DXGI_FORMAT_UNKNOWN;
+		phiTablesDesc.SampleDesc.Count = 1;
+		phiTablesDesc.SampleDesc.Quality = 0;
+		phiTablesDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		phiTablesDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+
+		THROW(device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&phiTablesDesc,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			nullptr,
+			IID_PPV_ARGS(&phiTables)
+		));
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = phiTablesDesc.Format;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = entries;
+		srvDesc.Buffer.StructureByteStride = sizeof(float) * 2;
+		srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+		device->CreateShaderResourceView(phiTables.Get(), &srvDesc, heap.at_cpu(heapOffset));
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.Format = phiTablesDesc.Format;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = entries;
+		uavDesc.Buffer.StructureByteStride = sizeof(float) * 2;
+		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+		device->CreateUnorderedAccessView(phiTables.Get(), nullptr, &uavDesc, heap.at_cpu(heapOffset + 1));
+
+		D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+		if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+			featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+		D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
+
+		auto createRootSignature([&](CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC const &desc, ComPtr<ID3D12RootSignature> &rootSignature) {
+			ComPtr<ID3DBlob> rootSignatureBlob;
+			ComPtr<ID3DBlob> errorBlob;
+			auto hr = D3DX12SerializeVersionedRootSignature(&desc,
+				featureData.HighestVersion, &rootSignatureBlob, &errorBlob);
+			if (FAILED(hr))
+			{
+				std::string errorString;
+
+				if (errorBlob)
+				{
+					errorString.append(": ");
+
+					errorString.append(
+						reinterpret_cast<char *>(
+						errorBlob->GetBufferPointer()),
+						errorBlob->GetBufferSize());
+					MessageBoxA(NULL, errorString.c_str(), "MultiViewRender", MB_OK | MB_ICONERROR);
+				}
+				__debugbreak();
+			}
+			ThrowIfFailed(device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(),
+				rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&rootSignature)));
+		});
+
+		// tables: the layout of FillPhiCache with more constants
+		{
+			ComPtr<ID3DBlob> computeShaderBlob;
+			ThrowIfFailed(D3DReadFileToBlob(L"equatorial_phi_mapping_views.cso", &computeShaderBlob));
+
+			CD3DX12_ROOT_PARAMETER1 rootParameters[3] = {};
+			rootParameters[0].InitAsConstants(12, 0); // size, count, l and r of each table
+			rootParameters[1].InitAsConstants(4, 1);  // wormhole
+			auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+			rootParameters[2].InitAsDescriptorTable(1, std::addressof(r1));
+
+			CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription{};
+			rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, rootSignatureFlags);
+			createRootSignature(rootSignatureDescription, rootSignatureTables);
+
+			D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+			psoDesc.pRootSignature = rootSignatureTables.Get();
+			psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+			ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStateTables)));
+		}
+
+		// views: the layout of WormholeRender with the positions of the views
+		{
+			ComPtr<ID3DBlob> computeShaderBlob;
+			ThrowIfFailed(D3DReadFileToBlob(L"wormhole_views.cso", &computeShaderBlob));
+
+			CD3DX12_ROOT_PARAMETER1 rootParameters[7] = {};
+			rootParameters[0].InitAsConstants(20, 0); // camera
+			rootParameters[1].InitAsConstants(4, 1);  // wormhole
+			rootParameters[2].InitAsConstants(4, 2);  // cache size
+			auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0);
+			rootParameters[3].InitAsDescriptorTable(1, std::addressof(r1));
+			auto r2 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+			rootParameters[4].InitAsDescriptorTable(1, std::addressof(r2));
+			auto r3 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2);
+			rootParameters[5].InitAsDescriptorTable(1, std::addressof(r3));
+			rootParameters[6].InitAsConstants(20, 3); // views
+
+			D3D12_STATIC_SAMPLER_DESC sampler = {};
+			sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+			sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+			sampler.MipLODBias = 0;
+			sampler.MaxAnisotropy = 0;
+			sampler.ComparisonFunc = D3D12_COMPARISON_FUNC_NEVER;
+			sampler.BorderColor = D3D12_STATIC_BORDER_COLOR_TRANSPARENT_BLACK;
+			sampler.MinLOD = 0.0f;
+			sampler.MaxLOD = D3D12_FLOAT32_MAX;
+			sampler.ShaderRegister = 0;
+			sampler.RegisterSpace = 0;
+			sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+			CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription{};
+			rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 1, std::addressof(sampler), rootSignatureFlags);
+			createRootSignature(rootSignatureDescription, rootSignatureViews);
+
+			D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+			psoDesc.pRootSignature = rootSignatureViews.Get();
+			psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+			ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStateViews)));
+		}
+	}
+
+	// Renders views[0..count) into output, which must be a UAV. The views must share orientation,
+	// field of view and resolution, views[0] provides them.
+	void Render(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		Camera const *views,
+		std::uint32_t count,
+		Wormhole &wormhole,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t srcTextureSRVHeapOffset, // 2 SRVs for two skymaps
+		std::size_t phiTablesSRVHeapOffset, // UAV follows it
+		std::size_t outputUAVHeapOffset,
+		TimestampBackend *timestamps = nullptr
+	)
+	{
+		count = std::min(count, maxViews);
+		std::vector<float> l, tableL;
+		for (std::uint32_t v(0); v < count; ++v)
+			l.push_back(views[v].GetL());
+		auto viewTable(ShareViewTables(l, shareTolerance, tableL));
+		tables = static_cast<std::uint32_t>(tableL.size());
+
+		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
+		{
+			PROFILE_ZONE("Phi table build");
+			ScopedTimestamp timestamp(timestamps, RenderPass::PhiCache);
+			commandList->SetPipelineState(pipelineStateTables.Get());
+			commandList->SetComputeRootSignature(rootSignatureTables.Get());
+			commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+			commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiTables.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+			struct
+			{
+				int bufferSize;
+				std::uint32_t tables;
+				std::uint32_t pad1, pad2;
+				float l[4];
+				float r[4];
+			} cb{ static_cast<int>(phiTableSize), tables, 0, 0, {}, {} };
+			for (std::uint32_t t(0); t < tables; ++t)
+			{
+				cb.l[t] = tableL[t];
+				cb.r[t] = wormhole.radius + std::abs(tableL[t]);
+			}
+			static_assert(sizeof(cb) == 12 * 4);
+
+			commandList->SetComputeRoot32BitConstants(0, 12, &cb, 0);
+			commandList->SetComputeRoot32BitConstants(1, 4, &wormhole, 0);
+			commandList->SetComputeRootDescriptorTable(2, textureHeap.at_gpu(phiTablesSRVHeapOffset + 1));
+
+			commandList->Dispatch(((PhiTableStoredEntries(phiTableSize) - 1) / 1024) + 1, tables, 1);
+
+			commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiTables.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+		}
+
+		PROFILE_ZONE("Wormhole dispatch");
+		ScopedTimestamp timestamp(timestamps, RenderPass::Wormhole);
+		commandList->SetPipelineState(pipelineStateViews.Get());
+		commandList->SetComputeRootSignature(rootSignatureViews.Get());
+		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+		Camera const &cam(views[0]);
+		struct
+		{
+			XMVECTOR position;
+			XMVECTOR forward;
+			XMVECTOR up;
+			XMVECTOR right;
+			float fovX;
+			float fovY;
+			float width;
+			float height;
+		} cam_data{ cam.GetPositionXM(),cam.GetLookDirXM(),cam.GetUpXM(),cam.GetRightXM(),cam.GetFovX(),cam.GetFovY(),static_cast<float>(cam.GetWidth()),static_cast<float>(cam.GetHeight()) };
+
+		struct
+		{
+			std::uint32_t size;
+			std::uint32_t pad1, pad2, pad3;
+		} cache_size{ phiTableSize, 0, 0, 0 };
+
+		struct
+		{
+			XMFLOAT4 position[4]; // w is the table
+			std::uint32_t views;
+			std::uint32_t pad1, pad2, pad3;
+		} view_data{ {}, count, 0, 0, 0 };
+		for (std::uint32_t v(0); v < count; ++v)
+		{
+			XMFLOAT3 p(views[v].GetPosition());
+			view_data.position[v] = XMFLOAT4(p.x, p.y, p.z, static_cast<float>(viewTable[v]));
+		}
+
+		static_assert(sizeof(cam_data) == 20 * 4);
+		static_assert(sizeof(view_data) == 20 * 4);
+
+		commandList->SetComputeRoot32BitConstants(0, 20, &cam_data, 0);
+		commandList->SetComputeRoot32BitConstants(1, 4, &wormhole, 0);
+		commandList->SetComputeRoot32BitConstants(2, 4, &cache_size, 0);
+		commandList->SetComputeRootDescriptorTable(3, textureHeap.at_gpu(srcTextureSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(4, textureHeap.at_gpu(outputUAVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(5, textureHeap.at_gpu(phiTablesSRVHeapOffset));
+		commandList->SetComputeRoot32BitConstants(6, 20, &view_data, 0);
+
+		UINT groupX(((cam.GetWidth() - 1) / 32) + 1);
+		UINT groupY(((cam.GetHeight() - 1) / 32) + 1);
+
+		commandList->Dispatch(groupX, groupY, 1);
+	}
+};
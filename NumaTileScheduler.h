@@ -0,0 +1,390 @@
+#pragma once
+
+// Tile scheduler of the CPU renderer for machines with several NUMA nodes (dual socket render
+// nodes). Every worker thread is pinned to a CPU of one node and reads a copy of the skymaps
+// made by a thread of that node, so the pages are local to it (first touch), instead of half the
+// workers fetching every texel across the socket interconnect. The tiles of a frame are split
+// into one contiguous band per node, in proportion to its workers, and each band into one range
+// per worker. A worker whose range is empty steals the upper half of the largest remaining range
+// of a worker on its node, and only when its whole node is done from the other nodes. Without
+// NUMA (one node, or no topology information) it behaves like the shared queue with pinned
+// workers. NumaTopology::Split divides one node into several to exercise the stealing on a
+// single socket machine.
+
+#include "TileRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#undef min
+#undef max
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct NumaTopology
+{
+	std::vector<std::vector<unsigned>> nodes; // CPUs of each node the process may run on
+
+	// the nodes of this machine, one node of every hardware thread when the OS does not tell
+	static NumaTopology Detect()
+	{
+		NumaTopology topology;
+#if defined(_WIN32)
+		ULONG highest(0);
+		if (GetNumaHighestNodeNumber(&highest))
+			for (ULONG node(0); node <= highest; ++node)
+			{
+				GROUP_AFFINITY affinity{};
+				if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity))
+					continue;
+				std::vector<unsigned> cpus;
+				for (unsigned bit(0); bit < 64; ++bit)
+					if ((affinity.Mask >> bit) & 1)
+						cpus.push_back(affinity.Group * 64u + bit);
+				if (!cpus.empty())
+					topology.nodes.push_back(std::move(cpus));
+			}
+#else
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool restricted(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+		for (unsigned node(0);; ++node)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			if (!file)
+				break;
+			std::string list;
+			std::getline(file, list);
+			std::vector<unsigned> cpus;
+			for (unsigned cpu : ParseCpuList(list))
+				if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+					cpus.push_back(cpu);
+			if (!cpus.empty())
+				topology.nodes.push_back(std::move(cpus));
+		}
+#endif
+		if (topology.nodes.empty())
+		{
+			topology.nodes.emplace_back();
+			for (unsigned cpu(0); cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+				topology.nodes[0].push_back(cpu);
+		}
+		return topology;
+	}
+
+	// the CPUs of all nodes dealt into count nodes, for testing on a machine with fewer. With more
+	// nodes than CPUs the nodes share CPUs.
+	NumaTopology Split(unsigned count) const
+	{
+		NumaTopology topology;
+		std::vector<unsigned> cpus;
+		for (auto const &node : nodes)
+			cpus.insert(cpus.end(), node.begin(), node.end());
+		count = std::max(1u, count);
+		std::size_t slots(std::max<std::size_t>(cpus.size(), count));
+		topology.nodes.resize(count);
+		for (std::size_t i(0); i < slots; ++i)
+			topology.nodes[i * count / slots].push_back(cpus[i % cpus.size()]);
+		return topology;
+	}
+
+	unsigned Cpus() const
+	{
+		unsigned n(0);
+		for (auto const &node : nodes)
+			n += static_cast<unsigned>(node.size());
+		return n;
+	}
+
+	// "0-3,8-11" as in /sys/devices/system/node/nodeN/cpulist
+	static std::vector<unsigned> ParseCpuList(std::string const &list)
+	{
+		std::vector<unsigned> cpus;
+		std::stringstream stream(list);
+		std::string part;
+		while (std::getline(stream, part, ','))
+		{
+			if (part.empty() || part[0] < '0' || part[0] > '9')
+				continue;
+			std::size_t dash(part.find('-'));
+			unsigned first(static_cast<unsigned>(std::stoul(part))), last(dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(part.substr(dash + 1))));
+			for (unsigned cpu(first); cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+		}
+		return cpus;
+	}
+};
+
+// pins the calling thread to one CPU, false if the OS refused
+inline bool PinThreadToCpu(unsigned cpu)
+{
+#if defined(_WIN32)
+	GROUP_AFFINITY affinity{};
+	affinity.Group = static_cast<WORD>(cpu / 64);
+	affinity.Mask = static_cast<KAFFINITY>(1) << (cpu % 64);
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+	if (cpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+struct NumaTileStats
+{
+	std::uint64_t own, stolenLocal, stolenRemote; // tiles taken from the worker's own range, stolen on its node, stolen from other nodes
+};
+
+struct NumaTileScheduler
+{
+	NumaTopology topology;
+	unsigned threads; // 0 one worker per CPU of the topology
+	bool pin; // false leaves the workers unpinned, for comparison
+	NumaTileStats stats; // of the last frame
+
+	explicit NumaTileScheduler(NumaTopology topology = NumaTopology::Detect(), unsigned threads = 0, bool pin = true)
+		:topology(std::move(topology)), threads(threads), pin(pin), stats{}, tileCount(0), source1{}, source2{}
+	{
+		;
+	}
+
+	NumaTileScheduler(NumaTileScheduler const &) = delete;
+	NumaTileScheduler &operator=(NumaTileScheduler const &) = delete;
+
+	unsigned Nodes() const
+	{
+		return static_cast<unsigned>(topology.nodes.size());
+	}
+
+	// copies the skymap texels (the float data of the CPU RGBAImage skymaps, as SkyView points to
+	// them) to every node unless these are the ones copied last time
+	void Replicate(SkyView const &sky1, SkyView const &sky2)
+	{
+		auto same([](SkyView const &a, SkyView const &b) { return a.data == b.data && a.width == b.width && a.height == b.height; });
+		if (same(sky1, source1) && same(sky2, source2) && replicas.size() == topology.nodes.size())
+			return;
+		source1 = sky1;
+		source2 = sky2;
+		replicas.clear();
+		replicas.resize(topology.nodes.size());
+		if (topology.nodes.size() < 2)
+			return; // one node reads the caller's skymaps
+		std::vector<std::thread> copiers;
+		for (std::size_t node(0); node < topology.nodes.size(); ++node)
+			copiers.emplace_back([this, node] {
+				if (pin)
+					PinThreadToCpu(topology.nodes[node].front());
+				replicas[node].Copy(source1, source2);
+			});
+		for (auto &copier : copiers)
+			copier.join();
+	}
+
+	// the next Replicate copies again, for skymaps changed in place
+	void Invalidate()
+	{
+		replicas.clear();
+	}
+
+	SkyView const &Sky1(unsigned worker) const
+	{
+		return replicas.empty() || replicas[workers[worker].node].sky1.empty() ? source1 : replicas[workers[worker].node].view1;
+	}
+
+	SkyView const &Sky2(unsigned worker) const
+	{
+		return replicas.empty() || replicas[workers[worker].node].sky2.empty() ? source2 : replicas[workers[worker].node].view2;
+	}
+
+	bool Next(unsigned worker, std::uint32_t &tile)
+	{
+		Worker &self(workers[worker]);
+		if (Pop(self, tile))
+		{
+			++self.own;
+			return true;
+		}
+		// the largest range left on the worker's node, then anywhere
+		for (bool local : { true, false })
+			while (Worker *victim = Largest(self.node, local))
+			{
+				if (!Steal(*victim, self))
+					continue;
+				if (Pop(self, tile))
+				{
+					++(local ? self.stolenLocal : self.stolenRemote);
+					return true;
+				}
+			}
+		return false;
+	}
+
+	template<typename Work>
+	void Run(std::uint32_t tiles, std::uint32_t maxWorkers, Work const &work)
+	{
+		tileCount = tiles;
+		unsigned count(threads ? threads : topology.Cpus());
+		count = std::max(1u, std::min(count, std::max(maxWorkers, 1u)));
+		Assign(count);
+		// the caller's thread only waits, pinning it would outlast the frame
+		std::vector<std::thread> pool;
+		for (unsigned w(0); w < count; ++w)
+			pool.emplace_back([this, &work, w] {
+				if (pin)
+					PinThreadToCpu(workers[w].cpu);
+				work(w);
+			});
+		for (auto &thread : pool)
+			thread.join();
+		stats = NumaTileStats{};
+		for (unsigned w(0); w < count; ++w)
+		{
+			stats.own += workers[w].own;
+			stats.stolenLocal += workers[w].stolenLocal;
+			stats.stolenRemote += workers[w].stolenRemote;
+		}
+	}
+
+private:
+	struct Replica
+	{
+		std::vector<float> sky1, sky2;
+		SkyView view1, view2;
+
+		void Copy(SkyView const &a, SkyView const &b)
+		{
+			sky1.assign(a.data, a.data + static_cast<std::size_t>(a.width) * a.height * 4);
+			sky2.assign(b.data, b.data + static_cast<std::size_t>(b.width) * b.height * 4);
+			view1 = { sky1.data(), a.width, a.height };
+			view2 = { sky2.data(), b.width, b.height };
+		}
+	};
+
+	// own cache line each, thieves write the ranges of other workers
+	struct alignas(64) Worker
+	{
+		std::atomic<std::uint64_t> range; // next tile in the low 32 bits, end in the high 32 bits
+		unsigned node, cpu;
+		std::uint64_t own, stolenLocal, stolenRemote;
+	};
+
+	std::uint32_t tileCount;
+	SkyView source1, source2;
+	std::vector<Replica> replicas;
+	std::vector<Worker> workers;
+
+	static std::uint64_t Pack(std::uint32_t begin, std::uint32_t end)
+	{
+		return static_cast<std::uint64_t>(end) << 32 | begin;
+	}
+
+	// Deals count workers to the nodes in proportion to their CPUs and gives every node a band of
+	// tiles in proportion to its workers, split evenly among them.
+	void Assign(unsigned count)
+	{
+		unsigned cpus(topology.Cpus());
+		std::vector<unsigned> perNode(topology.nodes.size());
+		for (unsigned w(0); w < count; ++w)
+		{
+			// the node furthest below its share
+			std::size_t best(0);
+			double bestDeficit(-1e30);
+			for (std::size_t n(0); n < perNode.size(); ++n)
+			{
+				double deficit(static_cast<double>(topology.nodes[n].size()) / cpus * (w + 1) - perNode[n]);
+				if (deficit > bestDeficit)
+				{
+					best = n;
+					bestDeficit = deficit;
+				}
+			}
+			++perNode[best];
+		}
+
+		workers = std::vector<Worker>(count);
+		unsigned w(0), assigned(0);
+		for (std::size_t n(0); n < perNode.size(); ++n)
+			for (unsigned k(0); k < perNode[n]; ++k, ++w, ++assigned)
+			{
+				Worker &worker(workers[w]);
+				worker.node = static_cast<unsigned>(n);
+				worker.cpu = topology.nodes[n][k % topology.nodes[n].size()];
+				std::uint32_t begin(static_cast<std::uint32_t>(static_cast<std::uint64_t>(tileCount) * assigned / count));
+				std::uint32_t end(static_cast<std::uint32_t>(static_cast<std::uint64_t>(tileCount) * (assigned + 1) / count));
+				worker.range = Pack(begin, end);
+				worker.own = worker.stolenLocal = worker.stolenRemote = 0;
+			}
+	}
+
+	static bool Pop(Worker &worker, std::uint32_t &tile)
+	{
+		std::uint64_t range(worker.range.load());
+		for (;;)
+		{
+			std::uint32_t begin(static_cast<std::uint32_t>(range)), end(static_cast<std::uint32_t>(range >> 32));
+			if (begin >= end)
+				return false;
+			if (worker.range.compare_exchange_weak(range, Pack(begin + 1, end)))
+			{
+				tile = begin;
+				return true;
+			}
+		}
+	}
+
+	Worker *Largest(unsigned node, bool local)
+	{
+		Worker *largest(nullptr);
+		std::uint32_t most(0);
+		for (auto &worker : workers)
+		{
+			if ((worker.node == node) != local)
+				continue;
+			std::uint64_t range(worker.range.load());
+			std::uint32_t begin(static_cast<std::uint32_t>(range)), end(static_cast<std::uint32_t>(range >> 32));
+			if (end > begin && end - begin > most)
+			{
+				largest = &worker;
+				most = end - begin;
+			}
+		}
+		return largest;
+	}
+
+	// moves the upper half of the victim's range (its last tile if only one is left) to the thief's empty range
+	static bool Steal(Worker &victim, Worker &thief)
+	{
+		std::uint64_t range(victim.range.load());
+		std::uint32_t begin(static_cast<std::uint32_t>(range)), end(static_cast<std::uint32_t>(range >> 32));
+		if (begin >= end)
+			return false;
+		std::uint32_t middle(begin + (end - begin) / 2);
+		if (!victim.range.compare_exchange_strong(range, Pack(begin, middle)))
+			return false;
+		thief.range = Pack(middle, end);
+		return true;
+	}
+};
+
+// RenderTiles on the workers of a NumaTileScheduler, which replicates the skymaps first if they changed
+inline TileStats RenderTiles(NumaTileScheduler &scheduler, KernelOptions const &options, PhiTable const &table, SkyView const &sky1, SkyView const &sky2,
+							 RayCamera const &cam, Foveation const &foveation, void *dst, TileCache *cache = nullptr)
+{
+	scheduler.Replicate(sky1, sky2);
+	return SpecializeTileKernel(options, [&](auto const &constant) {
+		return RenderTilesScheduled(constant, table, sky1, sky2, cam, foveation, dst, scheduler, cache);
+	});
+}
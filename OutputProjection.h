@@ -0,0 +1,121 @@
+#pragma once
+
+// Mapping from output pixels to ray directions for the per pixel pass, shared by the CPU tile
+// renderer (RayCamera) and wormhole.hlsl (projection.hlsli repeats ProjectionDirection). The
+// pinhole is the original camera; the others cover the whole sphere (equirectangular, cubemap)
+// or a dome (fisheye) for 360 video, all still one phi table lookup per pixel. Directions are in
+// the camera frame: x along right, y along up, z along forward.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+enum class OutputProjection : std::uint32_t
+{
+	Pinhole,
+	Equirectangular,	// 2:1, longitude along x centred on forward, latitude along y
+	Cubemap,			// 3x2 faces: right left up / down forward back
+	Fisheye,			// 1:1 equidistant, angle from forward proportional to the distance from the centre
+	Count
+};
+
+inline char const *OutputProjectionName(OutputProjection projection)
+{
+	switch (projection)
+	{
+	case OutputProjection::Equirectangular: return "equirect";
+	case OutputProjection::Cubemap: return "cubemap";
+	case OutputProjection::Fisheye: return "fisheye";
+	default: return "pinhole";
+	}
+}
+
+// largest image of the projection's aspect inside maxWidth x maxHeight
+inline void OutputProjectionResolution(OutputProjection projection, std::uint32_t maxWidth, std::uint32_t maxHeight, std::uint32_t &width, std::uint32_t &height)
+{
+	std::uint32_t aspectX(1), aspectY(1);
+	switch (projection)
+	{
+	case OutputProjection::Pinhole: width = maxWidth; height = maxHeight; return;
+	case OutputProjection::Equirectangular: aspectX = 2; aspectY = 1; break;
+	case OutputProjection::Cubemap: aspectX = 3; aspectY = 2; break;
+	default: break;
+	}
+	std::uint32_t unit(std::min(maxWidth / aspectX, maxHeight / aspectY));
+	width = unit * aspectX;
+	height = unit * aspectY;
+}
+
+template<OutputProjection P>
+using OutputProjectionConstant = std::integral_constant<OutputProjection, P>;
+
+// Direction of pixel (x, y) of a width x height image, false for pixels the projection does not
+// cover (outside the fisheye circle), whose direction is still valid. fovX and fovY are the
+// pinhole's (image plane extents at unit distance, as in Camera), fisheyeFov the full angle of
+// the fisheye circle. projection is an OutputProjection or an OutputProjectionConstant, which
+// leaves only its own case in the instantiation.
+template<typename Projection>
+bool ProjectionDirection(Projection projection, float x, float y, float width, float height,
+						 float fovX, float fovY, float fisheyeFov, float dir[3])
+{
+	float constexpr pi(3.14159265358979323846f);
+	if (projection == OutputProjection::Pinhole)
+	{
+		dir[0] = fovX * (x / width * 2.0f - 1.0f) * 0.5f;
+		dir[1] = fovY * (y / height * 2.0f - 1.0f) * 0.5f;
+		dir[2] = 1.0f;
+		return true;
+	}
+
+	// pixel centres, so both halves of every seam are sampled symmetrically
+	float u((x + 0.5f) / width), v((y + 0.5f) / height);
+	switch (static_cast<OutputProjection>(projection))
+	{
+	case OutputProjection::Equirectangular:
+	{
+		float longitude((u * 2.0f - 1.0f) * pi), latitude((v * 2.0f - 1.0f) * pi * 0.5f);
+		dir[0] = std::cos(latitude) * std::sin(longitude);
+		dir[1] = std::sin(latitude);
+		dir[2] = std::cos(latitude) * std::cos(longitude);
+		return true;
+	}
+	case OutputProjection::Cubemap:
+	{
+		// face axes: the face normal, then the directions of +s and +t across it
+		static float const faces[6][3][3] = {
+			{ {  1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } },	// right
+			{ { -1, 0, 0 }, { 0, 0,  1 }, { 0, 1, 0 } },	// left
+			{ { 0,  1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } },	// up
+			{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0,  1 } },	// down
+			{ { 0, 0,  1 }, {  1, 0, 0 }, { 0, 1, 0 } },	// forward
+			{ { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1, 0 } },	// back
+		};
+		float fu(u * 3.0f), fv(v * 2.0f);
+		std::uint32_t column(std::min(static_cast<std::uint32_t>(fu), 2u)), row(std::min(static_cast<std::uint32_t>(fv), 1u));
+		float s((fu - static_cast<float>(column)) * 2.0f - 1.0f), t((fv - static_cast<float>(row)) * 2.0f - 1.0f);
+		auto const &face(faces[row * 3 + column]);
+		for (int i(0); i < 3; ++i)
+			dir[i] = face[0][i] + face[1][i] * s + face[2][i] * t;
+		return true;
+	}
+	default:
+	{
+		float px((u * 2.0f - 1.0f) * width / height), py(v * 2.0f - 1.0f);
+		float d(std::sqrt(px * px + py * py));
+		float angle(std::min(d * fisheyeFov * 0.5f, pi));
+		if (d < 1e-6f)
+		{
+			dir[0] = 0.0f;
+			dir[1] = 0.0f;
+		}
+		else
+		{
+			dir[0] = std::sin(angle) * px / d;
+			dir[1] = std::sin(angle) * py / d;
+		}
+		dir[2] = std::cos(angle);
+		return d <= 1.0f;
+	}
+	}
+}
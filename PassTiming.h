@@ -0,0 +1,163 @@
+#pragma once
+
+// Per pass timings of a frame, free of D3D12 so the CPU backend and tools can share them with
+// GpuTimer.h (the timestamp query backend).
+
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+// the passes of one frame we report timings for
+enum class RenderPass : std::uint32_t
+{
+	PhiCache = 0,
+	Wormhole,
+	ScreenQuad,
+	ImGui,
+	Environment,
+	EnvironmentResample,
+	Upscale,
+	Accumulate,
+	Count
+};
+
+std::size_t constexpr g_RenderPassCount = static_cast<std::size_t>(RenderPass::Count);
+
+inline char const *RenderPassName(RenderPass pass)
+{
+	static char const *names[g_RenderPassCount] = { "FillPhiCache", "Wormhole dispatch", "Screen quad", "ImGui", "Environment trace", "Environment resample", "Upscale", "Temporal accumulate" };
+	return names[static_cast<std::size_t>(pass)];
+}
+
+using PassTimes = std::array<float, g_RenderPassCount>; // ms, 0 for passes not run that frame
+
+// Timestamps around each pass of a frame. Results come back some frames later (GPU) or
+// immediately (CPU), Collect hands out the latest complete frame. A pass timed more than once in
+// a frame reports the sum of its intervals on every backend.
+struct TimestampBackend
+{
+	virtual ~TimestampBackend()
+	{
+		;
+	}
+	// frameSlot is the index of the frame resources about to be reused, its previous results are complete
+	virtual void BeginFrame(std::uint32_t frameSlot) = 0;
+	virtual void Begin(RenderPass pass) = 0;
+	virtual void End(RenderPass pass) = 0;
+	virtual void EndFrame() = 0;
+	// true if a frame completed since the last call
+	virtual bool Collect(PassTimes &times) = 0;
+	virtual char const *Name() const = 0;
+};
+
+struct ScopedTimestamp
+{
+	TimestampBackend *backend;
+	RenderPass pass;
+
+	ScopedTimestamp(TimestampBackend *backend, RenderPass pass) :backend(backend), pass(pass)
+	{
+		if (backend)
+			backend->Begin(pass);
+	}
+	~ScopedTimestamp()
+	{
+		if (backend)
+			backend->End(pass);
+	}
+
+	ScopedTimestamp(ScopedTimestamp const &) = delete;
+	ScopedTimestamp &operator=(ScopedTimestamp const &) = delete;
+};
+
+// Wall clock around the same passes. Measures the passes when they run on the CPU, and lets the
+// instrumentation (and anything consuming PassTimes) run without a GPU.
+struct CpuTimestampBackend : TimestampBackend
+{
+	std::array<std::chrono::steady_clock::time_point, g_RenderPassCount> begins;
+	PassTimes current;
+	PassTimes latest;
+	bool hasLatest;
+
+	CpuTimestampBackend() :begins(), current(), latest(), hasLatest(false)
+	{
+		;
+	}
+
+	void BeginFrame(std::uint32_t) override
+	{
+		current.fill(0.0f);
+	}
+
+	void Begin(RenderPass pass) override
+	{
+		begins[static_cast<std::size_t>(pass)] = std::chrono::steady_clock::now();
+	}
+
+	void End(RenderPass pass) override
+	{
+		auto i(static_cast<std::size_t>(pass));
+		current[i] += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begins[i]).count();
+	}
+
+	void EndFrame() override
+	{
+		latest = current;
+		hasLatest = true;
+	}
+
+	bool Collect(PassTimes &times) override
+	{
+		if (!hasLatest)
+			return false;
+		times = latest;
+		hasLatest = false;
+		return true;
+	}
+
+	char const *Name() const override
+	{
+		return "CPU wall clock";
+	}
+};
+
+// rolling per-pass history for the histograms in the UI
+struct PassTimingHistory
+{
+	static std::size_t constexpr length = 120;
+
+	std::array<std::array<float, length>, g_RenderPassCount> samples;
+	std::size_t offset; // index of the oldest sample
+	std::size_t count;
+
+	PassTimingHistory() :samples(), offset(0), count(0)
+	{
+		;
+	}
+
+	void Add(PassTimes const &times)
+	{
+		for (std::size_t i(0); i < g_RenderPassCount; ++i)
+			samples[i][offset] = times[i];
+		offset = (offset + 1) % length;
+		count = std::min(count + 1, length);
+	}
+
+	float Average(RenderPass pass) const
+	{
+		if (!count)
+			return 0.0f;
+		auto const &s(samples[static_cast<std::size_t>(pass)]);
+		float sum(0.0f);
+		for (float v : s)
+			sum += v;
+		return sum / static_cast<float>(count);
+	}
+
+	float Max(RenderPass pass) const
+	{
+		auto const &s(samples[static_cast<std::size_t>(pass)]);
+		return *std::max_element(s.begin(), s.end());
+	}
+};
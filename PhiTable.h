@@ -0,0 +1,221 @@
+#pragma once
+
+// CPU side of the phi cache: the same table FillPhiCache computes on the GPU, built with the
+// scalar integrator from Geodesic.h.
+//
+// The mapping is mirror symmetric: the ray leaving at 2π - φ is the reflection of the one leaving
+// at φ (b changes sign, everything else is even in b), so entry size - i is MirrorEntry(entry i).
+// Only entries 0..size/2 are traced and stored, on the GPU as well.
+
+#include "Geodesic.h"
+#include "Quadrature.h"
+#include "RadiusTable.h"
+#include "Profiler.h"
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <type_traits>
+
+std::uint32_t constexpr g_PhiCacheSize = 16384; // logical entries over [0, 2π), must be even
+
+// entries 0..size/2 inclusive
+inline std::uint32_t constexpr PhiTableStoredEntries(std::uint32_t size)
+{
+	return size / 2 + 1;
+}
+
+// entry for 2π - φ from the entry for φ: the direction is reflected, the side is the same
+inline geodesic::Traced<float> MirrorEntry(geodesic::Traced<float> const &e)
+{
+	return { -e.phi - geodesic::TwoPi<float>, e.l };
+}
+
+enum class PhiSolver
+{
+	RK4,		// the fixed step integration FillPhiCache does, closed form for a massless wormhole
+	Quadrature,	// PhiMappingQuadrature in double, asymptotic direction
+	Tabulated,	// RK4 with r(l) and dr/dl from a RadiusTable
+	Adaptive	// PhiMappingAdaptive (Dormand-Prince, tolerance 1e-5), cheap for coarse tables
+};
+
+struct PhiTable
+{
+	std::vector<geodesic::Traced<float>> entries; // entry i is the ray leaving the camera at 2πi/size, i <= size/2
+	std::uint32_t size;
+	Wormhole wormhole;
+	float l, r; // camera
+	// how the entries were traced, for ValidatePhiTableSymmetry
+	PhiSolver solver;
+	bool closedForm;
+	int steps;
+	// names the entries in cache keys (TileViewKey) where the address could be reused by a later
+	// table: new for every table constructed, kept by copies. Code that rewrites the entries of a
+	// table others may have seen calls Touch.
+	std::uint64_t generation;
+
+	PhiTable() :size(0), l(0.0f), r(0.0f), solver(PhiSolver::RK4), closedForm(false), steps(10000), generation(NextGeneration())
+	{
+		;
+	}
+
+	void Touch()
+	{
+		generation = NextGeneration();
+	}
+
+	static std::uint64_t NextGeneration()
+	{
+		static std::atomic<std::uint64_t> next(0);
+		return ++next;
+	}
+
+	std::uint32_t Size() const
+	{
+		return size;
+	}
+
+	// logical entry i of the full table
+	geodesic::Traced<float> Entry(std::uint32_t i) const
+	{
+		return i < entries.size() ? entries[i] : MirrorEntry(entries[size - i]);
+	}
+
+	// nearest entry, same indexing as phi_mapping in wormhole.hlsl
+	geodesic::Traced<float> Lookup(float phi) const
+	{
+		using geodesic::TwoPi;
+		phi = std::fmod(phi + TwoPi<float>, TwoPi<float>);
+		auto index(std::min(static_cast<std::uint32_t>(phi / TwoPi<float> * static_cast<float>(size)), size - 1));
+		return Entry(index);
+	}
+};
+
+// entry i of a size entry table, traced as BuildPhiTableWith does with the same arguments. radii
+// is only read by the Tabulated solver without closed form.
+template<typename Solver, typename ClosedForm, typename Steps>
+geodesic::Traced<float> TracePhiEntry(Wormhole const &wormhole, float l, float r, std::uint32_t size, std::uint32_t i, Solver solver, ClosedForm closedForm, Steps steps,
+									  RadiusTable const &radii)
+{
+	if (solver == PhiSolver::Quadrature)
+	{
+		double phi(static_cast<double>(i) / static_cast<double>(size) * geodesic::TwoPi<double>);
+		auto traced(geodesic::PhiMappingQuadrature<double>(phi, l, r, wormhole, 1e-6).traced);
+		return { static_cast<float>(traced.phi), static_cast<float>(traced.l) };
+	}
+	float phi(static_cast<float>(i) / static_cast<float>(size) * geodesic::TwoPi<float>);
+	if (closedForm)
+		return geodesic::PhiMappingClosedForm(phi, l, r, wormhole);
+	if (solver == PhiSolver::Adaptive)
+		return geodesic::PhiMappingAdaptive(phi, l, r, wormhole);
+	if (solver == PhiSolver::Tabulated)
+		return geodesic::PhiMappingTabulated(phi, l, r, radii, steps);
+	return geodesic::PhiMapping(phi, l, r, wormhole, steps);
+}
+
+// Builds the table with the solver checks of every entry resolved at compile time where the
+// arguments allow. Solver (PhiSolver), ClosedForm (bool) and Steps (int) are either the plain
+// types, checked per entry, or std::integral_constants of them, which fold the checks away;
+// BuildPhiTable picks the specialized instantiation. threads = 0 uses every hardware thread.
+// Setting *cancel stops the workers at their next entry and leaves the rest of the table empty.
+template<typename Solver, typename ClosedForm, typename Steps>
+PhiTable BuildPhiTableWith(Wormhole const &wormhole, float l, float r, std::uint32_t size, unsigned threads, Solver solver, ClosedForm closedForm, Steps steps,
+						   std::atomic<bool> const *cancel = nullptr)
+{
+	PROFILE_ZONE("CPU phi table build");
+	PhiTable table;
+	table.size = size;
+	table.wormhole = wormhole;
+	table.l = l;
+	table.r = r;
+	table.solver = solver;
+	table.closedForm = closedForm;
+	table.steps = steps;
+	std::uint32_t stored(PhiTableStoredEntries(size));
+	table.entries.resize(stored);
+
+	if (!threads)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, stored);
+
+	RadiusTable radii;
+	if (solver == PhiSolver::Tabulated && !closedForm)
+		radii = BuildRadiusTable(wormhole, PhiMappingRadiusUMax(wormhole, l, steps));
+	auto fill([&](std::uint32_t begin, std::uint32_t end) {
+		for (auto i(begin); i < end; ++i)
+		{
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return;
+			table.entries[i] = TracePhiEntry(wormhole, l, r, size, i, solver, closedForm, steps, radii);
+		}
+	});
+
+	std::vector<std::thread> workers;
+	for (unsigned t(1); t < threads; ++t)
+		workers.emplace_back(fill, static_cast<std::uint32_t>(std::uint64_t(stored) * t / threads), static_cast<std::uint32_t>(std::uint64_t(stored) * (t + 1) / threads));
+	fill(0, static_cast<std::uint32_t>(stored / threads));
+	for (auto &worker : workers)
+		worker.join();
+	return table;
+}
+
+template<PhiSolver Solver>
+using PhiSolverConstant = std::integral_constant<PhiSolver, Solver>;
+// step count of the shader, the only one with its own instantiations
+using DefaultStepsConstant = std::integral_constant<int, 10000>;
+
+// threads = 0 uses every hardware thread. steps is the RK4 step count (h stays 0.01).
+inline PhiTable BuildPhiTable(Wormhole const &wormhole, float l, float r, std::uint32_t size = g_PhiCacheSize, unsigned threads = 0, PhiSolver solver = PhiSolver::RK4, int steps = 10000,
+							  std::atomic<bool> const *cancel = nullptr)
+{
+	if (solver == PhiSolver::Quadrature)
+		return BuildPhiTableWith(wormhole, l, r, size, threads, PhiSolverConstant<PhiSolver::Quadrature>(), std::false_type(), steps, cancel);
+	if (geodesic::ClosedFormApplies(wormhole))
+		return BuildPhiTableWith(wormhole, l, r, size, threads, PhiSolverConstant<PhiSolver::RK4>(), std::true_type(), steps, cancel);
+	if (solver == PhiSolver::Adaptive)
+		return BuildPhiTableWith(wormhole, l, r, size, threads, PhiSolverConstant<PhiSolver::Adaptive>(), std::false_type(), steps, cancel);
+	if (steps != DefaultStepsConstant::value)
+		return BuildPhiTableWith(wormhole, l, r, size, threads, solver, std::false_type(), steps, cancel);
+	if (solver == PhiSolver::Tabulated)
+		return BuildPhiTableWith(wormhole, l, r, size, threads, PhiSolverConstant<PhiSolver::Tabulated>(), std::false_type(), DefaultStepsConstant(), cancel);
+	return BuildPhiTableWith(wormhole, l, r, size, threads, PhiSolverConstant<PhiSolver::RK4>(), std::false_type(), DefaultStepsConstant(), cancel);
+}
+
+struct SymmetryCheck
+{
+	float maxError; // radians
+	std::uint32_t checked, sideMismatches;
+
+	bool Holds(float tolerance) const
+	{
+		return maxError <= tolerance && sideMismatches == 0;
+	}
+};
+
+// Validation: traces samples of the mirrored half directly, with the solver, closed form and
+// step count the table was built with, and compares them to what the table derives. 2π - φ is
+// not exactly representable either, rays grazing the throat amplify that.
+inline SymmetryCheck ValidatePhiTableSymmetry(PhiTable const &table, std::uint32_t samples = 64)
+{
+	SymmetryCheck check{ 0.0f, 0, 0 };
+	RadiusTable radii;
+	if (table.solver == PhiSolver::Tabulated && !table.closedForm)
+		radii = BuildRadiusTable(table.wormhole, PhiMappingRadiusUMax(table.wormhole, table.l, table.steps));
+	std::uint32_t half(table.size / 2);
+	samples = std::max(1u, std::min(samples, half - 1));
+	for (std::uint32_t s(0); s < samples; ++s)
+	{
+		std::uint32_t i(table.size - 1 - s * (half - 1) / samples); // spread over the mirrored half
+		auto traced(TracePhiEntry(table.wormhole, table.l, table.r, table.size, i, table.solver, table.closedForm, table.steps, radii));
+		auto derived(table.Entry(i));
+		++check.checked;
+		if ((traced.l < 0.0f) != (derived.l < 0.0f))
+		{
+			++check.sideMismatches;
+			continue;
+		}
+		check.maxError = std::max(check.maxError, std::abs(geodesic::AngleDifference(traced.phi, derived.phi)));
+	}
+	return check;
+}
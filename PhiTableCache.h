@@ -0,0 +1,163 @@
+#pragma once
+
+// Recently used phi tables, so going back to a wormhole configuration or camera shell seen a
+// moment ago (toggling between a few slider settings, the F2 orbit at a fixed distance) reuses
+// its table instead of tracing it again. Tables are keyed by l, r, mass, radius, length and size,
+// the floats rounded to mantissaBits bits of mantissa, so values within about one part in 2^14
+// share a table. Least recently used tables are dropped once their storage exceeds the byte
+// budget. Tables are immutable and shared, the CPU renderers use them directly and WormholeRender
+// uploads them to its phi cache buffer. Safe to use from several threads.
+
+#include "PhiTable.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct PhiTableKey
+{
+	std::uint32_t l, r, mass, radius, length, size;
+
+	bool operator==(PhiTableKey const &a) const
+	{
+		return l == a.l && r == a.r && mass == a.mass && radius == a.radius && length == a.length && size == a.size;
+	}
+};
+
+struct PhiTableKeyHash
+{
+	std::size_t operator()(PhiTableKey const &key) const
+	{
+		std::uint64_t h(14695981039346656037ull); // FNV-1a over the fields
+		for (std::uint32_t v : { key.l, key.r, key.mass, key.radius, key.length, key.size })
+		{
+			h ^= v;
+			h *= 1099511628211ull;
+		}
+		return static_cast<std::size_t>(h);
+	}
+};
+
+struct PhiTableCacheStats
+{
+	std::uint64_t hits, misses, evictions;
+	std::size_t tables, bytes;
+
+	double HitRate() const
+	{
+		return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0;
+	}
+};
+
+struct PhiTableCache
+{
+	std::size_t budgetBytes;
+	std::uint32_t mantissaBits; // kept of the 23 when quantizing the key
+
+	explicit PhiTableCache(std::size_t budgetBytes = 64u << 20, std::uint32_t mantissaBits = 14)
+		:budgetBytes(budgetBytes), mantissaBits(std::min(mantissaBits, 23u)), stats{}
+	{
+		;
+	}
+
+	PhiTableCache(PhiTableCache const &) = delete;
+	PhiTableCache &operator=(PhiTableCache const &) = delete;
+
+	PhiTableKey Key(Wormhole const &w, float l, float r, std::uint32_t size) const
+	{
+		return { Quantize(l), Quantize(r), Quantize(w.mass), Quantize(w.radius), Quantize(w.length), size };
+	}
+
+	// the table for these parameters if one is cached, counted as a hit or a miss
+	std::shared_ptr<PhiTable const> Find(Wormhole const &w, float l, float r, std::uint32_t size)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(index.find(Key(w, l, r, size)));
+		if (it == index.end())
+		{
+			++stats.misses;
+			return nullptr;
+		}
+		++stats.hits;
+		recent.splice(recent.begin(), recent, it->second);
+		return it->second->second;
+	}
+
+	// caches a table under its own parameters, replacing one with the same key, then evicts down to the budget
+	void Insert(std::shared_ptr<PhiTable const> table)
+	{
+		if (!table)
+			return;
+		PhiTableKey key(Key(table->wormhole, table->l, table->r, table->size));
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it(index.find(key));
+		if (it != index.end())
+		{
+			stats.bytes -= Bytes(*it->second->second);
+			recent.erase(it->second);
+		}
+		stats.bytes += Bytes(*table);
+		recent.emplace_front(key, std::move(table));
+		index[key] = recent.begin();
+		// the newest table stays even when it alone is over the budget
+		while (stats.bytes > budgetBytes && recent.size() > 1)
+		{
+			stats.bytes -= Bytes(*recent.back().second);
+			index.erase(recent.back().first);
+			recent.pop_back();
+			++stats.evictions;
+		}
+		stats.tables = recent.size();
+	}
+
+	// Find, or build and insert on a miss. The build runs outside the lock, two threads missing the
+	// same key both build it.
+	std::shared_ptr<PhiTable const> Get(Wormhole const &w, float l, float r, std::uint32_t size, std::function<PhiTable()> const &build)
+	{
+		if (auto table = Find(w, l, r, size))
+			return table;
+		auto table(std::make_shared<PhiTable const>(build()));
+		Insert(table);
+		return table;
+	}
+
+	PhiTableCacheStats Stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		recent.clear();
+		index.clear();
+		stats = PhiTableCacheStats{};
+	}
+
+	static std::size_t Bytes(PhiTable const &table)
+	{
+		return sizeof(PhiTable) + table.entries.size() * sizeof(table.entries[0]);
+	}
+
+private:
+	using Entry = std::pair<PhiTableKey, std::shared_ptr<PhiTable const>>;
+
+	mutable std::mutex mutex;
+	std::list<Entry> recent; // most recently used first
+	std::unordered_map<PhiTableKey, std::list<Entry>::iterator, PhiTableKeyHash> index;
+	PhiTableCacheStats stats;
+
+	// rounds to the nearest value with mantissaBits of mantissa, relative steps of 2^-mantissaBits
+	std::uint32_t Quantize(float v) const
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		std::uint32_t drop(23 - mantissaBits);
+		return drop ? (bits + (1u << (drop - 1))) >> drop : bits;
+	}
+};
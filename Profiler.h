@@ -0,0 +1,281 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PROFILER_USE_RDTSC 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// A finished zone. name must be a string literal (or otherwise outlive the profiler).
+struct ProfileEvent
+{
+	char const *name;
+	std::uint64_t begin, end; // ticks
+	std::uint32_t depth;
+};
+
+// Single producer ring buffer, only the owning thread writes. Readers may see an event being
+// overwritten if they read while the buffer wraps, which is acceptable for a profiler.
+struct ProfilerThreadBuffer
+{
+	static std::size_t constexpr capacity = 1 << 16; // power of 2
+
+	std::unique_ptr<ProfileEvent[]> events;
+	std::atomic<std::uint64_t> head;
+	std::uint32_t depth;
+	std::uint32_t threadIndex;
+	std::string threadName;
+
+	ProfilerThreadBuffer(std::uint32_t threadIndex) :events(new ProfileEvent[capacity]), head(0), depth(0), threadIndex(threadIndex), threadName("thread " + std::to_string(threadIndex))
+	{
+		;
+	}
+
+	void Push(ProfileEvent const &e)
+	{
+		auto h(head.load(std::memory_order_relaxed));
+		events[h & (capacity - 1)] = e;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// events that ended within [from, to)
+	void Collect(std::uint64_t from, std::uint64_t to, std::vector<ProfileEvent> &out) const
+	{
+		auto h(head.load(std::memory_order_acquire));
+		auto first(h > capacity ? h - capacity : 0);
+		for (auto i(first); i < h; ++i)
+		{
+			auto const &e(events[i & (capacity - 1)]);
+			if (e.end >= from && e.end < to)
+				out.push_back(e);
+		}
+	}
+};
+
+// Hierarchical CPU zone profiler. Zones are coarse (passes, tiles, uploads) so the cost of two
+// timestamps and one ring buffer write per zone stays far below 1% of a frame.
+struct Profiler
+{
+	std::atomic<bool> enabled;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ProfilerThreadBuffer>> threads;
+	std::vector<ProfilerThreadBuffer *> idle; // of exited threads, taken by the next new thread
+
+	std::uint64_t tick0;
+	std::chrono::steady_clock::time_point time0;
+
+	// frame boundaries in ticks, written by the thread calling BeginFrame
+	std::atomic<std::uint64_t> frameBegin, lastFrameBegin;
+
+	Profiler() :enabled(false), tick0(Now()), time0(std::chrono::steady_clock::now()), frameBegin(tick0), lastFrameBegin(tick0)
+	{
+		;
+	}
+
+	Profiler(Profiler const &) = delete;
+	Profiler &operator=(Profiler const &) = delete;
+
+	static Profiler &Get()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	static std::uint64_t Now()
+	{
+#if defined(PROFILER_USE_RDTSC)
+		return __rdtsc();
+#else
+		return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	// rdtsc is calibrated against steady_clock over the whole lifetime of the profiler
+	double TicksPerMicrosecond() const
+	{
+#if defined(PROFILER_USE_RDTSC)
+		auto elapsed_us(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - time0).count());
+		if (elapsed_us < 1.0)
+			return 1000.0;
+		return static_cast<double>(Now() - tick0) / elapsed_us;
+#else
+		using period = std::chrono::steady_clock::period;
+		return static_cast<double>(period::den) / (static_cast<double>(period::num) * 1e6);
+#endif
+	}
+
+	// The buffer of a thread goes back to idle when it exits: the tile renderer starts its workers
+	// every frame, one buffer each would grow the profiler by a buffer per worker per frame.
+	ProfilerThreadBuffer &ThreadBuffer()
+	{
+		struct Owner
+		{
+			Profiler *profiler = nullptr;
+			ProfilerThreadBuffer *buffer = nullptr;
+
+			~Owner()
+			{
+				if (!buffer)
+					return;
+				std::lock_guard<std::mutex> lock(profiler->mutex);
+				profiler->idle.push_back(buffer);
+			}
+		};
+		thread_local Owner owner;
+		if (!owner.buffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!idle.empty())
+			{
+				owner.buffer = idle.back();
+				idle.pop_back();
+			}
+			else
+			{
+				threads.push_back(std::make_unique<ProfilerThreadBuffer>(static_cast<std::uint32_t>(threads.size())));
+				owner.buffer = threads.back().get();
+			}
+			owner.profiler = this;
+		}
+		return *owner.buffer;
+	}
+
+	void SetThreadName(std::string name)
+	{
+		auto &buffer(ThreadBuffer());
+		std::lock_guard<std::mutex> lock(mutex);
+		buffer.threadName = std::move(name);
+	}
+
+	void SetEnabled(bool value)
+	{
+		enabled.store(value, std::memory_order_relaxed);
+	}
+
+	bool Enabled() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void BeginFrame()
+	{
+		lastFrameBegin.store(frameBegin.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		frameBegin.store(Now(), std::memory_order_relaxed);
+	}
+
+	struct ThreadEvents
+	{
+		std::uint32_t threadIndex;
+		std::string threadName;
+		std::vector<ProfileEvent> events;
+	};
+
+	// all events that ended in [from, to), per thread, sorted by begin
+	std::vector<ThreadEvents> Collect(std::uint64_t from, std::uint64_t to)
+	{
+		std::vector<ThreadEvents> result;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto const &thread : threads)
+		{
+			ThreadEvents t{ thread->threadIndex, thread->threadName, {} };
+			thread->Collect(from, to, t.events);
+			std::sort(t.events.begin(), t.events.end(), [](auto const &a, auto const &b) { return a.begin < b.begin; });
+			result.push_back(std::move(t));
+		}
+		return result;
+	}
+
+	std::vector<ThreadEvents> CollectLastFrame()
+	{
+		return Collect(lastFrameBegin.load(std::memory_order_relaxed), frameBegin.load(std::memory_order_relaxed));
+	}
+
+	static std::string EscapeJSON(char const *s)
+	{
+		std::string result;
+		for (; *s; ++s)
+		{
+			if (*s == '"' || *s == '\\')
+				result.push_back('\\');
+			result.push_back(*s);
+		}
+		return result;
+	}
+
+	// everything still held in the ring buffers, as Chrome trace event format (chrome://tracing, Perfetto)
+	bool WriteChromeTrace(std::string const &filename)
+	{
+		std::ofstream file(filename);
+		if (!file)
+			return false;
+
+		double ticksPerUs(TicksPerMicrosecond());
+		auto threadEvents(Collect(0, ~0ull));
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first(true);
+		for (auto const &t : threadEvents)
+		{
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.threadIndex
+				<< ",\"args\":{\"name\":\"" << EscapeJSON(t.threadName.c_str()) << "\"}}";
+			first = false;
+			for (auto const &e : t.events)
+			{
+				double ts(static_cast<double>(e.begin - tick0) / ticksPerUs);
+				double dur(static_cast<double>(e.end - e.begin) / ticksPerUs);
+				file << ",\n{\"name\":\"" << EscapeJSON(e.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t.threadIndex
+					<< ",\"ts\":" << ts << ",\"dur\":" << dur << "}";
+			}
+		}
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+};
+
+struct ProfileZone
+{
+	ProfilerThreadBuffer *buffer;
+	char const *name;
+	std::uint64_t begin;
+
+	explicit ProfileZone(char const *name) :buffer(nullptr), name(name), begin(0)
+	{
+		auto &profiler(Profiler::Get());
+		if (profiler.Enabled())
+		{
+			buffer = &profiler.ThreadBuffer();
+			++buffer->depth;
+			begin = Profiler::Now();
+		}
+	}
+
+	~ProfileZone()
+	{
+		if (buffer)
+		{
+			auto end(Profiler::Now());
+			--buffer->depth;
+			buffer->Push({ name, begin, end, buffer->depth });
+		}
+	}
+
+	ProfileZone(ProfileZone const &) = delete;
+	ProfileZone &operator=(ProfileZone const &) = delete;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone_, __LINE__)(name)
@@ -0,0 +1,119 @@
+#pragma once
+
+// Phi table for parameters that change interactively (the wormhole sliders, the camera walking
+// through the throat). A full table traces g_PhiCacheSize / 2 + 1 rays of 10000 RK4 steps, too
+// slow to redo for every intermediate slider value. When the parameters change, Request builds a
+// coarse table right away (coarseSize entries with the adaptive integrator, which takes large
+// steps far from the throat) and returns it, then refines to fullSize with RK4 on a background
+// thread and swaps the result in atomically. A refinement still running when the parameters
+// change again is cancelled (its workers stop at their next entry) before the new coarse table
+// is built, so a drag only ever pays for coarse tables. With a PhiTableCache a full table cached
+// for the parameters is used right away, and finished refinements are added to it. A fullSize
+// below coarseSize makes the coarse table fullSize entries too, still refined with RK4. Where the
+// closed form applies no ray is traced, the full table is built right away and not refined.
+
+#include "PhiTable.h"
+#include "PhiTableCache.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+struct ProgressivePhiTable
+{
+	std::uint32_t coarseSize, fullSize;
+	unsigned threads; // workers of both builds, 0 every hardware thread
+	PhiTableCache *cache; // optional, full tables only
+
+	std::uint64_t coarseBuilds, refinementsStarted; // caller thread only
+	std::atomic<std::uint64_t> refinementsDone, refinementsCancelled;
+
+	explicit ProgressivePhiTable(std::uint32_t coarseSize = 512, std::uint32_t fullSize = g_PhiCacheSize, unsigned threads = 0, PhiTableCache *cache = nullptr)
+		:coarseSize(coarseSize), fullSize(fullSize), threads(threads), cache(cache), coarseBuilds(0), refinementsStarted(0), refinementsDone(0), refinementsCancelled(0),
+		cancel(false), requested(false), l(0.0f), r(0.0f)
+	{
+		;
+	}
+
+	~ProgressivePhiTable()
+	{
+		CancelRefinement();
+	}
+
+	ProgressivePhiTable(ProgressivePhiTable const &) = delete;
+	ProgressivePhiTable &operator=(ProgressivePhiTable const &) = delete;
+
+	// The best table for these parameters available now. Unchanged parameters return the current
+	// one, which is the refined table once the background build has swapped it in.
+	std::shared_ptr<PhiTable const> Request(Wormhole const &w, float newL, float newR)
+	{
+		if (requested && newL == l && newR == r && w.mass == wormhole.mass && w.radius == wormhole.radius && w.length == wormhole.length)
+			return Current();
+		CancelRefinement();
+		wormhole = w;
+		l = newL;
+		r = newR;
+		requested = true;
+
+		if (auto cached = cache ? cache->Find(w, newL, newR, fullSize) : nullptr)
+		{
+			std::atomic_store(&current, cached);
+			return cached;
+		}
+		if (geodesic::ClosedFormApplies(w))
+		{
+			auto full(std::make_shared<PhiTable const>(BuildPhiTable(w, newL, newR, fullSize, threads)));
+			if (cache)
+				cache->Insert(full);
+			std::atomic_store(&current, full);
+			return full;
+		}
+		auto coarse(std::make_shared<PhiTable const>(BuildPhiTable(w, newL, newR, std::min(coarseSize, fullSize), threads, PhiSolver::Adaptive)));
+		std::atomic_store(&current, coarse);
+		++coarseBuilds;
+		++refinementsStarted;
+		cancel = false;
+		refiner = std::thread([this, w, newL, newR, size = fullSize, workers = threads] {
+			auto full(std::make_shared<PhiTable const>(BuildPhiTable(w, newL, newR, size, workers, PhiSolver::RK4, 10000, &cancel)));
+			if (cancel.load())
+			{
+				++refinementsCancelled;
+				return;
+			}
+			if (cache)
+				cache->Insert(full);
+			std::atomic_store(&current, std::shared_ptr<PhiTable const>(full));
+			++refinementsDone;
+		});
+		return coarse;
+	}
+
+	// safe to call from any thread, while a refinement may be swapping in
+	std::shared_ptr<PhiTable const> Current() const
+	{
+		return std::atomic_load(&current);
+	}
+
+	// waits for the refinement in flight, for tools that want the full table
+	void WaitRefined()
+	{
+		if (refiner.joinable())
+			refiner.join();
+	}
+
+private:
+	std::shared_ptr<PhiTable const> current;
+	std::thread refiner;
+	std::atomic<bool> cancel;
+	bool requested;		// parameters of the last Request, caller thread only
+	Wormhole wormhole;
+	float l, r;
+
+	void CancelRefinement()
+	{
+		if (!refiner.joinable())
+			return;
+		cancel = true;
+		refiner.join();
+	}
+};
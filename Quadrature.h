@@ -0,0 +1,248 @@
+#pragma once
+
+// Deflection as a one dimensional integral instead of an ODE. b and B² are constants of motion
+// and so is H = p_l² + B²/r², so along the ray
+//
+//   dφ/dl = b / (r² p_l),  p_l = ±sqrt(H - b²/r(l)²)
+//
+// with r(l) from (5). A ray either escapes outward on the camera's side, turns around where
+// r(l) = |b|/sqrt(H), or passes through the throat when that radius is below ρ. The total change
+// of φ is a sum of integrals of b_e / (r sqrt(r² - b_e²)) over |l|, b_e = |b|/sqrt(H), evaluated
+// with adaptive Gauss-Kronrod. The inverse square root at a turning point is removed by
+// substituting |l| = u_t + w², the infinite range by u = U + s/(1 - s).
+//
+// Meant for T = double: the tolerance is absolute, float round-off in the integrand is above any
+// useful value and the integrator would only stop at its evaluation budget.
+
+#include "Geodesic.h"
+
+#include <limits>
+#include <cstdint>
+
+namespace quadrature
+{
+	// 7 point Gauss / 15 point Kronrod nodes and weights on [-1, 1]
+	double constexpr g_KronrodNodes[8] = {
+		0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+		0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+		0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+		0.207784955007898467600689403773245, 0.000000000000000000000000000000000 };
+	double constexpr g_KronrodWeights[8] = {
+		0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+		0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+		0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+		0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+	double constexpr g_GaussWeights[4] = { // for the odd Kronrod nodes 1, 3, 5 and the centre
+		0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+		0.381830050505118944950369775488975, 0.417959183673469387755102040816327 };
+
+	// Adaptive G7-K15 by bisection until the Kronrod/Gauss difference is below tolerance. Stops
+	// refining once evaluations reaches budget, so a near singular integrand cannot blow up.
+	template<typename T, typename F>
+	T GaussKronrod(F &&f, T a, T b, T tolerance, std::uint64_t &evaluations, std::uint64_t budget = 100000)
+	{
+		T centre((a + b) * T(0.5)), half((b - a) * T(0.5));
+		T fc(f(centre));
+		T kronrod(fc * T(g_KronrodWeights[7])), gauss(fc * T(g_GaussWeights[3]));
+		for (int i(0); i < 7; ++i)
+		{
+			T dx(half * T(g_KronrodNodes[i]));
+			T sum(f(centre - dx) + f(centre + dx));
+			kronrod += sum * T(g_KronrodWeights[i]);
+			if (i & 1)
+				gauss += sum * T(g_GaussWeights[i / 2]);
+		}
+		evaluations += 15;
+		kronrod *= half;
+		gauss *= half;
+
+		if (std::abs(kronrod - gauss) <= tolerance || evaluations >= budget || !(std::abs(half) > std::numeric_limits<T>::epsilon() * std::abs(centre)))
+			return kronrod;
+		return GaussKronrod(f, a, centre, tolerance * T(0.5), evaluations, budget) +
+			GaussKronrod(f, centre, b, tolerance * T(0.5), evaluations, budget);
+	}
+}
+
+namespace geodesic
+{
+	// r(l) of (5), even in l
+	template<typename T>
+	T RadiusOfL(T u, Wormhole const &w)
+	{
+		T a(w.length), M(w.mass);
+		if (u <= a)
+			return T(w.radius);
+		T x(T(2) * (u - a) / (Pi<T> * M));
+		return T(w.radius) + M * (x * std::atan(x) - T(0.5) * std::log1p(x * x));
+	}
+
+	// dr/d|l|
+	template<typename T>
+	T RadiusDerivative(T u, Wormhole const &w)
+	{
+		T a(w.length), M(w.mass);
+		if (u <= a)
+			return T(0);
+		return std::atan(T(2) * (u - a) / (Pi<T> * T(M))) * T(2) / Pi<T>;
+	}
+
+	// r(u0 + v) - r(u0) without cancellation for small v (Simpson on dr/du there)
+	template<typename T>
+	T RadiusDifference(T u0, T v, Wormhole const &w)
+	{
+		if (v < T(1e-5))
+			return v / T(6) * (RadiusDerivative(u0, w) + T(4) * RadiusDerivative(u0 + v * T(0.5), w) + RadiusDerivative(u0 + v, w));
+		return RadiusOfL(u0 + v, w) - RadiusOfL(u0, w);
+	}
+
+	template<typename T>
+	struct QuadratureResult
+	{
+		Traced<T> traced; // l is the side the ray leaves on, ±1
+		std::uint64_t evaluations;
+	};
+
+	template<typename T>
+	QuadratureResult<T> PhiMappingQuadrature(T phi, T l, T r, Wormhole const &w, T tolerance = T(1e-10))
+	{
+		T a(w.length), rho(w.radius);
+		std::uint64_t evals(0);
+
+		// same initial conditions as MakeRay, H from r(l) at the camera like the ODE sees it
+		T p_l(std::cos(phi));
+		T b(r * -std::sin(phi));
+		T u_c(std::abs(l));
+		T r_c(RadiusOfL(u_c, w));
+		T H(p_l * p_l + b * b / (r_c * r_c));
+		T b_e(H > T(0) ? std::abs(b) / std::sqrt(H) : T(0));
+		T side(l < T(0) ? T(-1) : T(1));
+
+		// b_e / (r sqrt(r² - b_e²)) at u0 + v, with c0 = r(u0) - b_e >= 0
+		auto integrand([&](T u0, T c0, T v) {
+			T r_u(RadiusOfL(u0 + v, w));
+			T r_minus_b(c0 + RadiusDifference(u0, v, w));
+			if (!(r_minus_b > T(0)))
+				return T(0);
+			return b_e / (r_u * std::sqrt(r_minus_b * (r_u + b_e)));
+		});
+
+		// ∫ over [u0, u1], u0 >= a, substituting u = u0 + w² so a turning point at u0 is harmless
+		auto segment([&](T u0, T u1, T c0) {
+			if (!(u1 > u0))
+				return T(0);
+			return quadrature::GaussKronrod<T>([&](T s) { return T(2) * s * integrand(u0, c0, s * s); }, T(0), std::sqrt(u1 - u0), tolerance, evals);
+		});
+
+		// ∫ over [u0, ∞)
+		auto toInfinity([&](T u0, T c0) {
+			T split(T(1) + u0);
+			T head(segment(u0, u0 + split, c0));
+			T tail(quadrature::GaussKronrod<T>([&](T s) {
+				T one_minus_s(T(1) - s);
+				return integrand(u0, c0, split + s / one_minus_s) / (one_minus_s * one_minus_s);
+			}, T(0), T(1), tolerance, evals));
+			return head + tail;
+		});
+
+		// ∫ over [0, u1), r is constant inside the throat
+		auto fromThroat([&](T u1) {
+			T c0(rho - b_e);
+			T inside(b_e / (rho * std::sqrt(std::max(c0 * (rho + b_e), T(0)))));
+			T throat(std::min(u1, a) * inside);
+			return std::isinf(u1) ? throat + toInfinity(a, c0) : throat + segment(a, u1, c0);
+		});
+
+		T total, exitSide(side);
+		bool outward(p_l * side > T(0) || (p_l == T(0) && u_c > a));
+		if (b_e == T(0))
+		{
+			// radial, straight through or straight out
+			total = T(0);
+			if (!outward)
+				exitSide = -side;
+		}
+		else if (outward)
+		{
+			total = u_c >= a ? toInfinity(u_c, std::max(r_c - b_e, T(0))) : (a - u_c) * b_e / (rho * std::sqrt(std::max((rho - b_e) * (rho + b_e), T(0)))) + toInfinity(a, rho - b_e);
+		}
+		else if (b_e > rho)
+		{
+			// turns around where r(u_t) = b_e, a < u_t <= u_c
+			T lo(a), hi(u_c);
+			while (hi - lo > std::numeric_limits<T>::epsilon() * (T(1) + hi))
+			{
+				T mid((lo + hi) * T(0.5));
+				(RadiusOfL(mid, w) < b_e ? lo : hi) = mid;
+				++evals;
+			}
+			T u_t(hi);
+			b_e = RadiusOfL(u_t, w); // the turning point defines b_e, keeps r - b_e >= 0 exactly
+			total = segment(u_t, u_c, T(0)) + toInfinity(u_t, T(0));
+		}
+		else
+		{
+			// through the throat to the other side
+			total = fromThroat(u_c) + fromThroat(std::numeric_limits<T>::infinity());
+			exitSide = -side;
+		}
+
+		T phi_inf(b < T(0) ? -total : total);
+		// direction of motion in the (l cos φ, l sin φ) plane, which points back for l < 0
+		T direction(exitSide < T(0) ? phi_inf + Pi<T> : phi_inf);
+		T folded(std::fmod(std::fmod(direction, TwoPi<T>) + TwoPi<T>, TwoPi<T>));
+		return { { -folded, exitSide }, evals };
+	}
+}
+
+namespace geodesic
+{
+	// As M -> 0, r(l) becomes ρ + max(|l| - a, 0): two flat sheets joined by a cylinder of length
+	// 2a (the M = 0 limit of (5), not the Ellis r² = ρ² + l²). Rays are straight lines on the
+	// sheets and the deflection integrals above are elementary. The error of the limit grows like
+	// M log(1/M), below this mass (relative to ρ, the slider minimum qualifies) it is smaller than
+	// the error of the fixed step RK4, measured against PhiMappingQuadrature.
+	float constexpr g_ClosedFormMaxMass = 4e-5f;
+
+	inline bool ClosedFormApplies(Wormhole const &w)
+	{
+		return w.mass <= g_ClosedFormMaxMass * w.radius;
+	}
+
+	// The massless limit of PhiMappingQuadrature, exact for M = 0. ∫ b/(r sqrt(r² - b²)) dr
+	// is acos(b/r), so each segment on a sheet is a difference of arccosines.
+	template<typename T>
+	Traced<T> PhiMappingClosedForm(T phi, T l, T r, Wormhole const &w)
+	{
+		T a(w.length), rho(w.radius);
+
+		T p_l(std::cos(phi));
+		T b(r * -std::sin(phi));
+		T u_c(std::abs(l));
+		T r_c(rho + std::max(u_c - a, T(0)));
+		T H(p_l * p_l + b * b / (r_c * r_c));
+		T b_e(H > T(0) ? std::abs(b) / std::sqrt(H) : T(0));
+		T side(l < T(0) ? T(-1) : T(1));
+
+		auto arccos([](T x) { return std::acos(std::min(x, T(1))); });
+		// the constant integrand inside the throat times the length travelled there
+		auto throat([&](T length) { return length > T(0) ? length * b_e / (rho * std::sqrt(std::max(rho * rho - b_e * b_e, T(0)))) : T(0); });
+
+		T total, exitSide(side);
+		bool outward(p_l * side > T(0) || (p_l == T(0) && u_c > a));
+		if (outward)
+			total = throat(a - u_c) + Pi<T> / T(2) - arccos(b_e / std::max(r_c, rho));
+		else if (b_e > rho)
+			total = Pi<T> / T(2) + arccos(b_e / r_c); // straight line past the hole
+		else
+		{
+			// in through the hole, along the cylinder and out on the other sheet
+			total = arccos(b_e / r_c) - arccos(b_e / rho) + throat(std::min(u_c, a) + a) + Pi<T> / T(2) - arccos(b_e / rho);
+			exitSide = -side;
+		}
+
+		T phi_inf(b < T(0) ? -total : total);
+		T direction(exitSide < T(0) ? phi_inf + Pi<T> : phi_inf);
+		T folded(std::fmod(std::fmod(direction, TwoPi<T>) + TwoPi<T>, TwoPi<T>));
+		return { -folded, exitSide };
+	}
+}
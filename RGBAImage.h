@@ -5,6 +5,8 @@
 #include <atlbase.h>
 #include <wincodec.h>
 
+#include <cstring>
+
 class RGBAImage // FP32 from 0.0f to 1.0f, RGBARGBARGBA...
 {
 	//TODO: maybe add alignment?
@@ -42,6 +44,7 @@ public:
 	}
 	RGBAImage(LPCWSTR filename) :data(nullptr), width(0), height(0)
 	{
+		PROFILE_ZONE("Image decode");
 		//CoInitialize(nullptr);
 		{
 			CComPtr<IWICImagingFactory> pFactory;
@@ -181,6 +184,8 @@ struct RGBAImageGPU
 	D3D12_RESOURCE_DESC textureDesc;
 
 	ComPtr<ID3D12Resource> tmp;
+	ComPtr<ID3D12Resource> readback; // created by the first Download
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT readbackFootprint;
 
 	RGBAImageGPU(RGBAImageGPU const &a) = delete;
 	RGBAImageGPU &operator=(RGBAImageGPU const &a) = delete;
@@ -195,17 +200,20 @@ struct RGBAImageGPU
 			texture = a.texture;
 			textureDesc = a.textureDesc;
 			tmp = a.tmp;
+			readback = a.readback;
+			readbackFootprint = a.readbackFootprint;
 			a.width = 0;
 			a.height = 0;
 			a.state = D3D12_RESOURCE_STATE_COMMON;
 			a.texture = nullptr;
 			a.textureDesc = {};
 			a.tmp = nullptr;
+			a.readback = nullptr;
 		}
 		return *this;
 	}
 
-	RGBAImageGPU() :width(0), height(0), state(D3D12_RESOURCE_STATE_COMMON), texture(nullptr), textureDesc(), tmp(nullptr)
+	RGBAImageGPU() :width(0), height(0), state(D3D12_RESOURCE_STATE_COMMON), texture(nullptr), textureDesc(), tmp(nullptr), readback(nullptr), readbackFootprint()
 	{
 		;
 	}
@@ -215,7 +223,7 @@ struct RGBAImageGPU
 		std::uint32_t width,
 		std::uint32_t height,
 		D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorDest
-	) :width(width), height(height), state(D3D12_RESOURCE_STATE_COMMON), textureDesc()
+	) :width(width), height(height), state(D3D12_RESOURCE_STATE_COMMON), textureDesc(), readbackFootprint()
 	{
 		// allocate GPU space for empty texture
 
@@ -255,7 +263,7 @@ struct RGBAImageGPU
 		std::uint32_t height,
 		D3D12_CPU_DESCRIPTOR_HANDLE srvDescriptorDest,
 		D3D12_CPU_DESCRIPTOR_HANDLE uavDescriptorDest
-	) :width(width), height(height), state(D3D12_RESOURCE_STATE_COMMON), textureDesc()
+	) :width(width), height(height), state(D3D12_RESOURCE_STATE_COMMON), textureDesc(), readbackFootprint()
 	{
 		// allocate GPU space for empty texture
 
@@ -319,6 +327,7 @@ struct RGBAImageGPU
 		RGBAImage const &img
 	) // upload to GPU
 	{
+		PROFILE_ZONE("Upload");
 		if (img.height != height || img.width != width)
 			throw std::runtime_error("image shape mismatch");
 
@@ -356,8 +365,41 @@ struct RGBAImageGPU
 		state = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
 	}
 
-	void Download() // Download image to CPU
+	// Download image to CPU: records a copy into a readback buffer, ReadDownloaded reads it once
+	// the command list has executed and its fence has been waited on
+	void Download(
+		ComPtr<ID3D12Device> device,
+		ComPtr<ID3D12GraphicsCommandList> commandList
+	)
 	{
-		;
+		UINT64 readbackSize;
+		device->GetCopyableFootprints(&textureDesc, 0, 1, 0, &readbackFootprint, nullptr, nullptr, &readbackSize);
+		if (!readback)
+			THROW(device->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+				D3D12_HEAP_FLAG_NONE,
+				&CD3DX12_RESOURCE_DESC::Buffer(readbackSize),
+				D3D12_RESOURCE_STATE_COPY_DEST,
+				nullptr,
+				IID_PPV_ARGS(&readback)));
+
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), state, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		state = D3D12_RESOURCE_STATE_COPY_SOURCE;
+
+		CD3DX12_TEXTURE_COPY_LOCATION dst(readback.Get(), readbackFootprint);
+		CD3DX12_TEXTURE_COPY_LOCATION src(texture.Get(), 0);
+		commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+	}
+
+	// width * height RGBA floats, rows are padded to 256 bytes in the readback buffer
+	void ReadDownloaded(float *dst)
+	{
+		void *mapped(nullptr);
+		THROW(readback->Map(0, nullptr, &mapped));
+		auto const *src(static_cast<std::uint8_t const *>(mapped) + readbackFootprint.Offset);
+		for (std::uint32_t y(0); y < height; ++y)
+			std::memcpy(dst + static_cast<std::size_t>(y) * width * 4, src + static_cast<std::size_t>(y) * readbackFootprint.Footprint.RowPitch, width * 16);
+		D3D12_RANGE writeRange{ 0, 0 };
+		readback->Unmap(0, &writeRange);
 	}
 };
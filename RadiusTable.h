@@ -0,0 +1,144 @@
+#pragma once
+
+// r(l) and dr/dl of (5) tabulated once per wormhole, so the right hand side of the geodesic
+// equation costs a square root and two cubics instead of atan, log and a division.
+//
+// Both are even in l and constant inside the throat, so the table covers u = |l| - a >= 0 and the
+// kink at |l| = a sits on its first node. Nodes are uniform in s = sqrt(u): r changes over a scale
+// of about πM/2 right outside the throat and almost linearly far away, the square root spends
+// the nodes where the curvature is. Each segment is the cubic Hermite interpolant of the exact
+// values and derivatives at its ends (in s), so both curves are C¹ and fourth order accurate.
+// Beyond the last node RadiusOfL and RadiusDerivative are evaluated directly.
+
+#include "Geodesic.h"
+#include "Quadrature.h"
+
+#include <vector>
+#include <cstdint>
+
+struct RadiusTable
+{
+	// r and dr/d|l| over one segment, c0 + c1 t + c2 t² + c3 t³ for t in [0, 1]
+	struct Segment
+	{
+		float r[4], dr[4];
+	};
+
+	std::vector<Segment> segments;
+	Wormhole wormhole;
+	float scale;	// segments per unit of sqrt(u)
+	float uMax;		// |l| - a covered by the table
+
+	RadiusTable() :scale(0.0f), uMax(0.0f)
+	{
+		;
+	}
+
+	// r(l) and dr/dl, dr/dl carries the sign of l
+	void Evaluate(float l, float &r, float &dr_dl) const
+	{
+		float u(std::abs(l) - wormhole.length);
+		if (u <= 0.0f)
+		{
+			r = wormhole.radius;
+			dr_dl = 0.0f;
+			return;
+		}
+		if (u >= uMax)
+		{
+			r = geodesic::RadiusOfL(std::abs(l), wormhole);
+			dr_dl = geodesic::RadiusDerivative(std::abs(l), wormhole) * geodesic::Sign(l);
+			return;
+		}
+		float s(std::sqrt(u) * scale);
+		auto i(std::min(static_cast<std::size_t>(s), segments.size() - 1));
+		float t(s - static_cast<float>(i));
+		Segment const &c(segments[i]);
+		r = c.r[0] + t * (c.r[1] + t * (c.r[2] + t * c.r[3]));
+		dr_dl = (c.dr[0] + t * (c.dr[1] + t * (c.dr[2] + t * c.dr[3]))) * geodesic::Sign(l);
+	}
+};
+
+// uMax is the largest |l| - a the table has to cover, see PhiMappingRadiusUMax
+inline RadiusTable BuildRadiusTable(Wormhole const &w, float uMax, std::uint32_t segments = 4096)
+{
+	RadiusTable table;
+	table.wormhole = w;
+	table.uMax = uMax;
+	table.segments.resize(segments);
+	double ds(std::sqrt(static_cast<double>(uMax)) / segments);
+	table.scale = static_cast<float>(1.0 / ds);
+
+	double a(w.length), M(w.mass);
+	// value and derivative in s of r and of dr/du at node i, du/ds = 2s
+	auto node([&](std::uint32_t i, double r[2], double dr[2]) {
+		double s(i * ds), u(s * s);
+		double x(2.0 * u / (geodesic::Pi<double> * M));
+		double d2r_du2(4.0 / (geodesic::Pi<double> * geodesic::Pi<double> * M * (1.0 + x * x)));
+		r[0] = geodesic::RadiusOfL(a + u, w);
+		dr[0] = geodesic::RadiusDerivative(a + u, w);
+		r[1] = dr[0] * 2.0 * s;
+		dr[1] = d2r_du2 * 2.0 * s;
+	});
+
+	// c of the Hermite cubic through (f0, f0') and (f1, f1') over a segment of length ds
+	auto hermite([ds](double const f0[2], double const f1[2], float c[4]) {
+		double d0(f0[1] * ds), d1(f1[1] * ds);
+		c[0] = static_cast<float>(f0[0]);
+		c[1] = static_cast<float>(d0);
+		c[2] = static_cast<float>(3.0 * (f1[0] - f0[0]) - 2.0 * d0 - d1);
+		c[3] = static_cast<float>(2.0 * (f0[0] - f1[0]) + d0 + d1);
+	});
+
+	double r0[2], dr0[2], r1[2], dr1[2];
+	node(0, r0, dr0);
+	for (std::uint32_t i(0); i < segments; ++i)
+	{
+		node(i + 1, r1, dr1);
+		hermite(r0, r1, table.segments[i].r);
+		hermite(dr0, dr1, table.segments[i].dr);
+		std::copy(r1, r1 + 2, r0);
+		std::copy(dr1, dr1 + 2, dr0);
+	}
+	return table;
+}
+
+// |l| - a the fixed step trace of PhiMapping can reach, |p_l| <= 1 along the ray
+inline float PhiMappingRadiusUMax(Wormhole const &w, float l, int steps = 10000, float h = 0.01f)
+{
+	return std::max(std::abs(l) - w.length, 0.0f) + static_cast<float>(steps + 10) * h + 1.0f;
+}
+
+namespace geodesic
+{
+	template<typename T>
+	State<T> NullGeodesic2D(State<T> const &s, RadiusTable const &table, Ray<T> const &ray)
+	{
+		float r, dr_dl;
+		table.Evaluate(s.l, r, dr_dl);
+		T r_sqr(r * r);
+		// dl/dt (A.7a), dφ/dt (A.7c), dp_l/dt (A.7d)
+		return { s.pl, ray.b / r_sqr, ray.B_sqr * dr_dl / (r_sqr * r) };
+	}
+
+	template<typename T>
+	State<T> RK4Step(State<T> const &s, T h, RadiusTable const &table, Ray<T> const &ray)
+	{
+		State<T> k1(NullGeodesic2D(s, table, ray) * h);
+		State<T> k2(NullGeodesic2D(s + k1 * T(0.5), table, ray) * h);
+		State<T> k3(NullGeodesic2D(s + k2 * T(0.5), table, ray) * h);
+		State<T> k4(NullGeodesic2D(s + k3, table, ray) * h);
+		return s + (k1 + k2 * T(2) + k3 * T(2) + k4) * (T(1) / T(6));
+	}
+
+	// PhiMapping with r(l) and dr/dl from the table, which must cover PhiMappingRadiusUMax
+	template<typename Steps = int>
+	Traced<float> PhiMappingTabulated(float phi, float l, float r, RadiusTable const &table, Steps steps = 10000, float h = 0.01f)
+	{
+		State<float> s;
+		Ray<float> ray(MakeRay(phi, r, s, l));
+		for (int i(0); i < steps; ++i)
+			s = RK4Step(s, h, table, ray);
+		return ChordDirection(s, RK4Step(s, h * 10.0f, table, ray));
+	}
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+// Ground truth for the phi mapping: adaptive Dormand-Prince in double (or long double) with tight
+// tolerances, following each ray until it is far enough from the throat that its direction no
+// longer changes, instead of stopping at a fixed affine parameter like the float RK4 does.
+// Golden tables computed with it for a fixed set of wormholes are the baseline the fast paths
+// are measured against.
+
+#include "Geodesic.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdint>
+
+namespace reference
+{
+	template<typename T>
+	struct Options
+	{
+		T tolerance = T(1e-12);
+		T farDistance = T(1e6); // |l| - a at which a ray counts as escaped, in units of (1 + ρ + a)
+		std::uint64_t maxSteps = 1000000; // rays near the photon sphere orbit for a long time
+	};
+
+	template<typename T>
+	struct Result
+	{
+		T phi, l; // same convention as geodesic::Traced
+		bool escaped;
+		std::uint64_t evaluations;
+	};
+
+	template<typename T>
+	Result<T> Trace(T phi, T l, T r, Wormhole const &w, Options<T> const &options = {})
+	{
+		using geodesic::State;
+		T a(w.length), M(w.mass), rho(w.radius);
+		State<T> s;
+		geodesic::Ray<T> ray(geodesic::MakeRay(phi, r, s, l));
+		auto f([&](State<T> const &x) { return geodesic::NullGeodesic2D(x, a, M, rho, ray); });
+
+		T far(options.farDistance * (T(1) + rho + a));
+		T h(T(1e-3));
+		std::uint64_t evals(1), steps(0);
+		State<T> k1(f(s));
+		bool escaped(false);
+		for (; steps < options.maxSteps; ++steps)
+		{
+			// outgoing (p_l has the sign of l) and far away
+			if (std::abs(s.l) - a > far && s.pl * s.l > T(0))
+			{
+				escaped = true;
+				break;
+			}
+			State<T> k7, e;
+			State<T> next(geodesic::DormandPrinceStep(f, s, k1, h, k7, e));
+			evals += 6;
+
+			T err(geodesic::StepError(s, next, e, options.tolerance, options.tolerance));
+			if (err <= T(1))
+			{
+				s = next;
+				k1 = k7;
+			}
+			T factor(err > T(0) ? T(0.9) * std::pow(err, T(-0.2)) : T(5));
+			h *= std::min(T(5), std::max(T(0.2), factor));
+		}
+		auto traced(geodesic::TangentDirection(s, k1));
+		return { traced.phi, traced.l, escaped, evals };
+	}
+
+	// a wormhole and camera the golden tables are computed for
+	struct GoldenConfig
+	{
+		char const *name;
+		Wormhole wormhole;
+		double l; // camera, r = ρ + |l|
+	};
+
+	inline std::vector<GoldenConfig> CanonicalConfigs()
+	{
+		auto make([](char const *name, float mass, float radius, float length, double l) {
+			GoldenConfig c{ name, Wormhole(), l };
+			c.wormhole.mass = mass;
+			c.wormhole.radius = radius;
+			c.wormhole.length = length;
+			return c;
+		});
+		return {
+			make("default", 0.1f, 0.5f, 0.0f, 4.0),
+			make("default_other_side", 0.1f, 0.5f, 0.0f, -2.0),
+			make("interstellar", 0.035f, 1.0f, 0.005f, 6.0), // a = 0.005ρ, W = 0.05ρ from the paper
+			make("thin", 0.01f, 1.0f, 0.0f, 4.0),
+			make("long_throat", 0.1f, 0.5f, 1.0f, 4.0),
+			make("heavy", 0.5f, 1.0f, 0.5f, 8.0),
+			make("massless", 0.00001f, 0.5f, 0.0f, 4.0), // slider minimum, closed form regime
+		};
+	}
+
+	struct GoldenEntry
+	{
+		double phiIn; // ray direction at the camera
+		double phi, l;
+		bool escaped;
+	};
+
+	// Text file: a header of "key values" lines, then one "phi_in phi l escaped" line per entry.
+	struct GoldenTable
+	{
+		std::string name;
+		Wormhole wormhole;
+		double l, r;
+		double tolerance;
+		std::vector<GoldenEntry> entries;
+
+		GoldenTable() :l(0), r(0), tolerance(0)
+		{
+			;
+		}
+
+		bool Save(std::string const &filename) const
+		{
+			std::ofstream file(filename);
+			if (!file)
+				return false;
+			file << std::setprecision(17);
+			file << "name " << name << "\n"
+				<< "wormhole " << wormhole.mass << " " << wormhole.radius << " " << wormhole.length << "\n"
+				<< "camera " << l << " " << r << "\n"
+				<< "tolerance " << tolerance << "\n"
+				<< "entries " << entries.size() << "\n";
+			for (auto const &e : entries)
+				file << e.phiIn << " " << e.phi << " " << e.l << " " << (e.escaped ? 1 : 0) << "\n";
+			return static_cast<bool>(file);
+		}
+
+		static GoldenTable Load(std::string const &filename)
+		{
+			std::ifstream file(filename);
+			if (!file)
+				throw std::runtime_error("failed to open golden table " + filename);
+
+			GoldenTable table;
+			std::string key;
+			std::size_t count(0);
+			file >> key >> table.name
+				>> key >> table.wormhole.mass >> table.wormhole.radius >> table.wormhole.length
+				>> key >> table.l >> table.r
+				>> key >> table.tolerance
+				>> key >> count;
+			table.entries.resize(count);
+			for (auto &e : table.entries)
+			{
+				int escaped(0);
+				file >> e.phiIn >> e.phi >> e.l >> escaped;
+				e.escaped = escaped != 0;
+			}
+			if (!file)
+				throw std::runtime_error("malformed golden table " + filename);
+			return table;
+		}
+	};
+
+	// samples at the centres of the cells of a size entry phi table, where nearest lookup is worst
+	template<typename T = double>
+	GoldenTable ComputeGoldenTable(GoldenConfig const &config, std::size_t size, Options<T> const &options = {})
+	{
+		GoldenTable table;
+		table.name = config.name;
+		table.wormhole = config.wormhole;
+		table.l = config.l;
+		table.r = config.wormhole.radius + std::abs(config.l);
+		table.tolerance = static_cast<double>(options.tolerance);
+		table.entries.resize(size);
+		for (std::size_t i(0); i < size; ++i)
+		{
+			T phiIn((static_cast<T>(i) + T(0.5)) / static_cast<T>(size) * geodesic::TwoPi<T>);
+			auto result(Trace<T>(phiIn, static_cast<T>(table.l), static_cast<T>(table.r), config.wormhole, options));
+			table.entries[i] = { static_cast<double>(phiIn), static_cast<double>(result.phi), static_cast<double>(result.l), result.escaped };
+		}
+		return table;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// What a frame of the wormhole needs from the machine it runs on: RGBA float images, a phi table
+// build and the per pixel pass, with per pass timings. D3D12Backend.h runs them through
+// WormholeRender on the GPU, CpuBackend.h through PhiTable.h and TileRenderer.h on every core,
+// so the same frame renders on Windows and on machines without D3D12, and ImageDiff.h compares
+// the two (backend-compare).
+
+#include "Wormhole.h"
+#include "LensedSky.h"
+#include "Foveation.h"
+#include "PassTiming.h"
+
+#include <cstdint>
+
+using BackendImage = std::uint32_t; // handle from CreateImage
+
+struct RenderBackend
+{
+	virtual ~RenderBackend()
+	{
+		;
+	}
+	virtual char const *Name() const = 0;
+
+	// width x height RGBA float image, the contents are undefined until uploaded or rendered to
+	virtual BackendImage CreateImage(std::uint32_t width, std::uint32_t height) = 0;
+	// width * height * 4 floats, row major
+	virtual void Upload(BackendImage image, float const *rgba) = 0;
+
+	// phi table of a camera at l (r its distance to the centre), used by the following RenderPixels
+	virtual void BuildPhiTable(Wormhole const &wormhole, float l, float r, std::uint32_t size = g_PhiCacheSize) = 0;
+	// the per pixel pass into dst (cam.width x cam.height at its top left), sky1 on the camera's side
+	virtual void RenderPixels(BackendImage sky1, BackendImage sky2, BackendImage dst, RayCamera const &cam, Foveation const &foveation) = 0;
+
+	// waits for the work submitted so far and copies the image out
+	virtual void Readback(BackendImage image, float *rgba) = 0;
+
+	// BeginFrame/EndFrame bracket the passes whose timings Timestamps() collects
+	virtual void BeginFrame() = 0;
+	virtual void EndFrame() = 0;
+	virtual TimestampBackend &Timestamps() = 0;
+};
@@ -132,7 +132,7 @@ struct ScreenQuad
 			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS;
 
 		// A single 32-bit constant root parameter that is used by the vertex shader.
-		CD3DX12_ROOT_PARAMETER1 rootParameters[1] = {};
+		CD3DX12_ROOT_PARAMETER1 rootParameters[2] = {};
 
 		// create a descriptor range (descriptor table) and fill it out
 		// this is a range of descriptors inside a descriptor heap
@@ -153,6 +153,7 @@ struct ScreenQuad
 
 		auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 		rootParameters[0].InitAsDescriptorTable(1, std::addressof(r1), D3D12_SHADER_VISIBILITY_PIXEL);
+		rootParameters[1].InitAsConstants(4, 0); // uv scale and clamp of the rendered part
 
 		// create a static sampler
 		D3D12_STATIC_SAMPLER_DESC sampler = {};
@@ -256,14 +257,24 @@ struct ScreenQuad
 		//ThrowIfFailed(device->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&pipelineState)));
 	}
 
-	void Render(ComPtr<ID3D12GraphicsCommandList> commandList, DescriptorHeapWrapper& textureSRVHeap, std::size_t textuteHeapOffset)
+	// width and height are the part of the texture (textureWidth x textureHeight) holding the image
+	void Render(ComPtr<ID3D12GraphicsCommandList> commandList, DescriptorHeapWrapper& textureSRVHeap, std::size_t textuteHeapOffset,
+				std::uint32_t width = 1, std::uint32_t height = 1, std::uint32_t textureWidth = 1, std::uint32_t textureHeight = 1)
 	{
+		PROFILE_ZONE("Screen quad");
 		commandList->SetPipelineState(pipelineState.Get());
 		commandList->SetGraphicsRootSignature(rootSignature.Get());
 
 		ID3D12DescriptorHeap *descriptorHeaps[] = { textureSRVHeap.heap.Get() };
 		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 		commandList->SetGraphicsRootDescriptorTable(0, textureSRVHeap.at_gpu(textuteHeapOffset));
+		float viewport[4] = {
+			static_cast<float>(width) / static_cast<float>(textureWidth),
+			static_cast<float>(height) / static_cast<float>(textureHeight),
+			(static_cast<float>(width) - 0.5f) / static_cast<float>(textureWidth),
+			(static_cast<float>(height) - 0.5f) / static_cast<float>(textureHeight)
+		};
+		commandList->SetGraphicsRoot32BitConstants(1, 4, viewport, 0);
 
 		commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 		commandList->IASetVertexBuffers(0, 1, &vertexBufferView);
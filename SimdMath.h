@@ -0,0 +1,93 @@
+#pragma once
+
+// 4-wide float math for the CPU geodesic kernels. SSE2 only, so it is available on every x64
+// target. The transcendental functions follow the Cephes single precision approximations
+// (about 1 ulp over the ranges the geodesic equations use).
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WORMHOLE_SSE2 1
+#include <emmintrin.h>
+
+namespace simd
+{
+	inline __m128 abs_ps(__m128 x)
+	{
+		return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+	}
+
+	// -1, 0 or 1 like HLSL sign()
+	inline __m128 sign_ps(__m128 x)
+	{
+		__m128 positive(_mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+		__m128 negative(_mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+		return _mm_sub_ps(positive, negative);
+	}
+
+	inline __m128 select_ps(__m128 mask, __m128 a, __m128 b) // mask ? a : b
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline __m128 atan_ps(__m128 x)
+	{
+		__m128 signBit(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(0x80000000)))));
+		x = abs_ps(x);
+
+		// range reduction to |x| <= tan(pi/8)
+		__m128 big(_mm_cmpgt_ps(x, _mm_set1_ps(2.414213562373095f)));
+		__m128 mid(_mm_andnot_ps(big, _mm_cmpgt_ps(x, _mm_set1_ps(0.4142135623730950f))));
+		__m128 y(_mm_or_ps(_mm_and_ps(big, _mm_set1_ps(1.5707963267948966f)), _mm_and_ps(mid, _mm_set1_ps(0.7853981633974483f))));
+		__m128 xBig(_mm_div_ps(_mm_set1_ps(-1.0f), x));
+		__m128 xMid(_mm_div_ps(_mm_sub_ps(x, _mm_set1_ps(1.0f)), _mm_add_ps(x, _mm_set1_ps(1.0f))));
+		x = select_ps(big, xBig, select_ps(mid, xMid, x));
+
+		__m128 z(_mm_mul_ps(x, x));
+		__m128 p(_mm_set1_ps(8.05374449538e-2f));
+		p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.38776856032e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.99777106478e-1f));
+		p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.33329491539e-1f));
+		p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), x), x);
+		y = _mm_add_ps(y, p);
+
+		return _mm_xor_ps(y, signBit);
+	}
+
+	// natural log for x > 0
+	inline __m128 log_ps(__m128 x)
+	{
+		__m128 one(_mm_set1_ps(1.0f));
+		x = _mm_max_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x00800000))); // smallest normal
+
+		__m128i exponent(_mm_srli_epi32(_mm_castps_si128(x), 23));
+		x = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(~0x7f800000)));
+		x = _mm_or_ps(x, _mm_set1_ps(0.5f));
+		exponent = _mm_sub_epi32(exponent, _mm_set1_epi32(0x7f));
+		__m128 e(_mm_add_ps(_mm_cvtepi32_ps(exponent), one));
+
+		// mantissa in [sqrt(1/2), sqrt(2))
+		__m128 mask(_mm_cmplt_ps(x, _mm_set1_ps(0.707106781186547524f)));
+		__m128 tmp(_mm_and_ps(x, mask));
+		x = _mm_sub_ps(x, one);
+		e = _mm_sub_ps(e, _mm_and_ps(one, mask));
+		x = _mm_add_ps(x, tmp);
+
+		__m128 z(_mm_mul_ps(x, x));
+		__m128 y(_mm_set1_ps(7.0376836292e-2f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.1514610310e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.1676998740e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.2420140846e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.4249322787e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-1.6668057665e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(2.0000714765e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(-2.4999993993e-1f));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(3.3333331174e-1f));
+		y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+
+		y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(-2.12194440e-4f)));
+		y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+		x = _mm_add_ps(x, y);
+		x = _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(0.693359375f)));
+		return x;
+	}
+}
+#endif
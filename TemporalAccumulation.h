@@ -0,0 +1,100 @@
+#pragma once
+
+// Temporal accumulation for a view that holds still. While the camera, projection, wormhole and
+// table size stay the same every frame traces the same rays, so instead each frame moves its
+// samples by a sub-pixel jitter (a Halton (2, 3) sequence, the first frame unjittered) and is
+// blended into a history: frame n gets weight 1 / n, a running mean, until maxFrames, after which
+// the history is an exponential average. Any change of the view resets it. An idle view
+// converges to a box filtered, anti-aliased image for one sample per pixel per frame.
+// TemporalAccumulator.h runs the blend on the GPU, Blend here on the CPU.
+
+#include "LensedSky.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// radical inverse of index in base, the Halton sequence
+inline float Halton(std::uint32_t index, std::uint32_t base)
+{
+	float result(0.0f), f(1.0f);
+	for (; index; index /= base)
+	{
+		f /= static_cast<float>(base);
+		result += f * static_cast<float>(index % base);
+	}
+	return result;
+}
+
+// what a frame's rays depend on: camera frame, field of view, resolution, projection, wormhole
+// and phi table size
+using TemporalViewKey = std::array<float, 22>;
+
+inline TemporalViewKey MakeTemporalViewKey(RayCamera const &cam, Wormhole const &wormhole, std::uint32_t tableSize)
+{
+	return { cam.position.x, cam.position.y, cam.position.z, cam.forward.x, cam.forward.y, cam.forward.z, cam.up.x, cam.up.y, cam.up.z,
+			 cam.right.x, cam.right.y, cam.right.z, cam.fovX, cam.fovY, static_cast<float>(cam.width), static_cast<float>(cam.height),
+			 static_cast<float>(cam.projection), cam.fisheyeFov, wormhole.mass, wormhole.radius, wormhole.length, static_cast<float>(tableSize) };
+}
+
+struct TemporalAccumulation
+{
+	std::uint32_t maxFrames;	// of the running mean, then weight 1 / maxFrames
+	std::uint32_t frames;		// accumulated since the last reset, including the current one
+	std::uint64_t resets;
+	TemporalViewKey view;
+	bool valid;					// view holds the last frame's key
+
+	explicit TemporalAccumulation(std::uint32_t maxFrames = 256) :maxFrames(std::max(maxFrames, 1u)), frames(0), resets(0), view(), valid(false)
+	{
+		;
+	}
+
+	// starts a frame of this view, true if the history was reset (the frame replaces it)
+	bool Begin(TemporalViewKey const &key)
+	{
+		bool reset(!valid || key != view);
+		if (reset)
+		{
+			view = key;
+			valid = true;
+			frames = 0;
+			++resets;
+		}
+		++frames;
+		return reset;
+	}
+
+	// the next Begin resets, for frames rendered without accumulation in between
+	void Invalidate()
+	{
+		valid = false;
+	}
+
+	// offset of the current frame's samples, in pixels within [-0.5, 0.5)
+	void Jitter(float &x, float &y) const
+	{
+		std::uint32_t index(frames > 0 ? (frames - 1) % 1024 : 0);
+		x = index ? Halton(index, 2) - 0.5f : 0.0f;
+		y = index ? Halton(index, 3) - 0.5f : 0.0f;
+	}
+
+	// of the current frame in the history, 1 right after a reset
+	float Weight() const
+	{
+		return 1.0f / static_cast<float>(std::min(std::max(frames, 1u), maxFrames));
+	}
+
+	// history += (frame - history) * weight over count floats, a weight of 1 overwrites
+	static void Blend(float const *frame, float *history, std::size_t count, float weight)
+	{
+		if (weight >= 1.0f)
+		{
+			std::copy(frame, frame + count, history);
+			return;
+		}
+		for (std::size_t i(0); i < count; ++i)
+			history[i] += (frame[i] - history[i]) * weight;
+	}
+};
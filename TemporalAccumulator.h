@@ -0,0 +1,168 @@
+#pragma once
+
+// Temporal accumulation of the direct per pixel pass on the GPU (temporal_accumulate.hlsl), with
+// the jitter, weights and reset of TemporalAccumulation.h. BeginFrame sets WormholeRender's jitter
+// for the frame, Accumulate blends the traced frame into the history, which the screen quad shows
+// instead of the frame. The foveated shader does not jitter, main.cc does not accumulate with
+// foveated tracing on.
+
+#include "common.h"
+#include "Camera.h"
+#include "DescriptorHeap.h"
+#include "GpuTimer.h"
+#include "RGBAImage.h"
+#include "WormholeRender.h"
+#include "TemporalAccumulation.h"
+
+inline TemporalViewKey MakeTemporalViewKey(Camera const &cam, Wormhole const &wormhole, std::uint32_t tableSize)
+{
+	XMFLOAT3 p(cam.GetPosition()), f(cam.GetLookDir()), u(cam.GetUp()), r(cam.GetRight());
+	return { p.x, p.y, p.z, f.x, f.y, f.z, u.x, u.y, u.z, r.x, r.y, r.z, cam.GetFovX(), cam.GetFovY(), static_cast<float>(cam.GetWidth()), static_cast<float>(cam.GetHeight()),
+			 static_cast<float>(cam.GetOutputProjection()), cam.GetFisheyeFov(), wormhole.mass, wormhole.radius, wormhole.length, static_cast<float>(tableSize) };
+}
+
+struct TemporalAccumulator
+{
+	ComPtr<ID3D12PipelineState> pipelineState;
+	ComPtr<ID3D12RootSignature> rootSignature;
+	RGBAImageGPU history; // full render texture size, the image at its top left
+	TemporalAccumulation state;
+
+	TemporalAccumulator()
+	{
+		;
+	}
+
+	TemporalAccumulator(TemporalAccumulator const &a) = delete;
+	TemporalAccumulator &operator=(TemporalAccumulator const &a) = delete;
+
+	TemporalAccumulator(TemporalAccumulator &&a) noexcept
+	{
+		*this = std::move(a);
+	}
+
+	TemporalAccumulator &operator=(TemporalAccumulator &&a) noexcept
+	{
+		if (this != std::addressof(a))
+		{
+			pipelineState = std::move(a.pipelineState);
+			rootSignature = std::move(a.rootSignature);
+			history = std::move(a.history);
+			state = a.state;
+		}
+		return *this;
+	}
+
+	// SRV of the history at heapOffset, UAV at heapOffset + 1
+	TemporalAccumulator(ComPtr<ID3D12Device2> device, DescriptorHeapWrapper &heap, std::size_t heapOffset, std::uint32_t width, std::uint32_t height) :
+		history(device, width, height, heap.at_cpu(heapOffset), heap.at_cpu(heapOffset + 1))
+	{
+		ComPtr<ID3DBlob> computeShaderBlob;
+		ThrowIfFailed(D3DReadFileToBlob(L"temporal_accumulate.cso", &computeShaderBlob));
+
+		D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+		if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+			featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+		D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
+
+		CD3DX12_ROOT_PARAMETER1 rootParameters[3] = {};
+
+		rootParameters[0].InitAsConstants(4, 0); // size and weight
+		auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+		rootParameters[1].InitAsDescriptorTable(1, std::addressof(r1));
+		auto r2 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+		rootParameters[2].InitAsDescriptorTable(1, std::addressof(r2));
+
+		CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription{};
+		rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, rootSignatureFlags);
+
+		ComPtr<ID3DBlob> rootSignatureBlob;
+		ComPtr<ID3DBlob> errorBlob;
+		auto hr = D3DX12SerializeVersionedRootSignature(&rootSignatureDescription,
+			featureData.HighestVersion, &rootSignatureBlob, &errorBlob);
+		if (FAILED(hr))
+		{
+			std::string errorString;
+
+			if (errorBlob)
+			{
+				errorString.append(": ");
+
+				errorString.append(
+					reinterpret_cast<char *>(
+					errorBlob->GetBufferPointer()),
+					errorBlob->GetBufferSize());
+				MessageBoxA(NULL, errorString.c_str(), "TemporalAccumulator", MB_OK | MB_ICONERROR);
+			}
+			__debugbreak();
+		}
+		ThrowIfFailed(device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(),
+			rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&rootSignature)));
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+		psoDesc.pRootSignature = rootSignature.Get();
+		psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+
+		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineState)));
+	}
+
+	// starts a frame of this view and sets the jitter WormholeRender traces it with
+	void BeginFrame(WormholeRender &wormholeRender, Camera const &cam, Wormhole const &wormhole)
+	{
+		state.Begin(MakeTemporalViewKey(cam, wormhole, wormholeRender.phiTableSize));
+		state.Jitter(wormholeRender.jitterX, wormholeRender.jitterY);
+	}
+
+	// for frames rendered without accumulation: no jitter, and the next BeginFrame resets
+	void Invalidate(WormholeRender &wormholeRender)
+	{
+		state.Invalidate();
+		wormholeRender.jitterX = 0.0f;
+		wormholeRender.jitterY = 0.0f;
+	}
+
+	// blends the width x height image of the frame into the history. The frame texture must be a
+	// compute SRV and the history a UAV.
+	void Accumulate(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t frameSRVHeapOffset,
+		std::size_t historyUAVHeapOffset,
+		std::uint32_t width,
+		std::uint32_t height,
+		TimestampBackend *timestamps = nullptr
+	)
+	{
+		PROFILE_ZONE("Temporal accumulate");
+		ScopedTimestamp timestamp(timestamps, RenderPass::Accumulate);
+		commandList->SetPipelineState(pipelineState.Get());
+		commandList->SetComputeRootSignature(rootSignature.Get());
+
+		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
+		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+		struct
+		{
+			std::uint32_t width;
+			std::uint32_t height;
+			float weight;
+			std::uint32_t pad;
+		} accumulate{ width, height, state.Weight(), 0 };
+
+		commandList->SetComputeRoot32BitConstants(0, 4, &accumulate, 0);
+		commandList->SetComputeRootDescriptorTable(1, textureHeap.at_gpu(frameSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(2, textureHeap.at_gpu(historyUAVHeapOffset));
+
+		UINT groupX(((width - 1) / 32) + 1);
+		UINT groupY(((height - 1) / 32) + 1);
+
+		commandList->Dispatch(groupX, groupY, 1);
+	}
+};
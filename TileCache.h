@@ -0,0 +1,123 @@
+#pragma once
+
+// Partial re-render for the CPU tile renderer: the 8x8 tiles of the last frame stay in the
+// target image and each has a validity key, a hash of everything its pixels depend on (camera,
+// projection and jitter, phi table, skymaps, kernel options, the target buffer and the tile's
+// shading rate). RenderTiles with a TileCache traces only the tiles whose key changed, those
+// inside a dirty rectangle given by the caller (a skymap region updated in place) and none
+// entirely under an opaque occluder (a UI window over the image), which are traced once
+// uncovered. A still view costs no rays, moving the fovea re-traces only the tiles whose rate
+// changed. Any camera movement changes every ray, so a pan re-traces the whole image; rotation
+// only changes are what the environment cache is for. One cache per target image.
+
+#include "Foveation.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct TileRect
+{
+	std::uint32_t x, y, width, height; // pixels
+
+	bool Contains(std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1) const
+	{
+		return x0 >= x && y0 >= y && x1 <= x + width && y1 <= y + height;
+	}
+
+	bool Overlaps(std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1) const
+	{
+		return x0 < x + width && x < x1 && y0 < y + height && y < y1;
+	}
+};
+
+// FNV-1a over the bytes of values, chained through h
+struct TileKeyHash
+{
+	std::uint64_t h = 14695981039346656037ull;
+
+	template<typename T>
+	TileKeyHash &Add(T const &value)
+	{
+		unsigned char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		for (unsigned char b : bytes)
+		{
+			h ^= b;
+			h *= 1099511628211ull;
+		}
+		return *this;
+	}
+};
+
+struct TileCache
+{
+	std::vector<std::uint64_t> keys;	// per tile of the last frame, 0 not valid
+	std::vector<TileRect> dirty;		// re-traced by the next frame whatever their keys, then cleared
+	std::vector<TileRect> occluders;	// opaque overlays, tiles entirely under one are not traced; kept until changed
+	std::uint32_t tilesX, tilesY;
+
+	std::uint32_t traced, skipped, occluded;	// tiles of the last frame
+	std::uint64_t frames, tracedTotal, skippedTotal, occludedTotal;
+
+	TileCache() :tilesX(0), tilesY(0), traced(0), skipped(0), occluded(0), frames(0), tracedTotal(0), skippedTotal(0), occludedTotal(0)
+	{
+		;
+	}
+
+	void Invalidate(TileRect const &rect)
+	{
+		dirty.push_back(rect);
+	}
+
+	// every tile is traced by the next frame, for skymaps replaced in place
+	void InvalidateAll()
+	{
+		std::fill(keys.begin(), keys.end(), 0);
+	}
+
+	// Starts a frame of width x height pixels: stale[i] is set for the tiles to trace, keys hold
+	// the new keys (0 for occluded tiles, so they are traced once uncovered). view is what every
+	// tile depends on (TileViewKey in TileRenderer.h), rate(tile) the shading rate the kernel
+	// picks for the tile.
+	template<typename Rate>
+	void Begin(std::uint64_t view, std::uint32_t width, std::uint32_t height, Rate const &rate, std::vector<std::uint8_t> &stale)
+	{
+		std::uint32_t x((width + g_TileSize - 1) / g_TileSize), y((height + g_TileSize - 1) / g_TileSize);
+		if (x != tilesX || y != tilesY)
+		{
+			tilesX = x;
+			tilesY = y;
+			keys.assign(static_cast<std::size_t>(x) * y, 0);
+		}
+		stale.assign(keys.size(), 0);
+		traced = skipped = occluded = 0;
+		for (std::uint32_t tile(0); tile < keys.size(); ++tile)
+		{
+			std::uint32_t x0(tile % tilesX * g_TileSize), y0(tile / tilesX * g_TileSize);
+			std::uint32_t x1(std::min(x0 + g_TileSize, width)), y1(std::min(y0 + g_TileSize, height));
+			if (std::any_of(occluders.begin(), occluders.end(), [&](TileRect const &r) { return r.Contains(x0, y0, x1, y1); }))
+			{
+				keys[tile] = 0;
+				++occluded;
+				continue;
+			}
+			std::uint64_t key(TileKeyHash{ view }.Add(rate(tile)).h | 1);
+			bool isDirty(std::any_of(dirty.begin(), dirty.end(), [&](TileRect const &r) { return r.Overlaps(x0, y0, x1, y1); }));
+			if (key == keys[tile] && !isDirty)
+			{
+				++skipped;
+				continue;
+			}
+			keys[tile] = key;
+			stale[tile] = 1;
+			++traced;
+		}
+		dirty.clear();
+		++frames;
+		tracedTotal += traced;
+		skippedTotal += skipped;
+		occludedTotal += occluded;
+	}
+};
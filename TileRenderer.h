@@ -0,0 +1,318 @@
+#pragma once
+
+// CPU renderer of the per pixel pass: the image is cut into 8x8 tiles that worker threads take
+// one at a time. With foveation the periphery traces fewer rays: a tile gets a shading rate of
+// 1, 2 or 4 pixels per traced sample along each axis from its distance to the fovea, traces the
+// lattice of samples spaced by the rate including the first row and column of the next tiles,
+// and interpolates bilinearly between them. A coarse tile whose samples straddle the throat
+// edge or the Einstein ring (different sides, or traced angles far apart) is traced at full
+// rate instead, the interpolation would smear exactly the features worth looking at.
+// wormhole_foveated.hlsl does the same on the GPU. Any OutputProjection renders through the same
+// tiles, a 360 frame of several times the pixels of 1080p keeps every worker busy until the last
+// few tiles since they are handed out one at a time. The per pixel options (projection, sky
+// filter, pixel format, supersampling) are template policies of the kernel, RenderTiles picks
+// the instantiation with all of them constant once per call. With a TileCache only the tiles
+// whose inputs changed since the last frame are traced, the rest keep their pixels in dst.
+// RenderTilesScheduled takes the schedule that hands tiles to workers: SharedTileQueue here, or
+// NumaTileScheduler.h for several NUMA nodes.
+
+#include "LensedSky.h"
+#include "Foveation.h"
+#include "TileCache.h"
+#include "Profiler.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+struct TileStats
+{
+	std::uint64_t rays;
+	std::uint32_t tiles[3];		// by rate 1, 2, 4
+	std::uint32_t refinedTiles;	// coarse tiles traced at full rate
+	std::uint32_t skippedTiles;	// still valid in the TileCache, not traced
+	std::uint32_t occludedTiles;	// under an occluder of the TileCache, not traced
+};
+
+enum class PixelFormat : std::uint32_t
+{
+	RGBA32F,	// 4 floats per pixel
+	RGBA8		// 4 bytes per pixel, clamped to [0, 1], for encoders
+};
+
+template<PixelFormat F>
+using PixelFormatConstant = std::integral_constant<PixelFormat, F>;
+template<std::uint32_t N>
+using SampleCountConstant = std::integral_constant<std::uint32_t, N>;
+
+// Per pixel options of the tile kernel. Every member is either its plain type, checked per pixel,
+// or a std::integral_constant of it, which folds the check away in the instantiation:
+// RenderTiles(KernelOptions...) picks the fully constant instantiation once per frame.
+template<typename Projection, typename Filter, typename Format, typename Samples>
+struct TileKernelOptions
+{
+	Projection projection;
+	Filter filter;
+	Format format;
+	Samples samples;	// 1, or 4 for a 2x2 grid per pixel
+};
+
+using KernelOptions = TileKernelOptions<OutputProjection, SkyFilter, PixelFormat, std::uint32_t>;
+
+// what every tile of a frame depends on except its shading rate, the TileCache key of the view.
+// The phi table is named by its generation, which no later table reuses. The skymaps and dst are
+// named by their address and size only: callers that update texels in place pass the region to
+// TileCache::Invalidate, and a skymap replaced at the same address needs TileCache::InvalidateAll.
+template<typename Options>
+std::uint64_t TileViewKey(Options const &options, PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam,
+						  Foveation const &foveation, void const *dst)
+{
+	TileKeyHash hash;
+	hash.Add(cam.position).Add(cam.forward).Add(cam.up).Add(cam.right).Add(cam.fovX).Add(cam.fovY).Add(cam.width).Add(cam.height)
+		.Add(cam.fisheyeFov).Add(cam.jitterX).Add(cam.jitterY);
+	hash.Add(table.generation).Add(table.solver).Add(table.closedForm).Add(table.steps).Add(table.size).Add(table.wormhole.mass).Add(table.wormhole.radius).Add(table.wormhole.length).Add(table.l).Add(table.r);
+	hash.Add(sky1.data).Add(sky1.width).Add(sky1.height).Add(sky2.data).Add(sky2.width).Add(sky2.height);
+	OutputProjection projection(options.projection);
+	SkyFilter filter(options.filter);
+	PixelFormat format(options.format);
+	std::uint32_t samples(options.samples);
+	hash.Add(projection).Add(filter).Add(format).Add(samples).Add(foveation.refineAngle).Add(dst);
+	return hash.h;
+}
+
+// Hands the tiles of a frame to the workers of RenderTilesScheduled one at a time from a shared
+// counter. Workers are unpinned and all read the caller's skymaps. NumaTileScheduler.h is the
+// alternative for machines with several NUMA nodes.
+struct SharedTileQueue
+{
+	SkyView sky1, sky2;
+	unsigned threads; // 0 uses every hardware thread
+	std::atomic<std::uint32_t> next;
+	std::uint32_t tileCount;
+
+	SharedTileQueue(SkyView const &sky1, SkyView const &sky2, unsigned threads) :sky1(sky1), sky2(sky2), threads(threads), next(0), tileCount(0)
+	{
+		;
+	}
+
+	SkyView const &Sky1(unsigned) const
+	{
+		return sky1;
+	}
+
+	SkyView const &Sky2(unsigned) const
+	{
+		return sky2;
+	}
+
+	bool Next(unsigned, std::uint32_t &tile)
+	{
+		tile = next++;
+		return tile < tileCount;
+	}
+
+	// runs work(worker) on up to maxWorkers threads, the caller's thread being worker 0
+	template<typename Work>
+	void Run(std::uint32_t tiles, std::uint32_t maxWorkers, Work const &work)
+	{
+		next = 0;
+		tileCount = tiles;
+		unsigned workers(threads ? threads : std::max(1u, std::thread::hardware_concurrency()));
+		workers = std::min(workers, std::max(maxWorkers, 1u));
+		std::vector<std::thread> pool;
+		for (unsigned t(1); t < workers; ++t)
+			pool.emplace_back(work, t);
+		work(0);
+		for (auto &thread : pool)
+			thread.join();
+	}
+};
+
+// Renders cam.width x cam.height pixels of options.format into dst; the projection of the camera
+// is options.projection. The schedule hands out the tiles and the skymaps each worker reads
+// (copies of sky1 and sky2). With a cache, dst must hold the previous frame of the cache and only
+// the tiles it marks are traced.
+template<typename Options, typename Schedule>
+TileStats RenderTilesScheduled(Options const &options, PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam,
+							   Foveation const &foveation, void *dst, Schedule &schedule, TileCache *cache = nullptr)
+{
+	std::uint32_t tilesX((cam.width + g_TileSize - 1) / g_TileSize), tilesY((cam.height + g_TileSize - 1) / g_TileSize);
+	std::uint32_t tileCount(tilesX * tilesY);
+	std::atomic<std::uint64_t> rays(0);
+	std::atomic<std::uint32_t> tiles[3] = {}, refined(0);
+
+	// the lattice interpolation assumes a smooth pinhole image, the 360 projections have seams
+	auto tileRate([&](std::uint32_t tile) {
+		return options.projection == OutputProjection::Pinhole ? foveation.Rate(tile % tilesX * g_TileSize, tile / tilesX * g_TileSize, cam.width, cam.height) : 1u;
+	});
+	std::vector<std::uint8_t> stale;
+	if (cache)
+		cache->Begin(TileViewKey(options, table, sky1, sky2, cam, foveation, dst), cam.width, cam.height, tileRate, stale);
+
+	auto store([&](std::uint32_t x, std::uint32_t y, Color c) {
+		std::size_t index((static_cast<std::size_t>(y) * cam.width + x) * 4);
+		if (!cam.Covers(options.projection, x, y))
+			c = { 0.0f, 0.0f, 0.0f, 0.0f };
+		if (options.format == PixelFormat::RGBA8)
+		{
+			auto unorm([](float v) { return static_cast<std::uint8_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); });
+			std::uint8_t *p(static_cast<std::uint8_t *>(dst) + index);
+			p[0] = unorm(c.r);
+			p[1] = unorm(c.g);
+			p[2] = unorm(c.b);
+			p[3] = unorm(c.a);
+			return;
+		}
+		float *p(static_cast<float *>(dst) + index);
+		p[0] = c.r;
+		p[1] = c.g;
+		p[2] = c.b;
+		p[3] = c.a;
+	});
+	auto work([&](unsigned worker) {
+		SkyView const &workerSky1(schedule.Sky1(worker)), &workerSky2(schedule.Sky2(worker));
+		auto trace([&](float x, float y) {
+			return LensedSky(table, workerSky1, workerSky2, cam.position, cam.Ray(options.projection, x, y), options.filter);
+		});
+		// full rate pixel, the mean of the 2x2 grid with supersampling
+		auto shade([&](std::uint32_t x, std::uint32_t y, std::uint64_t &traced) {
+			if (options.samples == 1)
+			{
+				++traced;
+				return trace(static_cast<float>(x), static_cast<float>(y)).color;
+			}
+			Color sum{ 0.0f, 0.0f, 0.0f, 0.0f };
+			for (std::uint32_t s(0); s < 4; ++s)
+				sum = sum + trace(static_cast<float>(x) + (s & 1 ? 0.25f : -0.25f), static_cast<float>(y) + (s & 2 ? 0.25f : -0.25f)).color;
+			traced += 4;
+			return sum * 0.25f;
+		});
+
+		std::uint64_t traced(0);
+		LensedSample samples[g_TileSize + 1][g_TileSize + 1];
+		std::uint32_t sx[g_TileSize + 1], sy[g_TileSize + 1];
+		for (std::uint32_t tile; schedule.Next(worker, tile);)
+		{
+			if (cache && !stale[tile])
+				continue;
+			PROFILE_ZONE("CPU tile");
+			std::uint32_t x0(tile % tilesX * g_TileSize), y0(tile / tilesX * g_TileSize);
+			std::uint32_t x1(std::min(x0 + g_TileSize, cam.width)), y1(std::min(y0 + g_TileSize, cam.height));
+			std::uint32_t rate(tileRate(tile));
+			++tiles[rate == 1 ? 0 : (rate == 2 ? 1 : 2)];
+
+			if (rate > 1)
+			{
+				// lattice of the tile, the last row and column belong to the next tiles (or the image edge)
+				std::uint32_t n(g_TileSize / rate);
+				for (std::uint32_t i(0); i <= n; ++i)
+				{
+					sx[i] = std::min(x0 + i * rate, cam.width - 1);
+					sy[i] = std::min(y0 + i * rate, cam.height - 1);
+				}
+				bool straddles(false);
+				float tolerance(foveation.refineAngle * static_cast<float>(rate) * cam.fovX / static_cast<float>(cam.width));
+				for (std::uint32_t j(0); j <= n; ++j)
+					for (std::uint32_t i(0); i <= n; ++i)
+					{
+						samples[j][i] = trace(sx[i], sy[j]);
+						++traced;
+						auto const &t(samples[j][i].traced);
+						for (auto const *o : { i ? &samples[j][i - 1].traced : nullptr, j ? &samples[j - 1][i].traced : nullptr })
+							if (o && ((o->l < 0.0f) != (t.l < 0.0f) || std::abs(o->phi - t.phi) > tolerance))
+								straddles = true;
+					}
+
+				if (!straddles)
+				{
+					for (std::uint32_t y(y0); y < y1; ++y)
+					{
+						std::uint32_t j(std::min((y - y0) / rate, n - 1));
+						float ty(sy[j + 1] > sy[j] ? static_cast<float>(y - sy[j]) / static_cast<float>(sy[j + 1] - sy[j]) : 0.0f);
+						for (std::uint32_t x(x0); x < x1; ++x)
+						{
+							std::uint32_t i(std::min((x - x0) / rate, n - 1));
+							float tx(sx[i + 1] > sx[i] ? static_cast<float>(x - sx[i]) / static_cast<float>(sx[i + 1] - sx[i]) : 0.0f);
+							Color top(samples[j][i].color * (1.0f - tx) + samples[j][i + 1].color * tx);
+							Color bottom(samples[j + 1][i].color * (1.0f - tx) + samples[j + 1][i + 1].color * tx);
+							store(x, y, top * (1.0f - ty) + bottom * ty);
+						}
+					}
+					continue;
+				}
+				++refined;
+			}
+
+			// full rate, reusing the lattice samples that fall on pixels of the tile (without supersampling)
+			for (std::uint32_t y(y0); y < y1; ++y)
+				for (std::uint32_t x(x0); x < x1; ++x)
+				{
+					if (options.samples == 1 && rate > 1 && (x - x0) % rate == 0 && (y - y0) % rate == 0)
+						store(x, y, samples[(y - y0) / rate][(x - x0) / rate].color);
+					else
+						store(x, y, shade(x, y, traced));
+				}
+		}
+		rays += traced;
+	});
+
+	schedule.Run(tileCount, cache ? cache->traced : tileCount, work);
+
+	return { rays.load(), { tiles[0].load(), tiles[1].load(), tiles[2].load() }, refined.load(), cache ? cache->skipped : 0, cache ? cache->occluded : 0 };
+}
+
+// RenderTilesScheduled with a SharedTileQueue, threads = 0 uses every hardware thread
+template<typename Options>
+TileStats RenderTilesWith(Options const &options, PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam,
+						  Foveation const &foveation, void *dst, unsigned threads = 0, TileCache *cache = nullptr)
+{
+	SharedTileQueue queue(sky1, sky2, threads);
+	return RenderTilesScheduled(options, table, sky1, sky2, cam, foveation, dst, queue, cache);
+}
+
+// Picks the instantiation of RenderTilesWith with every option constant. Each option multiplies
+// the instantiations (4 projections x 2 filters x 2 formats x 2 sample counts here).
+template<typename Render, typename... Fixed>
+TileStats SpecializeTileKernel(KernelOptions const &options, Render &&render, Fixed... fixed)
+{
+	std::size_t constexpr n(sizeof...(Fixed));
+	if constexpr (n == 0)
+		switch (options.projection)
+		{
+		case OutputProjection::Equirectangular: return SpecializeTileKernel(options, render, OutputProjectionConstant<OutputProjection::Equirectangular>());
+		case OutputProjection::Cubemap: return SpecializeTileKernel(options, render, OutputProjectionConstant<OutputProjection::Cubemap>());
+		case OutputProjection::Fisheye: return SpecializeTileKernel(options, render, OutputProjectionConstant<OutputProjection::Fisheye>());
+		default: return SpecializeTileKernel(options, render, OutputProjectionConstant<OutputProjection::Pinhole>());
+		}
+	else if constexpr (n == 1)
+		return options.filter == SkyFilter::Nearest ? SpecializeTileKernel(options, render, fixed..., SkyFilterConstant<SkyFilter::Nearest>())
+			: SpecializeTileKernel(options, render, fixed..., SkyFilterConstant<SkyFilter::Bilinear>());
+	else if constexpr (n == 2)
+		return options.format == PixelFormat::RGBA8 ? SpecializeTileKernel(options, render, fixed..., PixelFormatConstant<PixelFormat::RGBA8>())
+			: SpecializeTileKernel(options, render, fixed..., PixelFormatConstant<PixelFormat::RGBA32F>());
+	else if constexpr (n == 3)
+		return options.samples > 1 ? SpecializeTileKernel(options, render, fixed..., SampleCountConstant<4>())
+			: SpecializeTileKernel(options, render, fixed..., SampleCountConstant<1>());
+	else
+		return render(TileKernelOptions<Fixed...>{ fixed... });
+}
+
+// specialized = false runs the generic kernel that checks the options per pixel, for comparison
+inline TileStats RenderTiles(KernelOptions const &options, PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam,
+							 Foveation const &foveation, void *dst, unsigned threads = 0, bool specialized = true, TileCache *cache = nullptr)
+{
+	if (!specialized)
+		return RenderTilesWith(options, table, sky1, sky2, cam, foveation, dst, threads, cache);
+	return SpecializeTileKernel(options, [&](auto const &constant) {
+		return RenderTilesWith(constant, table, sky1, sky2, cam, foveation, dst, threads, cache);
+	});
+}
+
+// RGBA float pixels with the projection of the camera
+inline TileStats RenderTiles(PhiTable const &table, SkyView const &sky1, SkyView const &sky2, RayCamera const &cam,
+							 Foveation const &foveation, float *dst, unsigned threads = 0, TileCache *cache = nullptr)
+{
+	return RenderTiles(KernelOptions{ cam.projection, SkyFilter::Bilinear, PixelFormat::RGBA32F, 1 }, table, sky1, sky2, cam, foveation, dst, threads, true, cache);
+}
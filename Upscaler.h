@@ -0,0 +1,198 @@
+#pragma once
+
+// Deflection guided upscaling of a low resolution render (upscale.hlsl). Bilinear stretching in
+// the screen quad smears the Einstein ring and the throat boundary, the only sharp features of
+// the image; the phi table tells for every full resolution pixel where its ray lands, so samples
+// from across those edges are rejected and the few pixels on the edges are traced exactly.
+// Everywhere else a full resolution pixel costs a table lookup per sample instead of a trace.
+
+#include "common.h"
+#include "Camera.h"
+#include "DescriptorHeap.h"
+#include "GpuTimer.h"
+#include "RGBAImage.h"
+#include "WormholeRender.h"
+
+struct Upscaler
+{
+	ComPtr<ID3D12PipelineState> pipelineState;
+	ComPtr<ID3D12RootSignature> rootSignature;
+	RGBAImageGPU output; // full resolution
+
+	float sigma;		// deflection difference tolerated, in low resolution pixels
+	float minWeight;	// sample weight below which a pixel is traced
+
+	Upscaler() :sigma(2.0f), minWeight(0.25f)
+	{
+		;
+	}
+
+	Upscaler(Upscaler const &a) = delete;
+	Upscaler &operator=(Upscaler const &a) = delete;
+
+	Upscaler(Upscaler &&a) noexcept
+	{
+		*this = std::move(a);
+	}
+
+	Upscaler &operator=(Upscaler &&a) noexcept
+	{
+		if (this != std::addressof(a))
+		{
+			pipelineState = std::move(a.pipelineState);
+			rootSignature = std::move(a.rootSignature);
+			output = std::move(a.output);
+			sigma = a.sigma;
+			minWeight = a.minWeight;
+		}
+		return *this;
+	}
+
+	// SRV of the output at heapOffset, UAV at heapOffset + 1
+	Upscaler(ComPtr<ID3D12Device2> device, DescriptorHeapWrapper &heap, std::size_t heapOffset, std::uint32_t width, std::uint32_t height) :
+		output(device, width, height, heap.at_cpu(heapOffset), heap.at_cpu(heapOffset + 1)), sigma(2.0f), minWeight(0.25f)
+	{
+		ComPtr<ID3DBlob> computeShaderBlob;
+		ThrowIfFailed(D3DReadFileToBlob(L"upscale.cso", &computeShaderBlob));
+
+		D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+		featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+		if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+			featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+
+		D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
+			D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
+
+		// the wormhole.hlsl layout with the wormhole constants replaced and the low resolution image added
+		CD3DX12_ROOT_PARAMETER1 rootParameters[7] = {};
+
+		rootParameters[0].InitAsConstants(20, 0); // camera
+		rootParameters[1].InitAsConstants(4, 1);  // upscale
+		rootParameters[2].InitAsConstants(4, 2);  // cache size
+		auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0);
+		rootParameters[3].InitAsDescriptorTable(1, std::addressof(r1));
+		auto r2 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+		rootParameters[4].InitAsDescriptorTable(1, std::addressof(r2));
+		auto r3 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2);
+		rootParameters[5].InitAsDescriptorTable(1, std::addressof(r3));
+		auto r4 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);
+		rootParameters[6].InitAsDescriptorTable(1, std::addressof(r4));
+
+		// for the skymaps of the pixels traced exactly, same as WormholeRender
+		D3D12_STATIC_SAMPLER_DESC sampler = {};
+		sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+		sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+		sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+		sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_BORDER;
+		sampler.MipLODBias = 0;
+		sampler.MaxAnisotropy = 0;
+		sampler.ComparisonFunc = D3D12_COMPARISON_FUNC_NEVER;
+		sampler.BorderColor = D3D12_STATIC_BORDER_COLOR_TRANSPARENT_BLACK;
+		sampler.MinLOD = 0.0f;
+		sampler.MaxLOD = D3D12_FLOAT32_MAX;
+		sampler.ShaderRegister = 0;
+		sampler.RegisterSpace = 0;
+		sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+		CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescription{};
+		rootSignatureDescription.Init_1_1(_countof(rootParameters), rootParameters, 1, std::addressof(sampler), rootSignatureFlags);
+
+		ComPtr<ID3DBlob> rootSignatureBlob;
+		ComPtr<ID3DBlob> errorBlob;
+		auto hr = D3DX12SerializeVersionedRootSignature(&rootSignatureDescription,
+			featureData.HighestVersion, &rootSignatureBlob, &errorBlob);
+		if (FAILED(hr))
+		{
+			std::string errorString;
+
+			if (errorBlob)
+			{
+				errorString.append(": ");
+
+				errorString.append(
+					reinterpret_cast<char *>(
+					errorBlob->GetBufferPointer()),
+					errorBlob->GetBufferSize());
+				MessageBoxA(NULL, errorString.c_str(), "Upscaler", MB_OK | MB_ICONERROR);
+			}
+			__debugbreak();
+		}
+		ThrowIfFailed(device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(),
+			rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&rootSignature)));
+
+		D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+		psoDesc.pRootSignature = rootSignature.Get();
+		psoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShaderBlob.Get());
+
+		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineState)));
+	}
+
+	// cam is the camera of the low resolution render (its width and height are the part of the
+	// low resolution texture holding the image), the phi table must be the one it was rendered with.
+	// The low resolution texture must be a compute SRV and output a UAV.
+	void Render(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		WormholeRender const &wormholeRender,
+		Camera &cam,
+		DescriptorHeapWrapper &textureHeap,
+		std::size_t srcTextureSRVHeapOffset, // 2 SRVs for two skymaps
+		std::size_t lowTextureSRVHeapOffset,
+		std::size_t phiCacheSRVHeapOffset,
+		std::size_t outputUAVHeapOffset,
+		TimestampBackend *timestamps = nullptr
+	)
+	{
+		PROFILE_ZONE("Upscale");
+		ScopedTimestamp timestamp(timestamps, RenderPass::Upscale);
+		commandList->SetPipelineState(pipelineState.Get());
+		commandList->SetComputeRootSignature(rootSignature.Get());
+
+		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
+		commandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+
+		struct
+		{
+			XMVECTOR position;
+			XMVECTOR forward;
+			XMVECTOR up;
+			XMVECTOR right;
+			float fovX;
+			float fovY;
+			float width;
+			float height;
+		} cam_data{ cam.GetPositionXM(),cam.GetLookDirXM(),cam.GetUpXM(),cam.GetRightXM(),cam.GetFovX(),cam.GetFovY(),static_cast<float>(output.width),static_cast<float>(output.height) };
+
+		struct
+		{
+			float lowWidth;
+			float lowHeight;
+			float sigma;
+			float minWeight;
+		} upscale{ static_cast<float>(cam.GetWidth()), static_cast<float>(cam.GetHeight()), sigma, minWeight };
+
+		struct
+		{
+			std::uint32_t size;
+			std::uint32_t pad1, pad2, pad3;
+		} cache_size{ wormholeRender.phiTableFilledSize, 0, 0, 0 };
+
+		static_assert(sizeof(cam_data) == 20 * 4);
+
+		commandList->SetComputeRoot32BitConstants(0, 20, &cam_data, 0);
+		commandList->SetComputeRoot32BitConstants(1, 4, &upscale, 0);
+		commandList->SetComputeRoot32BitConstants(2, 4, &cache_size, 0);
+		commandList->SetComputeRootDescriptorTable(3, textureHeap.at_gpu(srcTextureSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(4, textureHeap.at_gpu(outputUAVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(5, textureHeap.at_gpu(phiCacheSRVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(6, textureHeap.at_gpu(lowTextureSRVHeapOffset));
+
+		UINT groupX(((output.width - 1) / 32) + 1);
+		UINT groupY(((output.height - 1) / 32) + 1);
+
+		commandList->Dispatch(groupX, groupY, 1);
+	}
+};
@@ -1,7 +1,5 @@
 #pragma once
 
-#include "common.h"
-
 struct Wormhole
 {
 	float mass;
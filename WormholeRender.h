@@ -4,20 +4,40 @@
 #include "Wormhole.h"
 #include "Camera.h"
 #include "DescriptorHeap.h"
-
-std::uint32_t constexpr g_PhiCacheSize = 16384;
+#include "GpuTimer.h"
+#include "PhiTable.h"
+#include "PhiTableCache.h"
+#include "Foveation.h"
 
 struct WormholeRender
 {
 	ComPtr<ID3D12PipelineState> pipelineState;
+	ComPtr<ID3D12PipelineState> pipelineStateFoveated; // wormhole_foveated.hlsl, same root signature
 	ComPtr<ID3D12RootSignature> rootSignature;
 	ComPtr<ID3D12PipelineState> pipelineStatePhiCache;
 	ComPtr<ID3D12RootSignature> rootSignaturePhiCache;
 	ComPtr<ID3D12Resource> phiCache;
 
 	float last_l;
-
-	WormholeRender() :pipelineState(nullptr), rootSignature(nullptr), pipelineStatePhiCache(nullptr), rootSignaturePhiCache(nullptr), phiCache(nullptr), last_l(0.0f)
+	std::uint32_t phiTableSize; // logical entries used, even and at most g_PhiCacheSize the buffer is sized for
+	std::uint32_t phiTableFilledSize; // phiTableSize when the table was last filled, what its contents hold
+	Foveation foveation; // per tile shading rate of Render when enabled
+	float jitterX, jitterY; // sub-pixel offset of the samples of the direct pass, TemporalAccumulator.h
+
+	// With a PhiTableCache, FillPhiCache uploads a cached table instead of tracing it and reads the
+	// tables it traces back into the cache. One upload and one readback buffer per frame in flight.
+	struct PhiTableTransfer
+	{
+		ComPtr<ID3D12Resource> upload, readback;
+		bool uploaded;						// upload holds a table for the frame being recorded
+		std::shared_ptr<PhiTable> pending;	// parameters of the table copied to readback
+	};
+	PhiTableCache *tableCache;
+	std::vector<PhiTableTransfer> transfers;
+	std::uint32_t transferSlot;
+
+	WormholeRender() :pipelineState(nullptr), rootSignature(nullptr), pipelineStatePhiCache(nullptr), rootSignaturePhiCache(nullptr), phiCache(nullptr), last_l(0.0f), phiTableSize(g_PhiCacheSize), phiTableFilledSize(g_PhiCacheSize),
+		jitterX(0.0f), jitterY(0.0f), tableCache(nullptr), transferSlot(0)
 	{
 		;
 	}
@@ -28,10 +48,19 @@ struct WormholeRender
 	WormholeRender(WormholeRender &&a) noexcept
 	{
 		pipelineState = std::move(a.pipelineState);
+		pipelineStateFoveated = std::move(a.pipelineStateFoveated);
 		rootSignature = std::move(a.rootSignature);
 		pipelineStatePhiCache = std::move(a.pipelineStatePhiCache);
 		rootSignaturePhiCache = std::move(a.rootSignaturePhiCache);
 		phiCache = std::move(a.phiCache);
+		phiTableSize = a.phiTableSize;
+		phiTableFilledSize = a.phiTableFilledSize;
+		foveation = a.foveation;
+		jitterX = a.jitterX;
+		jitterY = a.jitterY;
+		tableCache = a.tableCache;
+		transfers = std::move(a.transfers);
+		transferSlot = a.transferSlot;
 	}
 
 	WormholeRender &operator=(WormholeRender &&a) noexcept
@@ -39,10 +68,19 @@ struct WormholeRender
 		if (this != std::addressof(a))
 		{
 			pipelineState = std::move(a.pipelineState);
+			pipelineStateFoveated = std::move(a.pipelineStateFoveated);
 			rootSignature = std::move(a.rootSignature);
 			pipelineStatePhiCache = std::move(a.pipelineStatePhiCache);
 			rootSignaturePhiCache = std::move(a.rootSignaturePhiCache);
 			phiCache = std::move(a.phiCache);
+			phiTableSize = a.phiTableSize;
+			phiTableFilledSize = a.phiTableFilledSize;
+			foveation = a.foveation;
+			jitterX = a.jitterX;
+			jitterY = a.jitterY;
+			tableCache = a.tableCache;
+			transfers = std::move(a.transfers);
+			transferSlot = a.transferSlot;
 		}
 		return *this;
 	}
@@ -53,7 +91,7 @@ struct WormholeRender
 
 		phiCacheDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		phiCacheDesc.Alignment = 0; // may be 0, 4KB, 64KB, or 4MB. 0 will let runtime decide between 64KB and 4MB (4MB for multi-sampled textures)
-		phiCacheDesc.Width = g_PhiCacheSize * sizeof(float) * 2;
+		phiCacheDesc.Width = PhiTableStoredEntries(g_PhiCacheSize) * sizeof(float) * 2;
 		phiCacheDesc.Height = 1;
 		phiCacheDesc.DepthOrArraySize = 1;
 		phiCacheDesc.MipLevels = 1;
@@ -74,7 +112,7 @@ struct WormholeRender
 
 		D3D12_BUFFER_SRV bufferSRVDesc = {};
 		bufferSRVDesc.FirstElement = 0;
-		bufferSRVDesc.NumElements = g_PhiCacheSize;
+		bufferSRVDesc.NumElements = PhiTableStoredEntries(g_PhiCacheSize);
 		bufferSRVDesc.StructureByteStride = sizeof(float) * 2;
 		bufferSRVDesc.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
 
@@ -87,7 +125,7 @@ struct WormholeRender
 
 		D3D12_BUFFER_UAV bufferUAVDesc = {};
 		bufferUAVDesc.FirstElement = 0;
-		bufferUAVDesc.NumElements = g_PhiCacheSize;
+		bufferUAVDesc.NumElements = PhiTableStoredEntries(g_PhiCacheSize);
 		bufferUAVDesc.StructureByteStride = sizeof(float) * 2;
 		bufferUAVDesc.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
@@ -162,7 +200,8 @@ struct WormholeRender
 		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStatePhiCache)));
 	}
 
-	WormholeRender(ComPtr<ID3D12Device2> device, ComPtr<ID3D12GraphicsCommandList> commandList, DescriptorHeapWrapper& heap, std::size_t heapOffset)
+	WormholeRender(ComPtr<ID3D12Device2> device, ComPtr<ID3D12GraphicsCommandList> commandList, DescriptorHeapWrapper& heap, std::size_t heapOffset) :last_l(0.0f), phiTableSize(g_PhiCacheSize), phiTableFilledSize(g_PhiCacheSize),
+		jitterX(0.0f), jitterY(0.0f), tableCache(nullptr), transferSlot(0)
 	{
 		ComPtr<ID3DBlob> computeShaderBlob;
 		ThrowIfFailed(D3DReadFileToBlob(L"wormhole.cso", &computeShaderBlob));
@@ -185,9 +224,9 @@ struct WormholeRender
 			D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
 			D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
 
-		CD3DX12_ROOT_PARAMETER1 rootParameters[6] = {};
+		CD3DX12_ROOT_PARAMETER1 rootParameters[7] = {};
 
-		rootParameters[0].InitAsConstants(20, 0); // camera
+		rootParameters[0].InitAsConstants(24, 0); // camera
 		rootParameters[1].InitAsConstants(4, 1);  // wormhole
 		rootParameters[2].InitAsConstants(4, 2);  // cache size
 		auto r1 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0);
@@ -196,6 +235,7 @@ struct WormholeRender
 		rootParameters[4].InitAsDescriptorTable(1, std::addressof(r2));
 		auto r3 = CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2);
 		rootParameters[5].InitAsDescriptorTable(1, std::addressof(r3));
+		rootParameters[6].InitAsConstants(8, 3);  // foveation, wormhole_foveated.hlsl only
 
 		// create a static sampler
 		D3D12_STATIC_SAMPLER_DESC sampler = {};
@@ -248,6 +288,11 @@ struct WormholeRender
 
 		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineState)));
 
+		ComPtr<ID3DBlob> foveatedShaderBlob;
+		ThrowIfFailed(D3DReadFileToBlob(L"wormhole_foveated.cso", &foveatedShaderBlob));
+		psoDesc.CS = CD3DX12_SHADER_BYTECODE(foveatedShaderBlob.Get());
+		ThrowIfFailed(device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&pipelineStateFoveated)));
+
 		BuildPhiCacheResources(device, heap, heapOffset);
 	}
 
@@ -255,8 +300,13 @@ struct WormholeRender
 					  Camera& cam,
 					  Wormhole& wormhole,
 					  DescriptorHeapWrapper& heap,
-					  std::size_t emptyPhiCacheUAVHeapOffset)
+					  std::size_t emptyPhiCacheUAVHeapOffset,
+					  TimestampBackend *timestamps = nullptr)
 	{
+		PROFILE_ZONE("Phi table build");
+		ScopedTimestamp timestamp(timestamps, RenderPass::PhiCache);
+		if (UploadCachedPhiTable(commandList, wormhole, cam.GetL(), cam.GetR()))
+			return;
 		commandList->SetPipelineState(pipelineStatePhiCache.Get());
 		commandList->SetComputeRootSignature(rootSignaturePhiCache.Get());
 
@@ -271,17 +321,111 @@ struct WormholeRender
 			float l;
 			float r;
 			UINT pad;
-		} cb{ g_PhiCacheSize, cam.GetL(), cam.GetR(), 0 };
+		} cb{ static_cast<int>(phiTableSize), cam.GetL(), cam.GetR(), 0 };
 
 		commandList->SetComputeRoot32BitConstants(0, 4, &cb, 0);
 		commandList->SetComputeRoot32BitConstants(1, 4, &wormhole, 0);
 		commandList->SetComputeRootDescriptorTable(2, heap.at_gpu(emptyPhiCacheUAVHeapOffset + 1));
 
-		UINT groupX(((g_PhiCacheSize - 1) / 1024) + 1);
+		UINT groupX(((PhiTableStoredEntries(phiTableSize) - 1) / 1024) + 1);
 
 		commandList->Dispatch(groupX, 1, 1);
+		phiTableFilledSize = phiTableSize;
 
 		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiCache.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+		DownloadPhiTable(commandList, wormhole, cam.GetL(), cam.GetR());
+	}
+
+	// frameSlots: frames in flight, BeginPhiTableFrame takes the slot of each frame
+	void EnablePhiTableCache(ComPtr<ID3D12Device2> device, PhiTableCache *cache, std::uint32_t frameSlots)
+	{
+		static_assert(sizeof(geodesic::Traced<float>) == sizeof(float) * 2, "phi cache entries are float2");
+		UINT64 bytes(PhiTableStoredEntries(g_PhiCacheSize) * sizeof(float) * 2);
+		tableCache = cache;
+		transfers.clear();
+		transfers.resize(frameSlots);
+		for (auto &t : transfers)
+		{
+			THROW(device->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+				D3D12_HEAP_FLAG_NONE,
+				&CD3DX12_RESOURCE_DESC::Buffer(bytes),
+				D3D12_RESOURCE_STATE_GENERIC_READ,
+				nullptr,
+				IID_PPV_ARGS(&t.upload)));
+			THROW(device->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+				D3D12_HEAP_FLAG_NONE,
+				&CD3DX12_RESOURCE_DESC::Buffer(bytes),
+				D3D12_RESOURCE_STATE_COPY_DEST,
+				nullptr,
+				IID_PPV_ARGS(&t.readback)));
+			t.uploaded = false;
+		}
+		transferSlot = 0;
+	}
+
+	// Call once the fence of the frame that last used the slot has been waited on: the table it
+	// traced is read back into the cache and its upload buffer is free again.
+	void BeginPhiTableFrame(std::uint32_t slot)
+	{
+		if (transfers.empty())
+			return;
+		transferSlot = slot % static_cast<std::uint32_t>(transfers.size());
+		auto &t(transfers[transferSlot]);
+		t.uploaded = false;
+		if (!t.pending)
+			return;
+		t.pending->entries.resize(PhiTableStoredEntries(t.pending->size));
+		D3D12_RANGE readRange{ 0, t.pending->entries.size() * sizeof(float) * 2 };
+		void *mapped(nullptr);
+		THROW(t.readback->Map(0, &readRange, &mapped));
+		std::memcpy(t.pending->entries.data(), mapped, readRange.End);
+		D3D12_RANGE writeRange{ 0, 0 };
+		t.readback->Unmap(0, &writeRange);
+		tableCache->Insert(std::move(t.pending));
+	}
+
+	// copies the cached table for these parameters into phiCache, false on a miss or when this
+	// frame's upload buffer is taken already
+	bool UploadCachedPhiTable(ComPtr<ID3D12GraphicsCommandList> commandList, Wormhole const &wormhole, float l, float r)
+	{
+		if (!tableCache || transfers.empty() || transfers[transferSlot].uploaded)
+			return false;
+		auto table(tableCache->Find(wormhole, l, r, phiTableSize));
+		if (!table)
+			return false;
+		auto &t(transfers[transferSlot]);
+		UINT64 bytes(table->entries.size() * sizeof(float) * 2);
+		D3D12_RANGE readRange{ 0, 0 };
+		void *mapped(nullptr);
+		THROW(t.upload->Map(0, &readRange, &mapped));
+		std::memcpy(mapped, table->entries.data(), bytes);
+		t.upload->Unmap(0, nullptr);
+		t.uploaded = true;
+
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiCache.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST));
+		commandList->CopyBufferRegion(phiCache.Get(), 0, t.upload.Get(), 0, bytes);
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiCache.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+		phiTableFilledSize = phiTableSize;
+		return true;
+	}
+
+	// records a copy of the table just traced, read into the cache by the slot's next BeginPhiTableFrame
+	void DownloadPhiTable(ComPtr<ID3D12GraphicsCommandList> commandList, Wormhole const &wormhole, float l, float r)
+	{
+		if (!tableCache || transfers.empty())
+			return;
+		auto &t(transfers[transferSlot]);
+		t.pending = std::make_shared<PhiTable>();
+		t.pending->size = phiTableSize;
+		t.pending->wormhole = wormhole;
+		t.pending->l = l;
+		t.pending->r = r;
+
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiCache.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		commandList->CopyBufferRegion(t.readback.Get(), 0, phiCache.Get(), 0, PhiTableStoredEntries(phiTableSize) * sizeof(float) * 2);
+		commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(phiCache.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
 	}
 
 	void Render(
@@ -291,7 +435,8 @@ struct WormholeRender
 		DescriptorHeapWrapper& textureHeap,
 		std::size_t srcTextureSRVHeapOffset, // 2 SRVs for two skymaps
 		std::size_t dstTextureUAVHeapOffset,
-		std::size_t emptyPhiCacheUAVHeapOffset
+		std::size_t emptyPhiCacheUAVHeapOffset,
+		TimestampBackend *timestamps = nullptr
 	)
 	{
 		//if (std::abs(last_l - cam.GetL()) > 1e-8f) // recalculate phi mapping only if l changed
@@ -299,9 +444,27 @@ struct WormholeRender
 		//	FillPhiCache(commandList, cam, wormhole, textureHeap, emptyPhiCacheUAVHeapOffset); // fill phi cache
 		//	last_l = cam.GetL();
 		//}
-		FillPhiCache(commandList, cam, wormhole, textureHeap, emptyPhiCacheUAVHeapOffset); // fill phi cache
+		FillPhiCache(commandList, cam, wormhole, textureHeap, emptyPhiCacheUAVHeapOffset, timestamps); // fill phi cache
+		Dispatch(commandList, cam, wormhole, textureHeap, srcTextureSRVHeapOffset, dstTextureUAVHeapOffset, emptyPhiCacheUAVHeapOffset, timestamps);
+	}
 
-		commandList->SetPipelineState(pipelineState.Get());
+	// the per pixel pass alone, with the phi table of the last FillPhiCache
+	void Dispatch(
+		ComPtr<ID3D12GraphicsCommandList> commandList,
+		Camera& cam,
+		Wormhole& wormhole,
+		DescriptorHeapWrapper& textureHeap,
+		std::size_t srcTextureSRVHeapOffset, // 2 SRVs for two skymaps
+		std::size_t dstTextureUAVHeapOffset,
+		std::size_t phiCacheSRVHeapOffset,
+		TimestampBackend *timestamps = nullptr
+	)
+	{
+		PROFILE_ZONE("Wormhole dispatch");
+		ScopedTimestamp timestamp(timestamps, RenderPass::Wormhole);
+		// the foveated lattice only handles the pinhole
+		bool foveated(foveation.enabled && cam.GetOutputProjection() == OutputProjection::Pinhole);
+		commandList->SetPipelineState(foveated ? pipelineStateFoveated.Get() : pipelineState.Get());
 		commandList->SetComputeRootSignature(rootSignature.Get());
 
 		ID3D12DescriptorHeap *descriptorHeaps[] = { textureHeap.heap.Get() };
@@ -317,23 +480,42 @@ struct WormholeRender
 			float fovY;
 			float width;
 			float height;
-		} cam_data{ cam.GetPositionXM(),cam.GetLookDirXM(),cam.GetUpXM(),cam.GetRightXM(),cam.GetFovX(),cam.GetFovY(),static_cast<float>(cam.GetWidth()),static_cast<float>(cam.GetHeight()) };
+			OutputProjection projection;
+			float fisheyeFov;
+			float jitterX, jitterY;
+		} cam_data{ cam.GetPositionXM(),cam.GetLookDirXM(),cam.GetUpXM(),cam.GetRightXM(),cam.GetFovX(),cam.GetFovY(),static_cast<float>(cam.GetWidth()),static_cast<float>(cam.GetHeight()),
+			cam.GetOutputProjection(),cam.GetFisheyeFov(),jitterX,jitterY };
 		//cam_data.position.m128_f32[3] = 0.00005f;// cam.GetL();
 
 		struct
 		{
 			std::uint32_t size;
 			std::uint32_t pad1, pad2, pad3;
-		} cache_size{ g_PhiCacheSize, 0, 0, 0 };
+		} cache_size{ phiTableSize, 0, 0, 0 };
 
-		static_assert(sizeof(cam_data) == 20 * 4);
+		static_assert(sizeof(cam_data) == 24 * 4);
 
-		commandList->SetComputeRoot32BitConstants(0, 20, &cam_data, 0);
+		commandList->SetComputeRoot32BitConstants(0, 24, &cam_data, 0);
 		commandList->SetComputeRoot32BitConstants(1, 4, &wormhole, 0);
 		commandList->SetComputeRoot32BitConstants(2, 4, &cache_size, 0);
 		commandList->SetComputeRootDescriptorTable(3, textureHeap.at_gpu(srcTextureSRVHeapOffset));
 		commandList->SetComputeRootDescriptorTable(4, textureHeap.at_gpu(dstTextureUAVHeapOffset));
-		commandList->SetComputeRootDescriptorTable(5, textureHeap.at_gpu(emptyPhiCacheUAVHeapOffset));
+		commandList->SetComputeRootDescriptorTable(5, textureHeap.at_gpu(phiCacheSRVHeapOffset));
+
+		if (foveated)
+		{
+			// a group per 8x8 tile
+			struct
+			{
+				float centerX, centerY;
+				float innerRadius, outerRadius;
+				float refineAngle;
+				float pad1, pad2, pad3;
+			} foveation_data{ foveation.centerX, foveation.centerY, foveation.innerRadius, foveation.outerRadius, foveation.refineAngle, 0, 0, 0 };
+			commandList->SetComputeRoot32BitConstants(6, 8, &foveation_data, 0);
+			commandList->Dispatch((cam.GetWidth() - 1) / g_TileSize + 1, (cam.GetHeight() - 1) / g_TileSize + 1, 1);
+			return;
+		}
 
 		UINT groupX(((cam.GetWidth() - 1) / 32) + 1);
 		UINT groupY(((cam.GetHeight() - 1) / 32) + 1);
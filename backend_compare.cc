@@ -0,0 +1,229 @@
+// Renders one frame of the wormhole with the render backends and compares them: the same
+// checkerboard skymaps, wormhole and camera go through RenderBackend on the CPU and, on Windows,
+// on D3D12, and the images are diffed channel by channel. Fails when they differ by more than the
+// tolerance, so a change to either path that breaks parity shows up without a GPU capture.
+//
+// backend-compare [--backend cpu|d3d12|both] [--warp] [--width n] [--height n]
+//                 [--projection pinhole|equirect|cubemap|fisheye] [--table-size n] [--tolerance t]
+//                 [--output file.pfm] [--shared-table]
+//
+// --table-size sets the phi table entries (even, at most g_PhiCacheSize), smaller tables keep CPU
+// runs short. --tolerance is the largest fraction of pixels allowed to differ. --output writes
+// the image of the first backend as a PFM. --warp runs D3D12 on the software
+// rasterizer. --shared-table gives the backends one PhiTableCache, so the later backends upload
+// the first one's phi table instead of building their own and only the per pixel passes are
+// compared. Off Windows only the CPU backend exists.
+
+#include "CpuBackend.h"
+#include "ImageDiff.h"
+#if defined(_WIN32)
+#include "D3D12Backend.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	// differences below this are rounding between the HLSL and C++ arithmetic
+	float constexpr g_PixelThreshold = 1e-2f;
+
+	struct Frame
+	{
+		std::uint32_t skyWidth, skyHeight;
+		std::vector<float> sky1, sky2;
+		Wormhole wormhole;
+		float l, r;
+		std::uint32_t tableSize;
+		RayCamera cam;
+	};
+
+	Frame MakeFrame(std::uint32_t width, std::uint32_t height, OutputProjection projection, std::uint32_t tableSize)
+	{
+		Frame frame;
+		// checkerboard skymaps with a gradient, so both the lookup and the filter show in the diff
+		frame.skyWidth = 1024;
+		frame.skyHeight = 512;
+		frame.sky1.resize(frame.skyWidth * frame.skyHeight * 4);
+		frame.sky2.resize(frame.skyWidth * frame.skyHeight * 4);
+		for (std::uint32_t y(0); y < frame.skyHeight; ++y)
+			for (std::uint32_t x(0); x < frame.skyWidth; ++x)
+			{
+				std::size_t i((static_cast<std::size_t>(y) * frame.skyWidth + x) * 4);
+				float v(((x / 32 + y / 32) & 1) ? 0.9f : 0.1f), g(static_cast<float>(x) / frame.skyWidth);
+				frame.sky1[i + 0] = v;
+				frame.sky1[i + 1] = g;
+				frame.sky1[i + 2] = 0.5f;
+				frame.sky1[i + 3] = 1.0f;
+				frame.sky2[i + 0] = 0.5f;
+				frame.sky2[i + 1] = 1.0f - g;
+				frame.sky2[i + 2] = 1.0f - v;
+				frame.sky2[i + 3] = 1.0f;
+			}
+		frame.wormhole = Wormhole();
+		frame.l = 4.0f;
+		frame.r = frame.wormhole.radius + frame.l;
+		frame.tableSize = tableSize;
+		frame.cam = RayCamera{ { frame.r, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, 1.13f, 0.64f, width, height, projection };
+		return frame;
+	}
+
+	struct Result
+	{
+		std::vector<float> pixels;
+		double seconds;
+	};
+
+	Result RenderFrame(RenderBackend &backend, Frame const &frame)
+	{
+		BackendImage sky1(backend.CreateImage(frame.skyWidth, frame.skyHeight));
+		BackendImage sky2(backend.CreateImage(frame.skyWidth, frame.skyHeight));
+		BackendImage target(backend.CreateImage(frame.cam.width, frame.cam.height));
+		backend.Upload(sky1, frame.sky1.data());
+		backend.Upload(sky2, frame.sky2.data());
+
+		Result result{ std::vector<float>(static_cast<std::size_t>(frame.cam.width) * frame.cam.height * 4), 0.0 };
+		auto begin(Clock::now());
+		backend.BeginFrame();
+		backend.BuildPhiTable(frame.wormhole, frame.l, frame.r, frame.tableSize);
+		backend.RenderPixels(sky1, sky2, target, frame.cam, Foveation());
+		backend.EndFrame();
+		backend.Readback(target, result.pixels.data());
+		result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+		PassTimes times{};
+		backend.Timestamps().Collect(times);
+		std::printf("%-6s %8.1fms total", backend.Name(), result.seconds * 1000.0);
+		for (std::size_t i(0); i < g_RenderPassCount; ++i)
+			if (times[i] > 0.0f)
+				std::printf(", %s %.2fms", RenderPassName(static_cast<RenderPass>(i)), times[i]);
+		std::printf("\n");
+		return result;
+	}
+
+	bool WritePFM(std::string const &filename, float const *rgba, std::uint32_t width, std::uint32_t height)
+	{
+		std::FILE *file(std::fopen(filename.c_str(), "wb"));
+		if (!file)
+			return false;
+		// little endian RGB, rows from the bottom up
+		std::fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+		std::vector<float> row(static_cast<std::size_t>(width) * 3);
+		for (std::uint32_t y(height); y-- > 0;)
+		{
+			for (std::uint32_t x(0); x < width; ++x)
+				for (std::uint32_t c(0); c < 3; ++c)
+					row[x * 3 + c] = rgba[(static_cast<std::size_t>(y) * width + x) * 4 + c];
+			std::fwrite(row.data(), sizeof(float), row.size(), file);
+		}
+		return std::fclose(file) == 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string backendName("both"), output;
+	std::uint32_t width(640), height(360), tableSize(g_PhiCacheSize);
+	OutputProjection projection(OutputProjection::Pinhole);
+	float tolerance(1e-3f);
+	bool warp(false), sharedTable(false);
+	for (int i(1); i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--backend") && i + 1 < argc)
+			backendName = argv[++i];
+		else if (!std::strcmp(argv[i], "--warp"))
+			warp = true;
+		else if (!std::strcmp(argv[i], "--width") && i + 1 < argc)
+			width = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--height") && i + 1 < argc)
+			height = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--projection") && i + 1 < argc)
+		{
+			std::string name(argv[++i]);
+			for (std::uint32_t p(0); p < static_cast<std::uint32_t>(OutputProjection::Count); ++p)
+				if (name == OutputProjectionName(static_cast<OutputProjection>(p)))
+					projection = static_cast<OutputProjection>(p);
+		}
+		else if (!std::strcmp(argv[i], "--table-size") && i + 1 < argc)
+			tableSize = std::min(static_cast<std::uint32_t>(std::stoul(argv[++i])) & ~1u, g_PhiCacheSize);
+		else if (!std::strcmp(argv[i], "--tolerance") && i + 1 < argc)
+			tolerance = std::stof(argv[++i]);
+		else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+			output = argv[++i];
+		else if (!std::strcmp(argv[i], "--shared-table"))
+			sharedTable = true;
+		else
+		{
+			std::printf("usage: %s [--backend cpu|d3d12|both] [--warp] [--width n] [--height n] [--projection pinhole|equirect|cubemap|fisheye] [--table-size n] [--tolerance t] [--output file.pfm] [--shared-table]\n", argv[0]);
+			return 1;
+		}
+	}
+	OutputProjectionResolution(projection, width, height, width, height);
+
+	std::unique_ptr<PhiTableCache> tableCache(sharedTable ? std::make_unique<PhiTableCache>() : nullptr);
+	std::vector<std::unique_ptr<RenderBackend>> backends;
+	try
+	{
+		if (backendName == "cpu" || backendName == "both")
+			backends.push_back(std::make_unique<CpuBackend>(0, false, tableCache.get()));
+#if defined(_WIN32)
+		if (backendName == "d3d12" || backendName == "both")
+			backends.push_back(std::make_unique<D3D12Backend>(warp, tableCache.get()));
+#else
+		(void)warp;
+		if (backendName == "d3d12")
+		{
+			std::printf("the D3D12 backend is only available on Windows\n");
+			return 1;
+		}
+#endif
+	}
+	catch (std::exception const &e)
+	{
+		std::printf("failed to create a backend: %s\n", e.what());
+		return 1;
+	}
+	if (backends.empty())
+	{
+		std::printf("unknown backend %s\n", backendName.c_str());
+		return 1;
+	}
+
+	Frame frame(MakeFrame(width, height, projection, std::max(tableSize, 2u)));
+	std::printf("%ux%u %s\n", width, height, OutputProjectionName(projection));
+	std::vector<Result> results;
+	try
+	{
+		for (auto &backend : backends)
+			results.push_back(RenderFrame(*backend, frame));
+	}
+	catch (std::exception const &e)
+	{
+		std::printf("render failed: %s\n", e.what());
+		return 1;
+	}
+
+	if (!output.empty() && !WritePFM(output, results.front().pixels.data(), width, height))
+	{
+		std::printf("failed to write %s\n", output.c_str());
+		return 1;
+	}
+
+	bool matches(true);
+	for (std::size_t i(1); i < results.size(); ++i)
+	{
+		ImageDifference diff(CompareImages(results.front().pixels.data(), results[i].pixels.data(), width, height, g_PixelThreshold));
+		float fraction(static_cast<float>(diff.differing) / (static_cast<float>(width) * height));
+		bool ok(fraction <= tolerance);
+		matches = matches && ok;
+		std::printf("%s vs %s: max %.3e, mean %.3e, psnr %.1f dB, %llu pixels (%.4f%%) above %.0e %s\n", backends.front()->Name(), backends[i]->Name(),
+					diff.maxError, diff.meanError, diff.psnr, static_cast<unsigned long long>(diff.differing), fraction * 100.0f, g_PixelThreshold, ok ? "ok" : "FAILED");
+	}
+	return matches ? 0 : 1;
+}
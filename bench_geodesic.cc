@@ -0,0 +1,596 @@
+// Microbenchmark of the geodesic integrator: throughput of the right hand side (analytic and
+// tabulated r(l)) and of whole phi_mapping traces for every CPU variant, plus their accuracy
+// against the reference integrator over a grid of wormhole parameters. Results are printed and
+// written as JSON.
+//
+// geodesic-bench [--quick] [--output file.json] [--golden dir] [--write-golden dir] [--validate-symmetry] [--kernels]
+//                [--tile-scaling] [--max-threads n] [--numa-nodes n]
+//
+// --write-golden computes the golden tables of the canonical wormholes with the reference
+// integrator and exits, --golden measures accuracy against them instead of the parameter grid.
+// --validate-symmetry checks the mirrored half of the phi table of each canonical wormhole
+// against direct traces and fails if they differ by more than g_SymmetryTolerance.
+// --kernels compares the specialized instantiations of the table builder and the CPU tile kernel
+// with their generic versions that check the options per entry or pixel, and fails if their
+// results differ.
+// --tile-scaling renders one frame through NumaTileScheduler.h with 1, 2, 4, ... up to
+// --max-threads (default 128) workers and prints the time, speedup and scaling efficiency against
+// one worker, next to the shared tile queue, and how many tiles were stolen within and across
+// nodes. --numa-nodes n splits the CPUs into n nodes on machines without NUMA. Fails if the two
+// schedulers render different pixels.
+
+#include "Geodesic.h"
+#include "PhiTable.h"
+#include "ReferenceIntegrator.h"
+#include "Quadrature.h"
+#include "RadiusTable.h"
+#include "NumaTileScheduler.h"
+#include "TileRenderer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double SecondsSince(Clock::time_point begin)
+	{
+		return std::chrono::duration<double>(Clock::now() - begin).count();
+	}
+
+	float constexpr g_SymmetryTolerance = 1e-3f;
+	double constexpr g_QuadratureTolerance = 1e-6;
+
+	// keeps results alive so the compiler cannot drop the measured work
+	volatile float g_Sink;
+
+	struct Throughput
+	{
+		double rhsScalar = 0, rhsSimd = 0, rhsTabulated = 0; // evaluations per second
+		double raysScalar = 0, raysSimd = 0, raysAdaptive = 0, raysQuadrature = 0, raysTabulated = 0, raysTable = 0; // traces per second
+		double adaptiveEvaluationsPerRay = 0, quadratureEvaluationsPerRay = 0;
+		double tableBuildMs = 0, radiusTableBuildMs = 0;
+		double radiusTableMaxError = 0, radiusTableDerivativeMaxError = 0; // against (5) in double
+	};
+
+	struct Accuracy
+	{
+		std::string config;
+		std::string variant;
+		Wormhole wormhole;
+		float l, r;
+		double maxError = 0, meanError = 0; // radians
+		std::uint32_t rays = 0, sideMismatches = 0;
+	};
+
+	Wormhole MakeWormhole(float mass, float radius, float length)
+	{
+		Wormhole w;
+		w.mass = mass;
+		w.radius = radius;
+		w.length = length;
+		return w;
+	}
+
+	std::vector<float> SampleDirections(std::uint32_t count)
+	{
+		// offset by half a step so no sample falls exactly on a table entry
+		std::vector<float> phis(count);
+		for (std::uint32_t i(0); i < count; ++i)
+			phis[i] = (static_cast<float>(i) + 0.37f) / static_cast<float>(count) * geodesic::TwoPi<float>;
+		return phis;
+	}
+
+	Throughput MeasureThroughput(bool quick)
+	{
+		Throughput t;
+		Wormhole w;
+		float l(4.0f), r(w.radius + 4.0f);
+
+		std::uint32_t const rhsCount(quick ? 1u << 20 : 1u << 24);
+		{
+			geodesic::Ray<float> ray{ 0.3f, 0.09f };
+			geodesic::State<float> s{ -3.0f, 0.0f, 0.5f };
+			float acc(0.0f);
+			auto begin(Clock::now());
+			for (std::uint32_t i(0); i < rhsCount; ++i)
+			{
+				s.l += 1e-6f;
+				acc += geodesic::NullGeodesic2D(s, w.length, w.mass, w.radius, ray).pl;
+			}
+			t.rhsScalar = rhsCount / SecondsSince(begin);
+			g_Sink = acc;
+		}
+		auto radiusBegin(Clock::now());
+		RadiusTable radii(BuildRadiusTable(w, PhiMappingRadiusUMax(w, l)));
+		t.radiusTableBuildMs = SecondsSince(radiusBegin) * 1000.0;
+		{
+			geodesic::Ray<float> ray{ 0.3f, 0.09f };
+			geodesic::State<float> s{ -3.0f, 0.0f, 0.5f };
+			float acc(0.0f);
+			auto begin(Clock::now());
+			for (std::uint32_t i(0); i < rhsCount; ++i)
+			{
+				s.l += 1e-6f;
+				acc += geodesic::NullGeodesic2D(s, radii, ray).pl;
+			}
+			t.rhsTabulated = rhsCount / SecondsSince(begin);
+			g_Sink = acc;
+		}
+		{
+			// dense near the throat where the curvature is
+			std::uint32_t const samples(quick ? 1u << 16 : 1u << 20);
+			for (std::uint32_t i(0); i < samples; ++i)
+			{
+				double f(static_cast<double>(i) / samples);
+				double u(f * f * radii.uMax);
+				float r, dr_dl;
+				radii.Evaluate(static_cast<float>(w.length + u), r, dr_dl);
+				double exact_l(static_cast<float>(w.length + u)); // what the table saw
+				t.radiusTableMaxError = std::max(t.radiusTableMaxError, std::abs(r - geodesic::RadiusOfL(exact_l, w)));
+				t.radiusTableDerivativeMaxError = std::max(t.radiusTableDerivativeMaxError, std::abs(dr_dl - geodesic::RadiusDerivative(exact_l, w)));
+			}
+		}
+#if defined(WORMHOLE_SSE2)
+		{
+			geodesic::Ray4 ray{ _mm_set_ps(0.3f, 0.2f, -0.1f, 0.4f), _mm_set1_ps(0.09f) };
+			geodesic::State4 s{ _mm_set_ps(-3.0f, -1.0f, 1.0f, 3.0f), _mm_setzero_ps(), _mm_set1_ps(0.5f) };
+			__m128 a(_mm_set1_ps(w.length)), M(_mm_set1_ps(w.mass)), rho(_mm_set1_ps(w.radius));
+			__m128 acc(_mm_setzero_ps()), inc(_mm_set1_ps(1e-6f));
+			auto begin(Clock::now());
+			for (std::uint32_t i(0); i < rhsCount / 4; ++i)
+			{
+				s.l = _mm_add_ps(s.l, inc);
+				acc = _mm_add_ps(acc, geodesic::NullGeodesic2D(s, a, M, rho, ray).pl);
+			}
+			t.rhsSimd = rhsCount / SecondsSince(begin);
+			g_Sink = _mm_cvtss_f32(acc);
+		}
+#endif
+
+		auto phis(SampleDirections(quick ? 16 : 256));
+		{
+			float acc(0.0f);
+			auto begin(Clock::now());
+			for (float phi : phis)
+				acc += geodesic::PhiMapping(phi, l, r, w).phi;
+			t.raysScalar = phis.size() / SecondsSince(begin);
+			g_Sink = acc;
+		}
+#if defined(WORMHOLE_SSE2)
+		{
+			float acc(0.0f);
+			geodesic::Traced<float> out[4];
+			auto begin(Clock::now());
+			for (std::size_t i(0); i + 4 <= phis.size(); i += 4)
+			{
+				geodesic::PhiMapping4(&phis[i], l, r, w, out);
+				acc += out[0].phi + out[3].phi;
+			}
+			t.raysSimd = phis.size() / SecondsSince(begin);
+			g_Sink = acc;
+		}
+#endif
+		{
+			float acc(0.0f);
+			auto begin(Clock::now());
+			for (float phi : phis)
+				acc += geodesic::PhiMappingTabulated(phi, l, r, radii).phi;
+			t.raysTabulated = phis.size() / SecondsSince(begin);
+			g_Sink = acc;
+		}
+		{
+			float acc(0.0f);
+			std::uint64_t evaluations(0);
+			auto begin(Clock::now());
+			for (float phi : phis)
+			{
+				int evals(0);
+				acc += geodesic::PhiMappingAdaptive(phi, l, r, w, 1e-5f, 100.0f, &evals).phi;
+				evaluations += evals;
+			}
+			t.raysAdaptive = phis.size() / SecondsSince(begin);
+			t.adaptiveEvaluationsPerRay = static_cast<double>(evaluations) / phis.size();
+			g_Sink = acc;
+		}
+		{
+			double acc(0.0);
+			std::uint64_t evaluations(0);
+			auto begin(Clock::now());
+			for (float phi : phis)
+			{
+				auto result(geodesic::PhiMappingQuadrature<double>(phi, l, r, w, g_QuadratureTolerance));
+				acc += result.traced.phi;
+				evaluations += result.evaluations;
+			}
+			t.raysQuadrature = phis.size() / SecondsSince(begin);
+			t.quadratureEvaluationsPerRay = static_cast<double>(evaluations) / phis.size();
+			g_Sink = static_cast<float>(acc);
+		}
+		{
+			auto begin(Clock::now());
+			PhiTable table(BuildPhiTable(w, l, r, quick ? 1024 : g_PhiCacheSize));
+			t.tableBuildMs = SecondsSince(begin) * 1000.0;
+
+			std::uint32_t const lookups(quick ? 1u << 20 : 1u << 24);
+			float acc(0.0f), phi(0.0f);
+			begin = Clock::now();
+			for (std::uint32_t i(0); i < lookups; ++i)
+			{
+				phi += 0.000123f;
+				acc += table.Lookup(phi).phi;
+			}
+			t.raysTable = lookups / SecondsSince(begin);
+			g_Sink = acc;
+		}
+		return t;
+	}
+
+	// error of every variant against a golden table, rays the reference saw orbiting are skipped
+	void MeasureAccuracy(reference::GoldenTable const &golden, bool quick, std::vector<Accuracy> &results)
+	{
+		Wormhole const &w(golden.wormhole);
+		float l(static_cast<float>(golden.l)), r(static_cast<float>(golden.r));
+		std::vector<float> phis;
+		for (auto const &e : golden.entries)
+			phis.push_back(static_cast<float>(e.phiIn));
+
+		PhiTable table(BuildPhiTable(w, l, r, quick ? 1024 : g_PhiCacheSize));
+		RadiusTable radii(BuildRadiusTable(w, PhiMappingRadiusUMax(w, l)));
+
+		auto measure([&](char const *variant, auto &&trace) {
+			Accuracy a{ golden.name, variant, w, l, r };
+			std::vector<geodesic::Traced<float>> traced(phis.size());
+			trace(traced);
+			std::uint32_t compared(0);
+			for (std::size_t i(0); i < phis.size(); ++i)
+			{
+				auto const &reference(golden.entries[i]);
+				if (!reference.escaped)
+					continue;
+				++a.rays;
+				if ((traced[i].l < 0.0f) != (reference.l < 0.0))
+				{
+					++a.sideMismatches;
+					continue;
+				}
+				double error(std::abs(geodesic::AngleDifference<double>(traced[i].phi, reference.phi)));
+				a.maxError = std::max(a.maxError, error);
+				a.meanError += error;
+				++compared;
+			}
+			if (compared)
+				a.meanError /= compared;
+			results.push_back(a);
+		});
+
+		measure("scalar", [&](auto &traced) {
+			for (std::size_t i(0); i < phis.size(); ++i)
+				traced[i] = geodesic::PhiMapping(phis[i], l, r, w);
+		});
+#if defined(WORMHOLE_SSE2)
+		measure("simd", [&](auto &traced) {
+			std::size_t i(0);
+			for (; i + 4 <= phis.size(); i += 4)
+				geodesic::PhiMapping4(&phis[i], l, r, w, &traced[i]);
+			for (; i < phis.size(); ++i)
+				traced[i] = geodesic::PhiMapping(phis[i], l, r, w);
+		});
+#endif
+		measure("tabulated", [&](auto &traced) {
+			for (std::size_t i(0); i < phis.size(); ++i)
+				traced[i] = geodesic::PhiMappingTabulated(phis[i], l, r, radii);
+		});
+		measure("adaptive", [&](auto &traced) {
+			for (std::size_t i(0); i < phis.size(); ++i)
+				traced[i] = geodesic::PhiMappingAdaptive(phis[i], l, r, w);
+		});
+		measure("quadrature", [&](auto &traced) {
+			for (std::size_t i(0); i < phis.size(); ++i)
+			{
+				auto result(geodesic::PhiMappingQuadrature<double>(golden.entries[i].phiIn, golden.l, golden.r, w, g_QuadratureTolerance).traced);
+				traced[i] = { static_cast<float>(result.phi), static_cast<float>(result.l) };
+			}
+		});
+		if (geodesic::ClosedFormApplies(w))
+			measure("closed_form", [&](auto &traced) {
+				for (std::size_t i(0); i < phis.size(); ++i)
+				{
+					auto result(geodesic::PhiMappingClosedForm<double>(golden.entries[i].phiIn, golden.l, golden.r, w));
+					traced[i] = { static_cast<float>(result.phi), static_cast<float>(result.l) };
+				}
+			});
+		measure("table", [&](auto &traced) {
+			for (std::size_t i(0); i < phis.size(); ++i)
+				traced[i] = table.Lookup(phis[i]);
+		});
+	}
+
+	// reference tables over a grid of wormhole parameters, computed on the spot
+	std::vector<reference::GoldenTable> GridTables(bool quick)
+	{
+		std::vector<Wormhole> wormholes;
+		for (float mass : { 0.01f, 0.1f, 0.5f })
+			for (float radius : { 0.5f, 1.0f, 2.0f })
+				for (float length : { 0.0f, 0.5f })
+					wormholes.push_back(MakeWormhole(mass, radius, length));
+		std::vector<double> cameraL{ 4.0, -2.0 };
+		if (quick)
+		{
+			wormholes = { MakeWormhole(0.1f, 0.5f, 0.0f), MakeWormhole(0.5f, 1.0f, 0.5f) };
+			cameraL = { 4.0 };
+		}
+
+		std::vector<reference::GoldenTable> tables;
+		for (auto const &w : wormholes)
+			for (double l : cameraL)
+				tables.push_back(reference::ComputeGoldenTable(reference::GoldenConfig{ "grid", w, l }, quick ? 16 : 64));
+		return tables;
+	}
+
+	// best of a few runs, on one thread so the kernels are compared and not the scheduling
+	template<typename F>
+	double BestMs(int runs, F &&f)
+	{
+		double best(1e30);
+		for (int i(0); i < runs; ++i)
+		{
+			auto begin(Clock::now());
+			f();
+			best = std::min(best, SecondsSince(begin) * 1000.0);
+		}
+		return best;
+	}
+
+	bool CompareKernels(bool quick)
+	{
+		bool identical(true);
+		Wormhole w(MakeWormhole(0.1f, 0.5f, 0.0f));
+		float l(4.0f), r(w.radius + l);
+		std::uint32_t size(quick ? 256 : 2048);
+		std::printf("%-36s %10s %10s %8s\n", "variant", "generic", "special", "speedup");
+		for (PhiSolver solver : { PhiSolver::RK4, PhiSolver::Tabulated })
+		{
+			PhiTable generic, special;
+			double genericMs(BestMs(1, [&] { generic = BuildPhiTableWith(w, l, r, size, 1, solver, false, 10000); }));
+			double specialMs(BestMs(1, [&] { special = BuildPhiTable(w, l, r, size, 1, solver); }));
+			bool same(std::equal(generic.entries.begin(), generic.entries.end(), special.entries.begin(),
+								 [](auto const &a, auto const &b) { return a.phi == b.phi && a.l == b.l; }));
+			identical = identical && same;
+			std::printf("table %-30s %8.1fms %8.1fms %7.2fx%s\n", solver == PhiSolver::RK4 ? "rk4" : "tabulated", genericMs, specialMs, genericMs / specialMs, same ? "" : " DIFFERS");
+		}
+
+		// checkerboard skymaps so the filters differ
+		std::uint32_t skyWidth(1024), skyHeight(512);
+		std::vector<float> sky1(skyWidth * skyHeight * 4), sky2(skyWidth * skyHeight * 4);
+		for (std::uint32_t y(0); y < skyHeight; ++y)
+			for (std::uint32_t x(0); x < skyWidth; ++x)
+				for (std::uint32_t c(0); c < 4; ++c)
+				{
+					float v(((x / 32 + y / 32) & 1) ? 0.9f : 0.1f);
+					sky1[(y * skyWidth + x) * 4 + c] = v;
+					sky2[(y * skyWidth + x) * 4 + c] = 1.0f - v;
+				}
+		SkyView view1{ sky1.data(), skyWidth, skyHeight }, view2{ sky2.data(), skyWidth, skyHeight };
+		PhiTable table(BuildPhiTable(w, l, r, size));
+		RayCamera cam{ { r, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, 1.13f, 0.64f, quick ? 320u : 960u, quick ? 180u : 540u };
+		std::vector<float> generic(cam.width * cam.height * 4), special(cam.width * cam.height * 4);
+		Foveation foveation;
+		for (OutputProjection projection : { OutputProjection::Pinhole, OutputProjection::Equirectangular, OutputProjection::Cubemap, OutputProjection::Fisheye })
+			for (SkyFilter filter : { SkyFilter::Bilinear, SkyFilter::Nearest })
+				for (PixelFormat format : { PixelFormat::RGBA32F, PixelFormat::RGBA8 })
+					for (std::uint32_t samples : { 1u, 4u })
+					{
+						KernelOptions options{ projection, filter, format, samples };
+						double genericMs(BestMs(3, [&] { RenderTiles(options, table, view1, view2, cam, foveation, generic.data(), 1, false); }));
+						double specialMs(BestMs(3, [&] { RenderTiles(options, table, view1, view2, cam, foveation, special.data(), 1, true); }));
+						bool same(generic == special);
+						identical = identical && same;
+						char name[64];
+						std::snprintf(name, sizeof(name), "pixels %s %s %s x%u", OutputProjectionName(projection), filter == SkyFilter::Nearest ? "nearest" : "bilinear",
+									  format == PixelFormat::RGBA8 ? "rgba8" : "rgba32f", samples);
+						std::printf("%-36s %8.1fms %8.1fms %7.2fx%s\n", name, genericMs, specialMs, genericMs / specialMs, same ? "" : " DIFFERS");
+					}
+		return identical;
+	}
+
+	bool TileScaling(bool quick, unsigned maxThreads, unsigned numaNodes)
+	{
+		NumaTopology topology(NumaTopology::Detect());
+		if (numaNodes)
+			topology = topology.Split(numaNodes);
+		std::printf("%u NUMA nodes, %u CPUs\n", static_cast<unsigned>(topology.nodes.size()), topology.Cpus());
+
+		Wormhole w(MakeWormhole(0.1f, 0.5f, 0.0f));
+		float l(4.0f), r(w.radius + l);
+		PhiTable table(BuildPhiTable(w, l, r, quick ? 256 : 2048));
+		std::uint32_t skyWidth(2048), skyHeight(1024);
+		std::vector<float> sky1(static_cast<std::size_t>(skyWidth) * skyHeight * 4), sky2(sky1.size());
+		for (std::size_t i(0); i < sky1.size(); ++i)
+		{
+			sky1[i] = static_cast<float>(i % 4099) / 4099.0f;
+			sky2[i] = 1.0f - sky1[i];
+		}
+		SkyView view1{ sky1.data(), skyWidth, skyHeight }, view2{ sky2.data(), skyWidth, skyHeight };
+		RayCamera cam{ { r, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, 1.13f, 0.64f, quick ? 320u : 1920u, quick ? 180u : 1080u };
+		KernelOptions options{ OutputProjection::Pinhole, SkyFilter::Bilinear, PixelFormat::RGBA32F, 1 };
+		Foveation foveation;
+		std::vector<float> shared(static_cast<std::size_t>(cam.width) * cam.height * 4), numa(shared.size());
+
+		bool identical(true);
+		double sharedOne(0.0), numaOne(0.0);
+		std::printf("%8s %10s %8s %10s %10s %8s %10s %10s %10s %10s\n", "threads", "shared", "speedup", "efficiency", "numa", "speedup", "efficiency", "own", "stolen", "remote");
+		for (unsigned threads(1); threads <= maxThreads; threads *= 2)
+		{
+			NumaTileScheduler scheduler(topology, threads);
+			scheduler.Replicate(view1, view2);
+			double sharedMs(BestMs(3, [&] { RenderTiles(options, table, view1, view2, cam, foveation, shared.data(), threads); }));
+			double numaMs(BestMs(3, [&] { RenderTiles(scheduler, options, table, view1, view2, cam, foveation, numa.data()); }));
+			if (threads == 1)
+			{
+				sharedOne = sharedMs;
+				numaOne = numaMs;
+			}
+			bool same(shared == numa);
+			identical = identical && same;
+			std::printf("%8u %8.1fms %7.2fx %9.0f%% %8.1fms %7.2fx %9.0f%% %10llu %10llu %10llu%s\n", threads, sharedMs, sharedOne / sharedMs, sharedOne / sharedMs / threads * 100.0,
+						numaMs, numaOne / numaMs, numaOne / numaMs / threads * 100.0, static_cast<unsigned long long>(scheduler.stats.own),
+						static_cast<unsigned long long>(scheduler.stats.stolenLocal), static_cast<unsigned long long>(scheduler.stats.stolenRemote), same ? "" : " DIFFERS");
+		}
+		return identical;
+	}
+
+	std::string GoldenPath(std::string const &directory, char const *name)
+	{
+		return directory + "/" + name + ".golden";
+	}
+
+	bool WriteJSON(std::string const &filename, bool quick, Throughput const &t, std::vector<Accuracy> const &accuracy)
+	{
+		std::ofstream file(filename);
+		if (!file)
+			return false;
+		file << std::setprecision(6);
+		file << "{\n  \"quick\": " << (quick ? "true" : "false") << ",\n"
+			<< "  \"throughput\": {\n"
+			<< "    \"rhs_scalar_per_sec\": " << t.rhsScalar << ",\n"
+			<< "    \"rhs_simd_per_sec\": " << t.rhsSimd << ",\n"
+			<< "    \"rhs_tabulated_per_sec\": " << t.rhsTabulated << ",\n"
+			<< "    \"rays_scalar_per_sec\": " << t.raysScalar << ",\n"
+			<< "    \"rays_simd_per_sec\": " << t.raysSimd << ",\n"
+			<< "    \"rays_tabulated_per_sec\": " << t.raysTabulated << ",\n"
+			<< "    \"rays_adaptive_per_sec\": " << t.raysAdaptive << ",\n"
+			<< "    \"adaptive_evaluations_per_ray\": " << t.adaptiveEvaluationsPerRay << ",\n"
+			<< "    \"rays_quadrature_per_sec\": " << t.raysQuadrature << ",\n"
+			<< "    \"quadrature_evaluations_per_ray\": " << t.quadratureEvaluationsPerRay << ",\n"
+			<< "    \"rays_table_per_sec\": " << t.raysTable << ",\n"
+			<< "    \"table_build_ms\": " << t.tableBuildMs << ",\n"
+			<< "    \"radius_table_build_ms\": " << t.radiusTableBuildMs << ",\n"
+			<< "    \"radius_table_max_error\": " << t.radiusTableMaxError << ",\n"
+			<< "    \"radius_table_dr_dl_max_error\": " << t.radiusTableDerivativeMaxError << "\n"
+			<< "  },\n  \"accuracy\": [\n";
+		for (std::size_t i(0); i < accuracy.size(); ++i)
+		{
+			auto const &a(accuracy[i]);
+			file << "    {\"config\": \"" << a.config << "\", \"variant\": \"" << a.variant << "\", \"mass\": " << a.wormhole.mass << ", \"radius\": " << a.wormhole.radius
+				<< ", \"length\": " << a.wormhole.length << ", \"l\": " << a.l << ", \"r\": " << a.r
+				<< ", \"rays\": " << a.rays << ", \"side_mismatches\": " << a.sideMismatches
+				<< ", \"max_error_rad\": " << a.maxError << ", \"mean_error_rad\": " << a.meanError << "}"
+				<< (i + 1 < accuracy.size() ? ",\n" : "\n");
+		}
+		file << "  ]\n}\n";
+		return static_cast<bool>(file);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool quick(false);
+	std::string output("geodesic_bench.json");
+	std::string goldenDirectory, writeGoldenDirectory;
+	bool validateSymmetry(false), kernels(false), tileScaling(false);
+	unsigned maxThreads(128), numaNodes(0);
+	for (int i(1); i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--quick"))
+			quick = true;
+		else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+			output = argv[++i];
+		else if (!std::strcmp(argv[i], "--golden") && i + 1 < argc)
+			goldenDirectory = argv[++i];
+		else if (!std::strcmp(argv[i], "--write-golden") && i + 1 < argc)
+			writeGoldenDirectory = argv[++i];
+		else if (!std::strcmp(argv[i], "--validate-symmetry"))
+			validateSymmetry = true;
+		else if (!std::strcmp(argv[i], "--kernels"))
+			kernels = true;
+		else if (!std::strcmp(argv[i], "--tile-scaling"))
+			tileScaling = true;
+		else if (!std::strcmp(argv[i], "--max-threads") && i + 1 < argc)
+			maxThreads = std::max(static_cast<unsigned>(std::stoul(argv[++i])), 1u);
+		else if (!std::strcmp(argv[i], "--numa-nodes") && i + 1 < argc)
+			numaNodes = static_cast<unsigned>(std::stoul(argv[++i]));
+		else
+		{
+			std::printf("usage: %s [--quick] [--output file.json] [--golden dir] [--write-golden dir] [--validate-symmetry] [--kernels] [--tile-scaling] [--max-threads n] [--numa-nodes n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (kernels)
+		return CompareKernels(quick) ? 0 : 1;
+	if (tileScaling)
+		return TileScaling(quick, maxThreads, numaNodes) ? 0 : 1;
+
+	if (validateSymmetry)
+	{
+		bool holds(true);
+		for (auto const &config : reference::CanonicalConfigs())
+		{
+			float l(static_cast<float>(config.l)), r(config.wormhole.radius + std::abs(l));
+			PhiTable table(BuildPhiTable(config.wormhole, l, r, quick ? 1024 : g_PhiCacheSize));
+			auto check(ValidatePhiTableSymmetry(table, quick ? 16 : 64));
+			std::printf("%-20s max error %.3e, side mismatches %u/%u %s\n", config.name, check.maxError, check.sideMismatches, check.checked,
+						check.Holds(g_SymmetryTolerance) ? "ok" : "FAILED");
+			holds = holds && check.Holds(g_SymmetryTolerance);
+		}
+		return holds ? 0 : 1;
+	}
+
+	if (!writeGoldenDirectory.empty())
+	{
+		for (auto const &config : reference::CanonicalConfigs())
+		{
+			auto begin(Clock::now());
+			auto table(reference::ComputeGoldenTable(config, quick ? 64 : 1024));
+			auto path(GoldenPath(writeGoldenDirectory, config.name));
+			if (!table.Save(path))
+			{
+				std::printf("failed to write %s\n", path.c_str());
+				return 1;
+			}
+			std::size_t escaped(std::count_if(table.entries.begin(), table.entries.end(), [](auto const &e) { return e.escaped; }));
+			std::printf("%-20s %zu/%zu rays escaped, %.1f s -> %s\n", config.name, escaped, table.entries.size(), SecondsSince(begin), path.c_str());
+		}
+		return 0;
+	}
+
+	Throughput t(MeasureThroughput(quick));
+	std::printf("null_geodesic_2d scalar   %12.0f evals/s\n", t.rhsScalar);
+	std::printf("null_geodesic_2d simd     %12.0f evals/s\n", t.rhsSimd);
+	std::printf("null_geodesic_2d table    %12.0f evals/s (build %.2f ms, max error r %.1e, dr/dl %.1e)\n", t.rhsTabulated, t.radiusTableBuildMs, t.radiusTableMaxError, t.radiusTableDerivativeMaxError);
+	std::printf("phi_mapping scalar        %12.1f rays/s\n", t.raysScalar);
+	std::printf("phi_mapping simd          %12.1f rays/s\n", t.raysSimd);
+	std::printf("phi_mapping tabulated r   %12.1f rays/s\n", t.raysTabulated);
+	std::printf("phi_mapping adaptive      %12.1f rays/s (%.0f evals/ray)\n", t.raysAdaptive, t.adaptiveEvaluationsPerRay);
+	std::printf("phi_mapping quadrature    %12.1f rays/s (%.0f evals/ray)\n", t.raysQuadrature, t.quadratureEvaluationsPerRay);
+	std::printf("phi_mapping table lookup  %12.0f rays/s (build %.1f ms)\n", t.raysTable, t.tableBuildMs);
+
+	std::vector<reference::GoldenTable> tables;
+	if (goldenDirectory.empty())
+		tables = GridTables(quick);
+	else
+		for (auto const &config : reference::CanonicalConfigs())
+			tables.push_back(reference::GoldenTable::Load(GoldenPath(goldenDirectory, config.name)));
+
+	std::vector<Accuracy> accuracy;
+	for (auto const &table : tables)
+		MeasureAccuracy(table, quick, accuracy);
+	std::printf("\n%-20s %-11s %6s %6s %6s %6s %12s %12s %s\n", "config", "variant", "mass", "radius", "length", "l", "max err", "mean err", "side mismatches");
+	for (auto const &a : accuracy)
+		std::printf("%-20s %-11s %6.2f %6.2f %6.2f %6.2f %12.3e %12.3e %u/%u\n", a.config.c_str(), a.variant.c_str(), a.wormhole.mass, a.wormhole.radius, a.wormhole.length, a.l, a.maxError, a.meanError, a.sideMismatches, a.rays);
+
+	if (!WriteJSON(output, quick, t, accuracy))
+	{
+		std::printf("failed to write %s\n", output.c_str());
+		return 1;
+	}
+	std::printf("\nwrote %s\n", output.c_str());
+	return 0;
+}
@@ -18,6 +18,8 @@
 #include <exception>
 #include <system_error>
 
+#include "Profiler.h"
+
 using Microsoft::WRL::ComPtr;
 
 #define THROW(x) { HRESULT const hr{x}; if( FAILED(hr) ) { throw std::runtime_error(std::system_category().message(hr)); } }
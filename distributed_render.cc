@@ -0,0 +1,251 @@
+// Coordinator and worker of DistributedRender.h: renders a sequence of frames of the orbit of
+// wormhole-headless on worker processes (or hosts) connected over TCP, and prints how many bytes
+// of skymaps, phi tables, work items and pixels went over the connections.
+//
+// wormhole-distributed --coordinator [--port n] [--workers n] [--local-workers n] [--frames n] [--width n] [--height n]
+//                      [--table-size n] [--distances n] [--item-size n] [--depth n] [--verify] [--drop-worker]
+// wormhole-distributed --worker host:port [--threads n]
+//
+// The coordinator listens on --port (0, the default, picks one and prints it) and waits for
+// --workers remote workers; --local-workers n also starts n workers as threads of its own process
+// that connect over the loopback interface, so the whole protocol runs on one machine. The camera
+// orbits at --distances n distances from the throat, changing every 8 frames, so each worker
+// receives the skymaps once and each of the n tables once. --verify renders every frame locally
+// too and fails if any pixel differs.
+//
+// --drop-worker makes the first local worker hold on to its first work items until every other
+// frame has been delivered and the other connections have run out of items (100 ms later), and
+// then close its connection without answering. The other local workers start rendering once it holds them, when
+// no more than the first items of frame 0 have been handed out. The coordinator has to hand the items to the idle
+// workers for frame 0 to complete; with --verify the run fails unless it does so with no pixel
+// differing.
+
+#include "DistributedRender.h"
+#include "ImageDiff.h"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	float constexpr g_OrbitStep = 0.02f; // radians per frame
+
+	int RunWorker(std::string const &address, unsigned threads)
+	{
+		std::size_t colon(address.rfind(':'));
+		if (colon == std::string::npos)
+		{
+			std::printf("worker address must be host:port\n");
+			return 1;
+		}
+		try
+		{
+			TileSocket socket(TileSocket::Connect(address.substr(0, colon), static_cast<std::uint16_t>(std::stoul(address.substr(colon + 1)))));
+			TileWorkerStats stats(ServeTiles(socket, threads));
+			std::printf("worker: %llu items, %llu rays, received %llu skymaps and %llu tables, %llu tables evicted\n", static_cast<unsigned long long>(stats.items),
+						static_cast<unsigned long long>(stats.rays), static_cast<unsigned long long>(stats.skies), static_cast<unsigned long long>(stats.tables),
+						static_cast<unsigned long long>(stats.evictions));
+		}
+		catch (std::exception const &e)
+		{
+			std::printf("worker failed: %s\n", e.what());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool coordinator(false), verify(false), dropWorker(false);
+	std::string workerAddress;
+	unsigned threads(0), remoteWorkers(0), localWorkers(0), depth(2);
+	std::uint16_t port(0);
+	std::uint32_t frames(32), width(320), height(180), tableSize(2048), distances(2), itemSize(64);
+	for (int i(1); i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--coordinator"))
+			coordinator = true;
+		else if (!std::strcmp(argv[i], "--worker") && i + 1 < argc)
+			workerAddress = argv[++i];
+		else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--port") && i + 1 < argc)
+			port = static_cast<std::uint16_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--workers") && i + 1 < argc)
+			remoteWorkers = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--local-workers") && i + 1 < argc)
+			localWorkers = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = std::max(static_cast<std::uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (!std::strcmp(argv[i], "--width") && i + 1 < argc)
+			width = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--height") && i + 1 < argc)
+			height = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--table-size") && i + 1 < argc)
+			tableSize = std::max(std::min(static_cast<std::uint32_t>(std::stoul(argv[++i])) & ~1u, g_PhiCacheSize), 2u);
+		else if (!std::strcmp(argv[i], "--distances") && i + 1 < argc)
+			distances = std::max(static_cast<std::uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (!std::strcmp(argv[i], "--item-size") && i + 1 < argc)
+			itemSize = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--depth") && i + 1 < argc)
+			depth = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--verify"))
+			verify = true;
+		else if (!std::strcmp(argv[i], "--drop-worker"))
+			dropWorker = true;
+		else
+		{
+			std::printf("usage: %s --coordinator [--port n] [--workers n] [--local-workers n] [--frames n] [--width n] [--height n] [--table-size n] [--distances n] [--item-size n] [--depth n] [--verify] [--drop-worker]\n"
+						"       %s --worker host:port [--threads n]\n", argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	SocketLibrary sockets;
+	if (!workerAddress.empty())
+		return RunWorker(workerAddress, threads);
+	if (!coordinator || remoteWorkers + localWorkers == 0)
+	{
+		std::printf("--coordinator needs --workers or --local-workers\n");
+		return 1;
+	}
+
+	TileCoordinator tiles(itemSize, depth);
+	if (dropWorker)
+	{
+		// the items in flight before anything is answered must all be in frame 0
+		std::uint32_t itemsPerFrame(((width + tiles.itemSize - 1) / tiles.itemSize) * ((height + tiles.itemSize - 1) / tiles.itemSize));
+		if (remoteWorkers != 0 || localWorkers < 2 || frames < 2 || itemsPerFrame < localWorkers * tiles.depth)
+		{
+			std::printf("--drop-worker needs 2 local workers and no remote ones, 2 frames and %u items per frame\n", localWorkers * tiles.depth);
+			return 1;
+		}
+	}
+
+	std::vector<std::thread> local;
+	std::uint64_t differing(0);
+	std::uint32_t delivered(0);
+	std::mutex dropMutex;
+	std::condition_variable dropSignal;
+	bool holding(false), dropNow(false);
+	auto releaseDrop([&] {
+		std::lock_guard<std::mutex> lock(dropMutex);
+		holding = dropNow = true;
+		dropSignal.notify_all();
+	});
+	try
+	{
+		TileSocket listener(TileSocket::Listen(port, remoteWorkers == 0));
+		std::printf("coordinator on port %u, waiting for %u workers\n", static_cast<unsigned>(listener.Port()), remoteWorkers + localWorkers);
+		std::fflush(stdout);
+		for (unsigned w(0); w < localWorkers; ++w)
+			local.emplace_back([&, port = listener.Port(), drop = dropWorker && w == 0] {
+				try
+				{
+					TileSocket socket(TileSocket::Connect("127.0.0.1", port));
+					if (!dropWorker)
+						ServeTiles(socket, threads);
+					else if (drop)
+						ServeTiles(socket, threads, [&](TileWorkItem const &) {
+							std::unique_lock<std::mutex> lock(dropMutex);
+							holding = true;
+							dropSignal.notify_all();
+							dropSignal.wait(lock, [&] { return dropNow; });
+							// released from the last delivery, let its connection run out of items
+							std::this_thread::sleep_for(std::chrono::milliseconds(100));
+							return true;
+						});
+					else
+						ServeTiles(socket, threads, [&](TileWorkItem const &) {
+							std::unique_lock<std::mutex> lock(dropMutex);
+							dropSignal.wait(lock, [&] { return holding; });
+							return false;
+						});
+				}
+				catch (std::exception const &e)
+				{
+					std::printf("local worker failed: %s\n", e.what());
+				}
+			});
+		// the sequence is prepared while the workers connect, with two gradients so the frame is
+		// not trivially uniform as in wormhole-headless
+		std::uint32_t skyWidth(512), skyHeight(256);
+		std::vector<float> sky(static_cast<std::size_t>(skyWidth) * skyHeight * 4);
+		for (std::uint32_t y(0); y < skyHeight; ++y)
+			for (std::uint32_t x(0); x < skyWidth; ++x)
+			{
+				float *p(&sky[(static_cast<std::size_t>(y) * skyWidth + x) * 4]);
+				p[0] = static_cast<float>(x) / skyWidth;
+				p[1] = static_cast<float>(y) / skyHeight;
+				p[2] = ((x / 16 + y / 16) & 1) ? 0.8f : 0.2f;
+				p[3] = 1.0f;
+			}
+		SkyView skyView{ sky.data(), skyWidth, skyHeight };
+
+		Wormhole wormhole;
+		std::vector<std::shared_ptr<PhiTable const>> tables;
+		for (std::uint32_t d(0); d < distances; ++d)
+		{
+			float l(4.0f + static_cast<float>(d));
+			tables.push_back(std::make_shared<PhiTable const>(BuildPhiTable(wormhole, l, wormhole.radius + l, tableSize)));
+		}
+		std::vector<TileFrame> sequence;
+		for (std::uint32_t frame(0); frame < frames; ++frame)
+		{
+			auto const &table(tables[frame / 8 % distances]);
+			float angle(static_cast<float>(frame) * g_OrbitStep), c(std::cos(angle)), s(std::sin(angle)), r(table->r);
+			RayCamera cam{ { r * c, 0.0f, r * s }, { -c, 0.0f, -s }, { 0.0f, 1.0f, 0.0f }, { -s, 0.0f, c }, 1.13f, 0.64f, width, height };
+			sequence.push_back({ cam, Foveation(), table, skyView, skyView });
+		}
+
+		tiles.Accept(listener, remoteWorkers + localWorkers);
+
+		std::vector<float> reference(static_cast<std::size_t>(width) * height * 4);
+		auto begin(Clock::now());
+		tiles.RenderFrames(sequence, [&](std::uint32_t frame, float const *pixels) {
+			if (dropWorker && ++delivered == frames - 1)
+				releaseDrop();
+			if (!verify)
+				return;
+			TileFrame const &f(sequence[frame]);
+			RenderTiles(*f.table, f.sky1, f.sky2, f.camera, f.foveation, reference.data());
+			differing += CompareImages(pixels, reference.data(), width, height, 0.0f).differing;
+		});
+		double seconds(std::chrono::duration<double>(Clock::now() - begin).count());
+		tiles.Finish();
+
+		TileCoordinatorStats const &stats(tiles.stats);
+		std::printf("%u frames %ux%u on %u workers in %.2f s (%.1f fps), %llu items of %ux%u, %llu retried, %llu rays\n", frames, width, height, remoteWorkers + localWorkers,
+					seconds, frames / seconds, static_cast<unsigned long long>(stats.items), tiles.itemSize, tiles.itemSize, static_cast<unsigned long long>(stats.retried),
+					static_cast<unsigned long long>(stats.rays));
+		std::printf("sent %.2f MB of skymaps, %.2f MB of tables, %.2f MB of work items, received %.2f MB of pixels\n", stats.skyBytes / 1048576.0, stats.tableBytes / 1048576.0,
+					stats.workBytes / 1048576.0, stats.pixelBytes / 1048576.0);
+	}
+	catch (std::exception const &e)
+	{
+		std::printf("coordinator failed: %s\n", e.what());
+		releaseDrop();
+		tiles.Finish();
+		for (auto &thread : local)
+			thread.join();
+		return 1;
+	}
+	for (auto &thread : local)
+		thread.join();
+	if (verify)
+	{
+		std::printf("%llu pixels differ from a local render\n", static_cast<unsigned long long>(differing));
+		if (differing)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,42 @@
+// Camera view from the lensed environment map, the per pixel cost of a rotation when the
+// environment cache is valid. Rays are built exactly like wormhole.hlsl does.
+
+Texture2D g_environment : register(t0);
+SamplerState s1 : register(s0); // wrap in u, clamp in v
+RWTexture2D<float4> g_dst : register(u0);
+
+struct CameraData
+{
+	float4 position;
+	float4 forward;
+	float4 up;
+	float4 right;
+	float fovX;
+	float fovY;
+	float width;
+	float height;
+};
+
+#define g_PI 3.141592653589793238462643383279502884197169399375105820974f
+#define g_2PI 6.283185307179586476925286766559005768394338798750211641949f
+
+ConstantBuffer<CameraData> g_Camera : register(b0);
+
+#include "skymap_panoramic.hlsli"
+
+[numthreads(32, 32, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+	float3 dir = g_Camera.forward.xyz;
+	float3 up = g_Camera.up.xyz;
+	float3 right = g_Camera.right.xyz;
+
+	float x = float(tid.x) / float(g_Camera.width) * 2.0f - 1.0f;
+	float y = float(tid.y) / float(g_Camera.height) * 2.0f - 1.0f;
+
+	float3 r = right * g_Camera.fovX * x * 0.5f;
+	float3 u = up * g_Camera.fovY * y * 0.5f;
+	float3 ray_dir = normalize(r + u + dir);
+
+	g_dst[tid.xy] = g_environment.SampleLevel(s1, dir2uv(ray_dir), 0);
+}
@@ -0,0 +1,33 @@
+// Phi tables of up to four views in one dispatch, group row y fills table y (MultiViewRender.h).
+// The tables are packed one after another, PhiTableStoredEntries(bufferSize) entries each.
+
+RWStructuredBuffer<float2> g_phiMapping : register(u0);
+
+struct MappingData
+{
+	int bufferSize;
+	uint tables;
+	uint2 pad;
+	float4 l;	// of each table
+	float4 r;
+};
+
+ConstantBuffer<MappingData> g_MappingData : register(b0);
+
+#include "equatorial_phi_mapping.hlsli"
+
+[numthreads(1024, 1, 1)]
+void main( uint3 tid : SV_DispatchThreadID )
+{
+	int buffer_size = g_MappingData.bufferSize;
+	uint stored = uint(buffer_size / 2) + 1;
+	if (tid.x >= stored || tid.y >= g_MappingData.tables)
+		return;
+
+	float l = g_MappingData.l[tid.y];
+	float r = g_MappingData.r[tid.y];
+
+	float input_phi_value = float(tid.x) / float(buffer_size) * g_2PI;
+
+	g_phiMapping[tid.y * stored + tid.x] = phi_mapping(input_phi_value, l, r);
+}
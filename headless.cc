@@ -0,0 +1,328 @@
+// Headless run of the update/render split of FramePipeline.h on a RenderBackend: an update
+// step orbits the camera around the wormhole and publishes snapshots, the render loop renders
+// the newest. Without --threaded the update runs right before each render (the WM_PAINT model),
+// with it the update runs on its own thread at --update-hz. Prints frame rate and the age of
+// each snapshot's input when its frame is done, and fails if a snapshot arrives torn or out of order.
+// --moving also changes the distance to the throat every tick, so every frame needs its own phi
+// table. --frames-in-flight n renders through CpuFramePipeline.h instead of the backend, with n
+// frames overlapping across its table, trace, post and output stages, and prints the stage times.
+// --progressive builds coarse tables on the CPU backend and refines them in the background
+// (ProgressivePhiTable.h) and prints how many refinements completed or were cancelled.
+// --table-cache mb keeps recent tables in a PhiTableCache of that many megabytes and prints its
+// hit rate, --configs n switches between n wormhole masses every 8 frames to revisit tables.
+// --accumulate holds the camera still and blends the jittered frames into a history
+// (TemporalAccumulation.h), printing how much the history changes per frame as it converges.
+// --tile-cache re-traces only the tiles whose inputs changed (TileCache.h), with an occluder over
+// the top left quarter standing in for a UI window, and prints the tiles traced and skipped per
+// frame. --still stops the orbit. --numa traces the tiles with NumaTileScheduler.h, workers
+// pinned per NUMA node and reading a copy of the skymaps local to it, and prints the tiles stolen
+// within and across nodes in the last frame.
+//
+// wormhole-headless [--threaded] [--update-hz n] [--frames n] [--width n] [--height n]
+//                   [--table-size n] [--moving] [--frames-in-flight n] [--progressive] [--table-cache mb] [--configs n] [--accumulate] [--tile-cache] [--still] [--numa] [--backend cpu|d3d12] [--warp]
+
+#include "CpuBackend.h"
+#include "CpuFramePipeline.h"
+#include "FramePipeline.h"
+#include "TemporalAccumulation.h"
+#include "TileCache.h"
+#if defined(_WIN32)
+#include "D3D12Backend.h"
+#endif
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	float constexpr g_OrbitSpeed = 0.5f; // radians per second
+	float constexpr g_ApproachAmplitude = 1.0f; // of the distance to the throat with --moving
+
+	struct Snapshot
+	{
+		RayCamera cam;
+		float angle, r;			// orbit cam was built from, to detect torn snapshots
+		float l;
+		std::uint64_t tick;
+		Clock::time_point sampled;
+	};
+
+	struct Orbit
+	{
+		Wormhole wormhole;
+		float l, angle, speed;
+		bool moving;
+		std::uint32_t width, height;
+		std::uint64_t tick;
+
+		// one update step: advance the orbit and fill the snapshot
+		void Step(double seconds, Snapshot &snapshot)
+		{
+			angle += static_cast<float>(seconds) * speed;
+			float c(std::cos(angle)), s(std::sin(angle));
+			snapshot.l = moving ? l + g_ApproachAmplitude * std::sin(angle * 3.0f) : l;
+			float r(wormhole.radius + snapshot.l);
+			snapshot.cam = RayCamera{ { r * c, 0.0f, r * s }, { -c, 0.0f, -s }, { 0.0f, 1.0f, 0.0f }, { -s, 0.0f, c }, 1.13f, 0.64f, width, height };
+			snapshot.angle = angle;
+			snapshot.r = r;
+			snapshot.tick = ++tick;
+			snapshot.sampled = Clock::now();
+		}
+	};
+
+	bool Consistent(Snapshot const &snapshot)
+	{
+		float r(snapshot.r);
+		return std::abs(snapshot.cam.position.x - r * std::cos(snapshot.angle)) < 1e-4f && std::abs(snapshot.cam.position.z - r * std::sin(snapshot.angle)) < 1e-4f;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool threaded(false), warp(false), moving(false), progressive(false), accumulate(false), tileCache(false), still(false), numa(false);
+	std::uint32_t framesInFlight(0);
+	std::size_t tableCacheMB(0);
+	std::uint32_t configs(1);
+	double updateHz(500.0);
+	std::uint32_t frames(60), width(320), height(180), tableSize(2048);
+	std::string backendName("cpu");
+	for (int i(1); i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--threaded"))
+			threaded = true;
+		else if (!std::strcmp(argv[i], "--update-hz") && i + 1 < argc)
+			updateHz = std::max(std::stod(argv[++i]), 1.0);
+		else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--width") && i + 1 < argc)
+			width = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--height") && i + 1 < argc)
+			height = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--table-size") && i + 1 < argc)
+			tableSize = std::max(std::min(static_cast<std::uint32_t>(std::stoul(argv[++i])) & ~1u, g_PhiCacheSize), 2u);
+		else if (!std::strcmp(argv[i], "--progressive"))
+			progressive = true;
+		else if (!std::strcmp(argv[i], "--table-cache") && i + 1 < argc)
+			tableCacheMB = static_cast<std::size_t>(std::stoul(argv[++i]));
+		else if (!std::strcmp(argv[i], "--configs") && i + 1 < argc)
+			configs = std::max(static_cast<std::uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (!std::strcmp(argv[i], "--accumulate"))
+			accumulate = true;
+		else if (!std::strcmp(argv[i], "--tile-cache"))
+			tileCache = true;
+		else if (!std::strcmp(argv[i], "--still"))
+			still = true;
+		else if (!std::strcmp(argv[i], "--numa"))
+			numa = true;
+		else if (!std::strcmp(argv[i], "--moving"))
+			moving = true;
+		else if (!std::strcmp(argv[i], "--frames-in-flight") && i + 1 < argc)
+			framesInFlight = std::max(static_cast<std::uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (!std::strcmp(argv[i], "--backend") && i + 1 < argc)
+			backendName = argv[++i];
+		else if (!std::strcmp(argv[i], "--warp"))
+			warp = true;
+		else
+		{
+			std::printf("usage: %s [--threaded] [--update-hz n] [--frames n] [--width n] [--height n] [--table-size n] [--moving] [--frames-in-flight n] [--progressive] [--table-cache mb] [--configs n] [--accumulate] [--tile-cache] [--still] [--numa] [--backend cpu|d3d12] [--warp]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::unique_ptr<PhiTableCache> tableCache(tableCacheMB ? std::make_unique<PhiTableCache>(tableCacheMB << 20) : nullptr);
+	std::unique_ptr<RenderBackend> backend;
+	try
+	{
+		if (backendName == "cpu")
+			backend = std::make_unique<CpuBackend>(0, progressive, tableCache.get(), tileCache);
+#if defined(_WIN32)
+		else if (backendName == "d3d12")
+			backend = std::make_unique<D3D12Backend>(warp, tableCache.get());
+#else
+		(void)warp;
+#endif
+	}
+	catch (std::exception const &e)
+	{
+		std::printf("failed to create the backend: %s\n", e.what());
+		return 1;
+	}
+	if (!backend)
+	{
+		std::printf("unknown backend %s\n", backendName.c_str());
+		return 1;
+	}
+
+	// two gradients so the frame is not trivially uniform
+	std::uint32_t skyWidth(512), skyHeight(256);
+	std::vector<float> sky(static_cast<std::size_t>(skyWidth) * skyHeight * 4);
+	for (std::uint32_t y(0); y < skyHeight; ++y)
+		for (std::uint32_t x(0); x < skyWidth; ++x)
+		{
+			float *p(&sky[(static_cast<std::size_t>(y) * skyWidth + x) * 4]);
+			p[0] = static_cast<float>(x) / skyWidth;
+			p[1] = static_cast<float>(y) / skyHeight;
+			p[2] = ((x / 16 + y / 16) & 1) ? 0.8f : 0.2f;
+			p[3] = 1.0f;
+		}
+	BackendImage sky1(backend->CreateImage(skyWidth, skyHeight)), sky2(backend->CreateImage(skyWidth, skyHeight));
+	BackendImage target(backend->CreateImage(width, height));
+	backend->Upload(sky1, sky.data());
+	backend->Upload(sky2, sky.data());
+	auto *cpu(dynamic_cast<CpuBackend *>(backend.get()));
+	if (cpu && cpu->tileCache)
+		cpu->tileCache->occluders.push_back({ 0, 0, width / 2, height / 2 });
+	if (cpu && numa)
+		cpu->numa = std::make_unique<NumaTileScheduler>();
+
+	Orbit orbit{ Wormhole(), 4.0f, 0.0f, accumulate || still ? 0.0f : g_OrbitSpeed, moving, width, height, 0 };
+	// frames in flight: the pipeline's output stage checks the order frames leave in
+	std::uint64_t outOfOrder(0), nextOutput(0);
+	std::unique_ptr<CpuFramePipeline> pipeline;
+	if (framesInFlight)
+	{
+		pipeline = std::make_unique<CpuFramePipeline>(SkyView{ sky.data(), skyWidth, skyHeight }, SkyView{ sky.data(), skyWidth, skyHeight }, framesInFlight,
+													  [&](CpuFrame const &frame) { outOfOrder += frame.index == nextOutput++ ? 0 : 1; }, tableSize);
+		pipeline->cache = tableCache.get();
+	}
+
+	TripleBuffer<Snapshot> snapshots;
+	orbit.Step(0.0, snapshots.Back());
+	snapshots.Publish();
+	FixedRateThread updateThread;
+	if (threaded)
+		updateThread.Start(updateHz, [&](double seconds) {
+			orbit.Step(seconds, snapshots.Back());
+			snapshots.Publish();
+		});
+
+	SnapshotLatency latency;
+	std::uint64_t lastTick(0), torn(0), reordered(0), repeated(0);
+	Foveation foveation;
+	float tableL(-1.0f), tableMass(-1.0f);
+	TemporalAccumulation accumulation;
+	std::vector<float> traced, history;
+	std::vector<std::pair<std::uint32_t, double>> convergence; // mean absolute change of the history at frames 2, 4, 8, ...
+	auto begin(Clock::now()), last(begin);
+	for (std::uint32_t frame(0); frame < frames; ++frame)
+	{
+		if (!threaded)
+		{
+			auto now(Clock::now());
+			orbit.Step(std::chrono::duration<double>(now - last).count(), snapshots.Back());
+			snapshots.Publish();
+			last = now;
+		}
+		if (!snapshots.Acquire())
+			++repeated;
+		Snapshot const &snapshot(snapshots.Front());
+		torn += Consistent(snapshot) ? 0 : 1;
+		reordered += snapshot.tick < lastTick ? 1 : 0;
+		lastTick = snapshot.tick;
+
+		Wormhole wormhole(orbit.wormhole);
+		wormhole.mass *= 1.0f + static_cast<float>(frame / 8 % configs) * 0.5f;
+		if (pipeline)
+		{
+			// latency is not measured here, a frame is done framesInFlight submits later
+			pipeline->Submit(wormhole, snapshot.l, snapshot.r, snapshot.cam, foveation);
+			continue;
+		}
+		if (snapshot.l != tableL || wormhole.mass != tableMass)
+		{
+			backend->BuildPhiTable(wormhole, snapshot.l, snapshot.r, tableSize);
+			tableL = snapshot.l;
+			tableMass = wormhole.mass;
+		}
+		RayCamera cam(snapshot.cam);
+		if (accumulate)
+		{
+			accumulation.Begin(MakeTemporalViewKey(cam, wormhole, tableSize));
+			accumulation.Jitter(cam.jitterX, cam.jitterY);
+		}
+		backend->BeginFrame();
+		backend->RenderPixels(sky1, sky2, target, cam, foveation);
+		backend->EndFrame();
+		latency.Add(snapshot.sampled);
+		if (accumulate)
+		{
+			traced.resize(static_cast<std::size_t>(width) * height * 4);
+			history.resize(traced.size());
+			backend->Readback(target, traced.data());
+			std::vector<float> previous(history);
+			TemporalAccumulation::Blend(traced.data(), history.data(), history.size(), accumulation.Weight());
+			std::uint32_t n(accumulation.frames);
+			if (n >= 2 && !(n & (n - 1)))
+			{
+				double change(0.0);
+				for (std::size_t i(0); i < history.size(); ++i)
+					change += std::abs(history[i] - previous[i]);
+				convergence.emplace_back(n, change / static_cast<double>(history.size()));
+			}
+		}
+	}
+	if (pipeline)
+		pipeline->Flush();
+	double seconds(std::chrono::duration<double>(Clock::now() - begin).count());
+	updateThread.Stop();
+
+	std::printf("%s, %s: %u frames %ux%u in %.2f s (%.1f fps), %llu update ticks\n", pipeline ? "CPU pipeline" : backend->Name(), threaded ? "update thread" : "update before render",
+				frames, width, height, seconds, frames / seconds, static_cast<unsigned long long>(orbit.tick));
+	if (pipeline)
+	{
+		std::printf("%u frames in flight, stage ms per frame:", pipeline->FramesInFlight());
+		double slowest(0.0), sum(0.0);
+		for (std::size_t s(0); s < g_CpuStageCount; ++s)
+		{
+			double ms(pipeline->busyMs[s] / frames);
+			std::printf(" %s %.2f", CpuStageName(static_cast<CpuStage>(s)), ms);
+			slowest = std::max(slowest, ms);
+			sum += ms;
+		}
+		std::printf(" (sum %.2f, slowest %.2f, measured %.2f)\n", sum, slowest, seconds * 1000.0 / frames);
+	}
+	else if (cpu && cpu->progressive)
+		std::printf("progressive tables: %llu coarse builds, %llu refinements done, %llu cancelled\n", static_cast<unsigned long long>(cpu->progressive->coarseBuilds),
+					static_cast<unsigned long long>(cpu->progressive->refinementsDone.load()), static_cast<unsigned long long>(cpu->progressive->refinementsCancelled.load()));
+	if (accumulate && !pipeline)
+	{
+		std::printf("accumulated %u frames, %llu resets, mean change of the history:", accumulation.frames, static_cast<unsigned long long>(accumulation.resets));
+		for (auto const &c : convergence)
+			std::printf(" frame %u %.2e", c.first, c.second);
+		std::printf("\n");
+	}
+	if (cpu && cpu->tileCache && !pipeline)
+	{
+		TileCache const &tiles(*cpu->tileCache);
+		double n(static_cast<double>(std::max<std::uint64_t>(tiles.frames, 1)));
+		std::printf("tile cache: %u tiles, per frame %.1f traced, %.1f skipped, %.1f occluded (last frame %u skipped)\n", tiles.tilesX * tiles.tilesY,
+					tiles.tracedTotal / n, tiles.skippedTotal / n, tiles.occludedTotal / n, cpu->tileStats.skippedTiles);
+	}
+	if (cpu && cpu->numa && !pipeline)
+	{
+		NumaTileStats const &stats(cpu->numa->stats);
+		std::printf("NUMA tiles: %u nodes, last frame %llu from own ranges, %llu stolen on the node, %llu from other nodes\n", cpu->numa->Nodes(),
+					static_cast<unsigned long long>(stats.own), static_cast<unsigned long long>(stats.stolenLocal), static_cast<unsigned long long>(stats.stolenRemote));
+	}
+	if (tableCache)
+	{
+		PhiTableCacheStats stats(tableCache->Stats());
+		std::printf("phi table cache: %llu hits, %llu misses (%.1f%%), %zu tables, %.1f MB, %llu evicted\n", static_cast<unsigned long long>(stats.hits),
+					static_cast<unsigned long long>(stats.misses), stats.HitRate() * 100.0, stats.tables, stats.bytes / 1048576.0, static_cast<unsigned long long>(stats.evictions));
+	}
+	if (!pipeline)
+		std::printf("input to frame done %.2f ms mean, %.2f ms max, %llu frames reused the previous snapshot\n", latency.MeanMs(), latency.maxMs, static_cast<unsigned long long>(repeated));
+	if (torn || reordered || outOfOrder)
+	{
+		std::printf("FAILED: %llu torn, %llu out of order snapshots, %llu frames out of order\n", static_cast<unsigned long long>(torn), static_cast<unsigned long long>(reordered),
+					static_cast<unsigned long long>(outOfOrder));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+// The sky seen along one ray from the camera, shared by wormhole.hlsl and the environment cache.
+// Depends only on the camera position (through the phi table) and the ray direction. The
+// including shader declares t1, t2 (the skymaps of both sides), g_phi, g_PhiCahceSize and s1,
+// and includes matrix_ops.hlsli and skymap_panoramic.hlsli first. g_phi may hold several tables
+// one after another (multiple views), base is the first entry of the one to use.
+
+float2 phi_mapping_table(float phi, uint base)
+{
+	phi = fmod(phi + g_2PI, g_2PI);
+	float phi_lookup = phi / g_2PI;
+	uint lookup_idx = min(uint(phi_lookup * g_PhiCahceSize.size), g_PhiCahceSize.size - 1);
+	// 2pi - phi is the reflection of phi, only the first half of the table is stored
+	if (lookup_idx > g_PhiCahceSize.size / 2)
+	{
+		float2 mirrored = g_phi[base + g_PhiCahceSize.size - lookup_idx];
+		return float2(-mirrored.x - g_2PI, mirrored.y);
+	}
+	return g_phi[base + lookup_idx];
+}
+
+float2 phi_mapping(float phi)
+{
+	return phi_mapping_table(phi, 0);
+}
+
+// traced is the phi table entry the ray used (traced angle, l)
+float4 lensed_sky_table(float3 ray_pos, float3 ray_dir, uint table_base, out float2 traced)
+{
+	float3 new_x = normalize(ray_pos);
+	float3 new_y;
+	float3 new_z = float3(0, 0, 1);
+
+	if (abs(abs(dot(ray_dir, new_x)) - 1.0f) < 1e-8f)
+	{
+		new_y = cross(new_x, new_z);
+		new_z = cross(new_y, new_x);
+	}
+	else
+	{
+		new_z = cross(ray_dir, new_x);
+		new_y = cross(new_x, new_z);
+	}
+	new_y = normalize(new_y);
+	new_z = normalize(new_z);
+
+	// get inverse transformation
+	float4x4 local2global;
+	local2global._11 = new_x.x; local2global._12 = new_x.y; local2global._13 = new_x.z; local2global._14 = 0;
+	local2global._21 = new_y.x; local2global._22 = new_y.y; local2global._23 = new_y.z; local2global._24 = 0;
+	local2global._31 = new_z.x; local2global._32 = new_z.y; local2global._33 = new_z.z; local2global._34 = 0;
+	local2global._41 = 0; local2global._42 = 0; local2global._43 = 0; local2global._44 = 1.0;
+
+	float4x4 global2local = inverse(local2global); // matrix inverse to get forward transformation
+
+	float3 ray_dir_local_frame = mul(float4(ray_dir, 0.0f), global2local).xyz;
+	float ray_phi_camera = atan2(ray_dir_local_frame.y, ray_dir_local_frame.x);
+
+	float2 traced_result = phi_mapping_table(ray_phi_camera, table_base); // phi mapping
+	traced = traced_result;
+	float phi_traced = traced_result.x;
+	float l_traced = traced_result.y;
+
+	float local_x, local_y, local_z = 0.0f;
+	sincos(phi_traced, local_y, local_x);
+
+	float3 traced_ray_dir = float3(local_x, local_y, local_z);
+	float3 traced_ray_global_frame = mul(float4(traced_ray_dir, 0.0f), local2global).xyz;
+
+	float2 texCoord = dir2uv(traced_ray_global_frame);
+	if (l_traced < 0)
+		return t2.SampleLevel(s1, texCoord, 0);
+	else
+		return t1.SampleLevel(s1, texCoord, 0);
+}
+
+float4 lensed_sky_traced(float3 ray_pos, float3 ray_dir, out float2 traced)
+{
+	return lensed_sky_table(ray_pos, ray_dir, 0, traced);
+}
+
+float4 lensed_sky(float3 ray_pos, float3 ray_dir)
+{
+	float2 traced;
+	return lensed_sky_traced(ray_pos, ray_dir, traced);
+}
@@ -3,9 +3,20 @@
 #include "DescriptorHeap.h"
 #include "ScreenQuad.h"
 #include "WormholeRender.h"
+#include "EnvironmentCache.h"
+#include "Upscaler.h"
+#include "TemporalAccumulator.h"
+#include "MultiViewRender.h"
 #include "RGBAImage.h"
 #include "Camera.h"
 #include "InputHelper.h"
+#include "CameraPath.h"
+#include "FrameStats.h"
+#include "GpuTimer.h"
+#include "DynamicResolution.h"
+#include "FramePipeline.h"
+
+#include <mutex>
 
 // The number of swap chain back buffers.
 const uint8_t g_NumFrames = 3;
@@ -36,7 +47,18 @@ ComPtr<ID3D12GraphicsCommandList> g_CommandList;
 ComPtr<ID3D12CommandAllocator> g_CommandAllocators[g_NumFrames];
 ComPtr<ID3D12CommandAllocator> g_InitCommandAllocator;
 ComPtr<ID3D12DescriptorHeap> g_RTVDescriptorHeap;
-DescriptorHeapWrapper g_SkymapDescriptorHeap; // for skymap related stuffs, 2 SRVs and 2 UAVs
+DescriptorHeapWrapper g_SkymapDescriptorHeap; // for skymap related stuffs, laid out by the slots below
+
+// slots of g_SkymapDescriptorHeap, each the first of the descriptors listed
+std::size_t constexpr g_SlotSkymaps = 0;        // SRV of skymap 1, SRV of skymap 2
+std::size_t constexpr g_SlotResultUAV = 2;      // render result UAV
+std::size_t constexpr g_SlotResultSRV = 3;      // render result SRV
+std::size_t constexpr g_SlotPhiCache = 4;       // phi cache SRV, UAV
+std::size_t constexpr g_SlotEnvironment = 6;    // environment cache SRV, UAV
+std::size_t constexpr g_SlotUpscaler = 8;       // upscaler output SRV, UAV
+std::size_t constexpr g_SlotMultiView = 10;     // multi-view phi tables SRV, UAV, output SRV, UAV
+std::size_t constexpr g_SlotAccumulator = 14;   // accumulation history SRV, UAV
+std::size_t constexpr g_SkymapHeapSize = 16;
 UINT g_RTVDescriptorSize;
 UINT g_CurrentBackBufferIndex;
 
@@ -71,6 +93,7 @@ Wormhole g_Wormhole;
 // Common patterns
 ScreenQuad g_ScreenQuad;
 WormholeRender g_WormholeRender;
+EnvironmentCache g_EnvironmentCache;
 Camera g_Camera;
 InputHelper g_Input;
 
@@ -78,6 +101,92 @@ InputHelper g_Input;
 RGBAImageGPU g_Skymap1, g_Skymap2;
 RGBAImageGPU g_SkymapResult;
 
+// Camera path playback and benchmark mode
+CameraPathPlayer g_CameraPathPlayer;
+std::wstring g_CameraPathFile;
+float g_CameraPathTimestep = 1.0f / 60.0f;
+bool g_Benchmark = false;
+std::wstring g_BenchmarkOutput;
+FrameTimingStats g_FrameTimingStats;
+// frames rendered before measuring starts, lets shader compilation and clocks settle
+std::uint32_t constexpr g_BenchmarkWarmupFrames = 30;
+
+// Chrome trace written on exit when set
+std::wstring g_ProfileOutput;
+
+// Per pass timings, GPU timestamp queries unless --cpu-timestamps
+std::unique_ptr<TimestampBackend> g_Timestamps;
+PassTimingHistory g_PassTimings;
+bool g_UseCpuTimestamps = false;
+
+// trace the lensed sky once per camera position and resample it for rotations
+bool g_UseEnvironmentCache = false;
+
+// lower the internal resolution (within the fixed render texture) to hold a GPU frame time
+DynamicResolution g_DynamicResolution;
+bool g_UseDynamicResolution = false;
+
+// render at 1 / g_UpscaleFactor per axis (or the dynamic resolution) and upscale guided by the deflection
+Upscaler g_Upscaler;
+bool g_UseUpscaler = false;
+int g_UpscaleFactor = 2;
+
+// jittered frames of a still view blended into a history, reset when anything changes
+TemporalAccumulator g_TemporalAccumulator;
+bool g_UseAccumulation = false;
+
+// per tile shading rate around the fovea, the flag is applied once the renderer exists
+bool g_Foveated = false;
+
+// side by side stereo, both eyes rendered by one batch that shares the deflection table when it can
+MultiViewRender g_MultiViewRender;
+bool g_Stereo = false;
+float g_StereoSeparation = 0.064f;
+
+// 360 output (equirectangular, cubemap, fisheye) traced directly, without the pinhole only passes
+int g_OutputProjection = static_cast<int>(OutputProjection::Pinhole);
+float g_FisheyeFov = 180.0f;
+
+// coarse phi table while a wormhole slider is dragged, the full one is filled again on release
+// (the CPU backend refines in the background instead, ProgressivePhiTable.h)
+std::uint32_t constexpr g_CoarsePhiTableSize = 512;
+bool g_ProgressiveTable = false;
+bool g_WormholeDragging = false;
+
+// recently traced phi tables, uploaded instead of traced again when a configuration comes back
+std::unique_ptr<PhiTableCache> g_PhiTableCache;
+std::size_t g_PhiTableCacheMB = 0;
+
+// What Render needs from Update: the camera after this tick's input and the wormhole it moved
+// through. With --threaded the update thread publishes one per tick and Render takes the newest,
+// otherwise Update and Render run back to back in WM_PAINT.
+struct FrameSnapshot
+{
+    Camera camera;
+    Wormhole wormhole;
+    std::chrono::steady_clock::time_point sampled; // when the input was read
+};
+
+bool g_Threaded = false;
+double g_UpdateHz = 500.0;
+TripleBuffer<FrameSnapshot> g_Snapshots;
+FixedRateThread g_UpdateThread;
+// g_Wormhole as edited in ImGui on the render thread, read by the update thread
+std::mutex g_UiWormholeMutex;
+Wormhole g_UiWormhole;
+Camera g_RenderCamera; // camera of the frame being rendered, at its render resolution
+SnapshotLatency g_SnapshotLatency;
+float g_SnapshotLatencyMs = 0.0f, g_SnapshotLatencyMaxMs = 0.0f; // of the last 60 frames, for display
+
+std::string NarrowString(std::wstring const &s)
+{
+    int size = ::WideCharToMultiByte(CP_ACP, 0, s.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    std::string result(std::max(size, 1), '\0');
+    ::WideCharToMultiByte(CP_ACP, 0, s.c_str(), -1, result.data(), size, nullptr, nullptr);
+    result.resize(result.size() - 1);
+    return result;
+}
+
 #include "imgui.h"
 #include "imgui_impl_win32.h"
 #include "imgui_impl_dx12.h"
@@ -89,8 +198,66 @@ bool g_cameraPositionOverride = false;
 
 ComPtr<ID3D12DescriptorHeap> g_imGUIHeap;
 
+// flame graph of the last complete frame, one block of rows per thread, one row per zone depth
+void RenderProfilerPanel()
+{
+    auto &profiler = Profiler::Get();
+
+    ImGui::Begin("Profiler");
+    bool enabled = profiler.Enabled();
+    if (ImGui::Checkbox("Enabled", &enabled))
+        profiler.SetEnabled(enabled);
+    ImGui::SameLine();
+    if (ImGui::Button("Save Chrome trace"))
+        profiler.WriteChromeTrace("wormhole_trace.json");
+
+    std::uint64_t frameBegin = profiler.lastFrameBegin.load(std::memory_order_relaxed);
+    std::uint64_t frameEnd = profiler.frameBegin.load(std::memory_order_relaxed);
+    double ticksPerMs = profiler.TicksPerMicrosecond() * 1000.0;
+    double frameTicks = static_cast<double>(std::max<std::uint64_t>(frameEnd - frameBegin, 1));
+    ImGui::Text("Last frame: %.3f ms", frameTicks / ticksPerMs);
+
+    float const rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    for (auto const &thread : profiler.Collect(frameBegin, frameEnd))
+    {
+        if (thread.events.empty())
+            continue;
+        std::uint32_t maxDepth = 0;
+        for (auto const &e : thread.events)
+            maxDepth = std::max(maxDepth, e.depth);
+
+        ImGui::Text("%s", thread.threadName.c_str());
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f);
+        ImVec2 size(width, rowHeight * (maxDepth + 1));
+        ImGui::InvisibleButton(thread.threadName.c_str(), size);
+
+        drawList->PushClipRect(origin, ImVec2(origin.x + size.x, origin.y + size.y), true);
+        for (auto const &e : thread.events)
+        {
+            float x0 = origin.x + static_cast<float>(static_cast<double>(std::max(e.begin, frameBegin) - frameBegin) / frameTicks) * width;
+            float x1 = origin.x + static_cast<float>(static_cast<double>(e.end - frameBegin) / frameTicks) * width;
+            float y0 = origin.y + e.depth * rowHeight;
+            ImVec2 p0(x0, y0), p1(std::max(x1, x0 + 1.0f), y0 + rowHeight - 1.0f);
+
+            float hue = static_cast<float>((reinterpret_cast<std::uintptr_t>(e.name) * 2654435761u) % 360u) / 360.0f;
+            drawList->AddRectFilled(p0, p1, ImColor::HSV(hue, 0.6f, 0.7f));
+            drawList->PushClipRect(p0, p1, true);
+            drawList->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32(255, 255, 255, 255), e.name);
+            drawList->PopClipRect();
+
+            if (ImGui::IsMouseHoveringRect(p0, p1))
+                ImGui::SetTooltip("%s: %.3f ms", e.name, static_cast<double>(e.end - e.begin) / ticksPerMs);
+        }
+        drawList->PopClipRect();
+    }
+    ImGui::End();
+}
+
 void RenderIMGUI()
 {
+    PROFILE_ZONE("ImGui frame");
     ImGui_ImplDX12_NewFrame();
     ImGui_ImplWin32_NewFrame();
     ImGui::NewFrame();
@@ -98,8 +265,61 @@ void RenderIMGUI()
     {
         ImGui::Begin("Wormhole control");
         ImGui::SliderFloat("radius", &g_Wormhole.radius, 0.00001f, 4.0f, "%.5f");
+        bool dragging(ImGui::IsItemActive());
         ImGui::SliderFloat("mass", &g_Wormhole.mass, 0.00001f, 4.0f, "%.5f");
+        dragging = dragging || ImGui::IsItemActive();
         ImGui::SliderFloat("length", &g_Wormhole.length, 0.0f, 6.0f);
+        g_WormholeDragging = dragging || ImGui::IsItemActive();
+        ImGui::Checkbox("Coarse phi table while dragging", &g_ProgressiveTable);
+        ImGui::Checkbox("Environment cache (rotation only resamples)", &g_UseEnvironmentCache);
+        if (g_UseEnvironmentCache)
+        {
+            if (g_EnvironmentCache.valid)
+                ImGui::Text("Environment cache: valid");
+            else if (g_EnvironmentCache.tracedRows)
+                ImGui::Text("Environment cache: tracing %u/%u rows", g_EnvironmentCache.tracedRows, g_EnvironmentHeight);
+            else
+                ImGui::Text("Environment cache: tracing directly while moving");
+        }
+        ImGui::Checkbox("Foveated tracing", &g_WormholeRender.foveation.enabled);
+        if (g_WormholeRender.foveation.enabled)
+        {
+            ImGui::SliderFloat2("fovea", &g_WormholeRender.foveation.centerX, 0.0f, 1.0f);
+            ImGui::SliderFloat("full rate radius", &g_WormholeRender.foveation.innerRadius, 0.0f, 1.0f);
+            ImGui::SliderFloat("half rate radius", &g_WormholeRender.foveation.outerRadius, 0.0f, 1.0f);
+        }
+        ImGui::Checkbox("Temporal accumulation (still view)", &g_UseAccumulation);
+        if (g_UseAccumulation)
+            ImGui::Text("Accumulated frames: %u, %llu resets", g_TemporalAccumulator.state.frames, static_cast<unsigned long long>(g_TemporalAccumulator.state.resets));
+        ImGui::Checkbox("Deflection guided upscaler", &g_UseUpscaler);
+        if (g_UseUpscaler && !g_UseDynamicResolution)
+        {
+            ImGui::RadioButton("half", &g_UpscaleFactor, 2);
+            ImGui::SameLine();
+            ImGui::RadioButton("quarter", &g_UpscaleFactor, 4);
+        }
+        ImGui::Combo("projection", &g_OutputProjection, "pinhole\0equirect\0cubemap\0fisheye\0");
+        if (g_OutputProjection == static_cast<int>(OutputProjection::Fisheye))
+            ImGui::SliderFloat("fisheye angle", &g_FisheyeFov, 90.0f, 360.0f, "%.0f");
+        ImGui::Checkbox("Stereo (side by side)", &g_Stereo);
+        if (g_Stereo)
+        {
+            ImGui::SliderFloat("eye separation", &g_StereoSeparation, 0.0f, 0.5f, "%.3f");
+            ImGui::Text("Deflection tables: %u for 2 eyes", g_MultiViewRender.tables);
+        }
+        ImGui::Checkbox("Dynamic resolution", &g_UseDynamicResolution);
+        if (g_UseDynamicResolution)
+        {
+            ImGui::SliderFloat("target ms", &g_DynamicResolution.targetMs, 2.0f, 50.0f, "%.1f");
+            ImGui::Text("Internal resolution: %ux%u (%.0f%%), phi table %u",
+                        g_RenderCamera.GetWidth(), g_RenderCamera.GetHeight(), g_DynamicResolution.scale * 100.0f, g_WormholeRender.phiTableSize);
+        }
+        if (g_PhiTableCache)
+        {
+            PhiTableCacheStats stats(g_PhiTableCache->Stats());
+            ImGui::Text("Phi table cache: %zu tables, %.1f / %zu MB, hit rate %.1f%% (%llu evicted)", stats.tables, stats.bytes / 1048576.0, g_PhiTableCacheMB,
+                        stats.HitRate() * 100.0, static_cast<unsigned long long>(stats.evictions));
+        }
 
         ImGui::End();
     }
@@ -111,23 +331,42 @@ void RenderIMGUI()
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::Text("Client resolution: %ux%u", g_ClientWidth, g_ClientHeight);
         ImGui::Text("cam_x: %f, cam_y: %f, cam_z: %f\ndir_x: %f, dir_y: %f, dir_z: %f",
-                    g_Camera.GetPosition().x,
-                    g_Camera.GetPosition().y,
-                    g_Camera.GetPosition().z,
-                    g_Camera.GetLookDir().x,
-                    g_Camera.GetLookDir().y,
-                    g_Camera.GetLookDir().z
+                    g_RenderCamera.GetPosition().x,
+                    g_RenderCamera.GetPosition().y,
+                    g_RenderCamera.GetPosition().z,
+                    g_RenderCamera.GetLookDir().x,
+                    g_RenderCamera.GetLookDir().y,
+                    g_RenderCamera.GetLookDir().z
                     );
-        ImGui::Text("l: %f\n", g_Camera.GetL());
+        ImGui::Text("l: %f\n", g_RenderCamera.GetL());
+        ImGui::Text("Input to submit: %.2f ms (max %.2f), %s", g_SnapshotLatencyMs, g_SnapshotLatencyMaxMs, g_UpdateThread.running ? "update thread" : "update in WM_PAINT");
+        if (g_CameraPathPlayer.Active())
+            ImGui::Text("Camera path: frame %llu / %llu", g_CameraPathPlayer.frameIndex, g_CameraPathPlayer.FrameCount());
+
+        if (g_Timestamps)
+        {
+            ImGui::Text("Pass timings (%s)", g_Timestamps->Name());
+            for (std::size_t i = 0; i < g_RenderPassCount; ++i)
+            {
+                auto pass = static_cast<RenderPass>(i);
+                char overlay[64];
+                sprintf_s(overlay, "avg %.3f ms, max %.3f ms", g_PassTimings.Average(pass), g_PassTimings.Max(pass));
+                ImGui::PlotHistogram(RenderPassName(pass), g_PassTimings.samples[i].data(), static_cast<int>(PassTimingHistory::length),
+                                     static_cast<int>(g_PassTimings.offset), overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+        }
 
         ImGui::End();
     }
 
+    RenderProfilerPanel();
+
     // Rendering
     UINT backBufferIdx = g_SwapChain->GetCurrentBackBufferIndex();
     
     g_CommandList->SetDescriptorHeaps(1, g_imGUIHeap.GetAddressOf());
     ImGui::Render();
+    ScopedTimestamp timestamp(g_Timestamps.get(), RenderPass::ImGui);
     ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), g_CommandList.Get());
 
 }
@@ -152,6 +391,93 @@ void ParseCommandLineArguments()
         {
             g_UseWarp = true;
         }
+        if (::wcscmp(argv[i], L"--camera-path") == 0)
+        {
+            g_CameraPathFile = argv[++i];
+        }
+        if (::wcscmp(argv[i], L"--timestep") == 0)
+        {
+            g_CameraPathTimestep = ::wcstof(argv[++i], nullptr);
+        }
+        if (::wcscmp(argv[i], L"--benchmark") == 0)
+        {
+            g_Benchmark = true;
+        }
+        if (::wcscmp(argv[i], L"--benchmark-output") == 0)
+        {
+            g_BenchmarkOutput = argv[++i];
+        }
+        if (::wcscmp(argv[i], L"--cpu-timestamps") == 0)
+        {
+            g_UseCpuTimestamps = true;
+        }
+        if (::wcscmp(argv[i], L"--environment-cache") == 0)
+        {
+            g_UseEnvironmentCache = true;
+        }
+        if (::wcscmp(argv[i], L"--dynamic-resolution") == 0)
+        {
+            g_UseDynamicResolution = true;
+        }
+        if (::wcscmp(argv[i], L"--target-frame-ms") == 0)
+        {
+            g_DynamicResolution.targetMs = ::wcstof(argv[++i], nullptr);
+            g_UseDynamicResolution = true;
+        }
+        if (::wcscmp(argv[i], L"--foveated") == 0)
+        {
+            g_Foveated = true;
+        }
+        if (::wcscmp(argv[i], L"--projection") == 0)
+        {
+            std::string name(NarrowString(argv[++i]));
+            for (int p(0); p < static_cast<int>(OutputProjection::Count); ++p)
+                if (name == OutputProjectionName(static_cast<OutputProjection>(p)))
+                    g_OutputProjection = p;
+        }
+        if (::wcscmp(argv[i], L"--fisheye-fov") == 0)
+        {
+            g_FisheyeFov = ::wcstof(argv[++i], nullptr);
+        }
+        if (::wcscmp(argv[i], L"--stereo") == 0)
+        {
+            g_Stereo = true;
+        }
+        if (::wcscmp(argv[i], L"--accumulate") == 0)
+        {
+            g_UseAccumulation = true;
+        }
+        if (::wcscmp(argv[i], L"--upscale") == 0)
+        {
+            g_UpscaleFactor = std::max(static_cast<int>(::wcstol(argv[++i], nullptr, 10)), 1);
+            g_UseUpscaler = true;
+        }
+        if (::wcscmp(argv[i], L"--phi-table-cache") == 0)
+        {
+            g_PhiTableCacheMB = static_cast<std::size_t>(::wcstoul(argv[++i], nullptr, 10));
+        }
+        if (::wcscmp(argv[i], L"--progressive-table") == 0)
+        {
+            g_ProgressiveTable = true;
+        }
+        if (::wcscmp(argv[i], L"--threaded") == 0)
+        {
+            g_Threaded = true;
+        }
+        if (::wcscmp(argv[i], L"--update-hz") == 0)
+        {
+            g_UpdateHz = std::max(::wcstod(argv[++i], nullptr), 1.0);
+            g_Threaded = true;
+        }
+        if (::wcscmp(argv[i], L"--profile") == 0)
+        {
+            Profiler::Get().SetEnabled(true);
+        }
+        if (::wcscmp(argv[i], L"--profile-output") == 0)
+        {
+            g_ProfileOutput = argv[++i];
+            Profiler::Get().SetEnabled(true);
+        }
     }
 
     // Free memory allocated by CommandLineToArgvW
@@ -499,14 +825,18 @@ void Flush(ComPtr<ID3D12CommandQueue> commandQueue, ComPtr<ID3D12Fence> fence,
     WaitForFenceValue(fence, fenceValueForSignal, fenceEvent);
 }
 
-void UpdateCamera(float frameTime_ms)
+// radians per mouse count, what the per frame scale used to give at 60 fps. lX and lY are the
+// displacement since the last sample, so unlike key movement they are not scaled by frame time.
+float constexpr g_MouseLookScale = 16.67f * 1e-4f;
+
+void UpdateCamera(float frameTime_ms, Wormhole const &wormhole)
 {
     g_Input.Update();
 
     float adjusted_delta = frameTime_ms * 1e-4f;
-    float delta_mouse_scale = frameTime_ms * 1e-4f;
+    float delta_mouse_scale = g_MouseLookScale;
 
-    //g_Camera.Walk(frameTime_ms * 5e-4f, g_Wormhole);
+    //g_Camera.Walk(frameTime_ms * 5e-4f, wormhole);
 
     char* key_map = g_Input.GetKeyboardMap();
 
@@ -514,27 +844,27 @@ void UpdateCamera(float frameTime_ms)
         adjusted_delta *= 10.0f;
     if (key_map[DIK_A] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Strafe(-adjusted_delta, g_Wormhole);
+        g_Camera.Strafe(-adjusted_delta, wormhole);
     }
     if (key_map[DIK_D] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Strafe(adjusted_delta, g_Wormhole);
+        g_Camera.Strafe(adjusted_delta, wormhole);
     }
     if (key_map[DIK_W] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Walk(adjusted_delta, g_Wormhole);
+        g_Camera.Walk(adjusted_delta, wormhole);
     }
     if (key_map[DIK_S] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Walk(-adjusted_delta, g_Wormhole);
+        g_Camera.Walk(-adjusted_delta, wormhole);
     }
     if (key_map[DIK_SPACE] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Fly(-adjusted_delta, g_Wormhole);
+        g_Camera.Fly(-adjusted_delta, wormhole);
     }
     if (key_map[DIK_C] & 0x80 && !g_cameraPositionOverride)
     {
-        g_Camera.Fly(adjusted_delta, g_Wormhole);
+        g_Camera.Fly(adjusted_delta, wormhole);
     }
     if (key_map[DIK_Q] & 0x80)
     {
@@ -552,17 +882,22 @@ void UpdateCamera(float frameTime_ms)
 
     float constexpr orbitDelta = 0.81f;
 
-    if (key_map[DIK_F2] & 0x80)
+    // toggles on the press only, the update thread samples a held key hundreds of times
+    static bool f2WasDown = false;
+    bool f2Down = (key_map[DIK_F2] & 0x80) != 0;
+    bool f2Pressed = f2Down && !f2WasDown;
+    f2WasDown = f2Down;
+    if (f2Pressed)
     {
         g_cameraPositionOverride = !g_cameraPositionOverride;
         g_cameraOrbitingWormhole = !g_cameraOrbitingWormhole;
         if (g_cameraOrbitingWormhole)
         {
             XMFLOAT3 pos;
-            pos.x = g_Wormhole.radius + g_Wormhole.length + orbitDelta;
+            pos.x = wormhole.radius + wormhole.length + orbitDelta;
             pos.y = 0;
             pos.z = 0;
-            g_Camera.SetPosition(pos, g_Wormhole);
+            g_Camera.SetPosition(pos, wormhole);
         }
     }
 
@@ -575,7 +910,7 @@ void UpdateCamera(float frameTime_ms)
         pos.x = old_pos.x * cosAngle - old_pos.z * sinAngle;
         pos.y = 0;
         pos.z = old_pos.x * sinAngle + old_pos.z * cosAngle;
-        g_Camera.SetPosition(pos, g_Wormhole);
+        g_Camera.SetPosition(pos, wormhole);
     }
 
     // handle mouse
@@ -589,8 +924,50 @@ void UpdateCamera(float frameTime_ms)
     }
 }
 
+void FinishBenchmark()
+{
+    auto summary = g_FrameTimingStats.FormatSummary();
+    std::printf("Benchmark %ls\n%s", g_CameraPathFile.c_str(), summary.c_str());
+    OutputDebugStringA(summary.c_str());
+    if (!g_BenchmarkOutput.empty() && !g_FrameTimingStats.WriteJSON(NarrowString(g_BenchmarkOutput)))
+        std::printf("Failed to write %ls\n", g_BenchmarkOutput.c_str());
+}
+
+// The camera path is stepped with a fixed timestep, wall clock frame time is only measured, never used for motion
+void PlayCameraPath(float frameTime_ms)
+{
+    static std::uint32_t warmupFrames = 0;
+
+    if (g_Benchmark)
+    {
+        if (warmupFrames < g_BenchmarkWarmupFrames)
+        {
+            if (++warmupFrames == g_BenchmarkWarmupFrames)
+                g_CameraPathPlayer.Rewind();
+        }
+        else if (g_CameraPathPlayer.frameIndex > 0)
+            g_FrameTimingStats.Add(frameTime_ms); // time taken by the previous path frame
+    }
+
+    if (g_CameraPathPlayer.Finished())
+    {
+        if (g_Benchmark)
+        {
+            FinishBenchmark();
+            ::PostQuitMessage(0);
+            return;
+        }
+        g_CameraPathPlayer.Rewind(); // loop
+    }
+
+    g_CameraPathPlayer.Step(g_Camera, g_Wormhole);
+}
+
 void Update()
 {
+    Profiler::Get().BeginFrame();
+    PROFILE_ZONE("Update");
+
     static uint64_t frameCounter = 0;
     static double elapsedSeconds = 0.0;
     static std::chrono::high_resolution_clock clock;
@@ -601,7 +978,10 @@ void Update()
     auto deltaTime = t1 - t0;
     t0 = t1;
     elapsedSeconds += deltaTime.count() * 1e-9;
-    UpdateCamera(deltaTime.count() * 1e-6f);
+    if (g_CameraPathPlayer.Active())
+        PlayCameraPath(deltaTime.count() * 1e-6f);
+    else
+        UpdateCamera(deltaTime.count() * 1e-6f, g_Wormhole);
     if (elapsedSeconds > 1.0)
     {
         char buffer[500];
@@ -624,13 +1004,68 @@ void Update()
     }
 }
 
-void Render()
+FrameSnapshot TakeSnapshot(Wormhole const &wormhole)
+{
+    return { g_Camera, wormhole, std::chrono::steady_clock::now() };
+}
+
+// update thread, one input sample and camera step per tick
+void UpdateTick(double seconds)
+{
+    static bool named = false;
+    if (!named)
+    {
+        Profiler::Get().SetThreadName("update");
+        named = true;
+    }
+    PROFILE_ZONE("Update tick");
+    Wormhole wormhole;
+    {
+        std::lock_guard<std::mutex> lock(g_UiWormholeMutex);
+        wormhole = g_UiWormhole;
+    }
+    UpdateCamera(static_cast<float>(seconds * 1e3), wormhole);
+    g_Snapshots.Back() = TakeSnapshot(wormhole);
+    g_Snapshots.Publish();
+}
+
+void Render(FrameSnapshot const &frame)
 {
+    PROFILE_ZONE("Render");
     auto commandAllocator = g_CommandAllocators[g_CurrentBackBufferIndex];
     auto backBuffer = g_BackBuffers[g_CurrentBackBufferIndex];
 
     commandAllocator->Reset();
     g_CommandList->Reset(commandAllocator.Get(), nullptr);
+
+    // this back buffer's fence was waited on at the end of the last Render(), so its timestamps are complete
+    g_Timestamps->BeginFrame(g_CurrentBackBufferIndex);
+    g_WormholeRender.BeginPhiTableFrame(g_CurrentBackBufferIndex);
+    PassTimes passTimes;
+    if (g_Timestamps->Collect(passTimes))
+    {
+        g_PassTimings.Add(passTimes);
+        if (g_UseDynamicResolution)
+        {
+            auto ms([&](RenderPass pass) { return passTimes[static_cast<std::size_t>(pass)]; });
+            float scaledMs(ms(RenderPass::PhiCache) + ms(RenderPass::Wormhole) + ms(RenderPass::Environment) + ms(RenderPass::EnvironmentResample) + ms(RenderPass::Accumulate));
+            g_DynamicResolution.Update(scaledMs, ms(RenderPass::Upscale) + ms(RenderPass::ScreenQuad) + ms(RenderPass::ImGui));
+        }
+    }
+    Wormhole wormhole(frame.wormhole);
+    auto projection(static_cast<OutputProjection>(g_OutputProjection));
+    bool panoramic(projection != OutputProjection::Pinhole);
+    if (!g_UseDynamicResolution)
+        g_DynamicResolution.scale = g_UseUpscaler && !panoramic ? 1.0f / static_cast<float>(g_UpscaleFactor) : 1.0f;
+    // renders into the top left part of the fixed size result texture
+    std::uint32_t width, height;
+    OutputProjectionResolution(projection, g_DynamicResolution.Scaled(g_renderWidth), g_DynamicResolution.Scaled(g_renderHeight), width, height);
+    g_RenderCamera = frame.camera;
+    g_RenderCamera.SetResolutionFOV(width, height, 65.0f);
+    g_RenderCamera.SetOutputProjection(projection, g_FisheyeFov * XM_PI / 180.0f);
+    g_WormholeRender.phiTableSize = g_DynamicResolution.PhiTableSize(g_PhiCacheSize);
+    if (g_ProgressiveTable && g_WormholeDragging)
+        g_WormholeRender.phiTableSize = std::min(g_WormholeRender.phiTableSize, g_CoarsePhiTableSize);
     // Clear the render target.
     {
         CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
@@ -651,7 +1086,59 @@ void Render()
         g_Skymap1.AsComputeSRV(g_CommandList);
         g_Skymap2.AsComputeSRV(g_CommandList);
         g_SkymapResult.AsUAV(g_CommandList);
-        g_WormholeRender.Render(g_CommandList, g_Camera, g_Wormhole, g_SkymapDescriptorHeap, 0, 2, 4);
+        bool stereo(g_Stereo && !panoramic);
+        bool environment(g_UseEnvironmentCache && !panoramic);
+        bool upscale(!stereo && !panoramic && g_UseUpscaler && g_RenderCamera.GetWidth() < g_renderWidth);
+        // only the direct full rate pass is jittered and accumulated, wormhole_foveated.hlsl is not jittered
+        bool accumulate(g_UseAccumulation && !stereo && !environment && !upscale && !g_WormholeRender.foveation.enabled);
+        if (accumulate)
+            g_TemporalAccumulator.BeginFrame(g_WormholeRender, g_RenderCamera, wormhole);
+        else
+            g_TemporalAccumulator.Invalidate(g_WormholeRender);
+        if (stereo)
+        {
+            // each eye gets half the width, offset along the camera's right axis
+            Camera eyes[2] = { g_RenderCamera, g_RenderCamera };
+            for (int e(0); e < 2; ++e)
+            {
+                eyes[e].SetResolutionFOV(g_DynamicResolution.Scaled(g_renderWidth / 2), g_DynamicResolution.Scaled(g_renderHeight), 65.0f);
+                XMFLOAT3 pos;
+                XMStoreFloat3(&pos, g_RenderCamera.GetPositionXM() + g_RenderCamera.GetRightXM() * (e ? 0.5f : -0.5f) * g_StereoSeparation);
+                eyes[e].SetPosition(pos, wormhole);
+            }
+            g_MultiViewRender.phiTableSize = g_WormholeRender.phiTableSize;
+            g_MultiViewRender.output.AsUAV(g_CommandList);
+            g_MultiViewRender.Render(g_CommandList, eyes, 2, wormhole, g_SkymapDescriptorHeap, g_SlotSkymaps, g_SlotMultiView, g_SlotMultiView + 3, g_Timestamps.get());
+            g_MultiViewRender.output.AsGraphicsSRV(g_CommandList);
+        }
+        else if (environment)
+        {
+            // the 288 MB map is only allocated once the cache is first used
+            if (!g_EnvironmentCache.environment)
+                g_EnvironmentCache = EnvironmentCache(g_Device, g_WormholeRender, g_SkymapDescriptorHeap, g_SlotEnvironment);
+            g_EnvironmentCache.Render(g_CommandList, g_WormholeRender, g_RenderCamera, wormhole, g_SkymapDescriptorHeap, g_SlotSkymaps, g_SlotResultUAV, g_SlotPhiCache, g_SlotEnvironment,
+                g_Timestamps.get());
+        }
+        else
+        {
+            g_EnvironmentCache.Invalidate();
+            g_WormholeRender.Render(g_CommandList, g_RenderCamera, wormhole, g_SkymapDescriptorHeap, g_SlotSkymaps, g_SlotResultUAV, g_SlotPhiCache, g_Timestamps.get());
+        }
+        if (accumulate)
+        {
+            g_SkymapResult.AsComputeSRV(g_CommandList);
+            g_TemporalAccumulator.history.AsUAV(g_CommandList);
+            g_TemporalAccumulator.Accumulate(g_CommandList, g_SkymapDescriptorHeap, g_SlotResultSRV, g_SlotAccumulator + 1, g_RenderCamera.GetWidth(), g_RenderCamera.GetHeight(), g_Timestamps.get());
+            g_TemporalAccumulator.history.AsGraphicsSRV(g_CommandList);
+        }
+        if (upscale)
+        {
+            g_SkymapResult.AsComputeSRV(g_CommandList);
+            g_Upscaler.output.AsUAV(g_CommandList);
+            g_Upscaler.Render(g_CommandList, g_WormholeRender, g_RenderCamera, g_SkymapDescriptorHeap, g_SlotSkymaps, g_SlotResultSRV, g_SlotPhiCache, g_SlotUpscaler + 1,
+                g_Timestamps.get());
+            g_Upscaler.output.AsGraphicsSRV(g_CommandList);
+        }
         g_SkymapResult.AsGraphicsSRV(g_CommandList);
         g_Skymap1.AsGraphicsSRV(g_CommandList);
         g_Skymap2.AsGraphicsSRV(g_CommandList);
@@ -660,22 +1147,45 @@ void Render()
         g_CommandList->RSSetScissorRects(1, &g_ScissorRect);
 
         //DirectX::XMVector2Dot
-        g_ScreenQuad.Render(g_CommandList, g_SkymapDescriptorHeap, 3);
+        ScopedTimestamp timestamp(g_Timestamps.get(), RenderPass::ScreenQuad);
+        if (stereo)
+        {
+            std::uint32_t eyeWidth(g_DynamicResolution.Scaled(g_renderWidth / 2));
+            g_ScreenQuad.Render(g_CommandList, g_SkymapDescriptorHeap, g_SlotMultiView + 2, 2 * eyeWidth, g_RenderCamera.GetHeight(), 2 * (g_renderWidth / 2), g_renderHeight);
+        }
+        else if (upscale)
+            g_ScreenQuad.Render(g_CommandList, g_SkymapDescriptorHeap, g_SlotUpscaler);
+        else if (accumulate)
+            g_ScreenQuad.Render(g_CommandList, g_SkymapDescriptorHeap, g_SlotAccumulator, g_RenderCamera.GetWidth(), g_RenderCamera.GetHeight(), g_renderWidth, g_renderHeight);
+        else
+            g_ScreenQuad.Render(g_CommandList, g_SkymapDescriptorHeap, g_SlotResultSRV, g_RenderCamera.GetWidth(), g_RenderCamera.GetHeight(), g_renderWidth, g_renderHeight);
 
     }
     // IMGUI
     {
         RenderIMGUI();
+        std::lock_guard<std::mutex> lock(g_UiWormholeMutex);
+        g_UiWormhole = g_Wormhole;
     }
     // Present
     {
+        PROFILE_ZONE("Present + fence wait");
         CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
             backBuffer.Get(),
             D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
         g_CommandList->ResourceBarrier(1, &barrier);
 
+        g_Timestamps->EndFrame();
         ThrowIfFailed(g_CommandList->Close());
 
+        g_SnapshotLatency.Add(frame.sampled);
+        if (g_SnapshotLatency.frames == 60)
+        {
+            g_SnapshotLatencyMs = static_cast<float>(g_SnapshotLatency.MeanMs());
+            g_SnapshotLatencyMaxMs = static_cast<float>(g_SnapshotLatency.maxMs);
+            g_SnapshotLatency.Reset();
+        }
+
         ID3D12CommandList *const commandLists[] = {
             g_CommandList.Get()
         };
@@ -784,8 +1294,17 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
         switch (message)
         {
         case WM_PAINT:
-            Update();
-            Render();
+            if (g_UpdateThread.running)
+            {
+                Profiler::Get().BeginFrame();
+                g_Snapshots.Acquire(); // keeps the previous snapshot if the update thread has not ticked since
+                Render(g_Snapshots.Front());
+            }
+            else
+            {
+                Update();
+                Render(TakeSnapshot(g_Wormhole));
+            }
             break;
         case WM_SYSKEYDOWN:
         case WM_KEYDOWN:
@@ -854,6 +1373,7 @@ int main()
     // Window class name. Used for registering / creating the window.
     const wchar_t *windowClassName = L"WormholeClass";
     ParseCommandLineArguments();
+    Profiler::Get().SetThreadName("main");
 
     EnableDebugLayer();
 
@@ -881,14 +1401,8 @@ int main()
     g_RTVDescriptorHeap = CreateDescriptorHeap(g_Device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, g_NumFrames);
     g_RTVDescriptorSize = g_Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 
-    // create DH for 4 entries, 2 skymap SRVs for 2 spaces, 1 for render result UAV, 1 for render result SRV, 2 for phi cache SRV and UAV
-    // SRV
-    // SRV
-    // UAV
-    // SRV
-    // SRV (phi cache)
-    // UAV (phi cache)
-    g_SkymapDescriptorHeap = DescriptorHeapWrapper(g_Device, 6, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+    // create DH for the g_Slot* layout declared with g_SkymapDescriptorHeap
+    g_SkymapDescriptorHeap = DescriptorHeapWrapper(g_Device, g_SkymapHeapSize, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
     UpdateRenderTargetViews(g_Device, g_SwapChain, g_RTVDescriptorHeap);
 
@@ -904,16 +1418,41 @@ int main()
     g_Fence = CreateFence(g_Device);
     g_FenceEvent = CreateEventHandle();
 
+    if (g_UseCpuTimestamps)
+        g_Timestamps = std::make_unique<CpuTimestampBackend>();
+    else
+        g_Timestamps = std::make_unique<D3D12TimestampBackend>(g_Device, g_CommandQueue, g_CommandList, g_NumFrames);
+
     g_ScissorRect = CD3DX12_RECT(0, 0, LONG_MAX, LONG_MAX);
     g_Viewport = CD3DX12_VIEWPORT(0.0f, 0.0f, static_cast<float>(g_ClientWidth), static_cast<float>(g_ClientHeight));
     g_Camera.LookAt(XMFLOAT3(2, 0, 2), XMFLOAT3(-1, 0, -1), XMFLOAT3(0, 1, 0));
     //g_Camera.Walk(10.0f);
     g_Camera.SetResolutionFOV(g_renderWidth, g_renderHeight, 65.0f); // fixed 1920x1080 resolution, 65 degree view
 
+    if (!g_CameraPathFile.empty())
+    {
+        g_CameraPathPlayer = CameraPathPlayer(CameraPath(g_CameraPathFile.c_str()), g_CameraPathTimestep);
+        if (g_Benchmark)
+            g_VSync = false; // measure render time, not refresh rate
+    }
+    else if (g_Benchmark)
+    {
+        throw std::runtime_error("--benchmark requires --camera-path");
+    }
+
     // Init screen quad
     THROW(g_CommandList->Reset(g_InitCommandAllocator.Get(), nullptr));
     g_ScreenQuad = ScreenQuad(g_Device, g_CommandList);
-    g_WormholeRender = WormholeRender(g_Device, g_CommandList, g_SkymapDescriptorHeap, 4);
+    g_WormholeRender = WormholeRender(g_Device, g_CommandList, g_SkymapDescriptorHeap, g_SlotPhiCache);
+    if (g_PhiTableCacheMB)
+    {
+        g_PhiTableCache = std::make_unique<PhiTableCache>(g_PhiTableCacheMB << 20);
+        g_WormholeRender.EnablePhiTableCache(g_Device, g_PhiTableCache.get(), g_NumFrames);
+    }
+    g_Upscaler = Upscaler(g_Device, g_SkymapDescriptorHeap, g_SlotUpscaler, g_renderWidth, g_renderHeight);
+    g_TemporalAccumulator = TemporalAccumulator(g_Device, g_SkymapDescriptorHeap, g_SlotAccumulator, g_renderWidth, g_renderHeight);
+    g_MultiViewRender = MultiViewRender(g_Device, g_SkymapDescriptorHeap, g_SlotMultiView, 2, g_renderWidth / 2, g_renderHeight);
+    g_WormholeRender.foveation.enabled = g_Foveated;
     THROW(g_CommandList->Close());
     ID3D12CommandList *const commandLists[] = {
         g_CommandList.Get()
@@ -923,10 +1462,10 @@ int main()
 
     // Init texture
     RGBAImage skymap1(L"InterstellarWormhole_Fig6a.jpg");
-    g_Skymap1 = RGBAImageGPU(g_Device, skymap1.width, skymap1.height, g_SkymapDescriptorHeap.at_cpu(0));
+    g_Skymap1 = RGBAImageGPU(g_Device, skymap1.width, skymap1.height, g_SkymapDescriptorHeap.at_cpu(g_SlotSkymaps));
     RGBAImage skymap2(L"InterstellarWormhole_Fig10.jpg");
-    g_Skymap2 = RGBAImageGPU(g_Device, skymap2.width, skymap2.height, g_SkymapDescriptorHeap.at_cpu(1));
-    g_SkymapResult = RGBAImageGPU(g_Device, g_renderWidth, g_renderHeight, g_SkymapDescriptorHeap.at_cpu(3), g_SkymapDescriptorHeap.at_cpu(2)); // empty texture, fixed 1920x1080 resolution
+    g_Skymap2 = RGBAImageGPU(g_Device, skymap2.width, skymap2.height, g_SkymapDescriptorHeap.at_cpu(g_SlotSkymaps + 1));
+    g_SkymapResult = RGBAImageGPU(g_Device, g_renderWidth, g_renderHeight, g_SkymapDescriptorHeap.at_cpu(g_SlotResultSRV), g_SkymapDescriptorHeap.at_cpu(g_SlotResultUAV)); // empty texture, fixed 1920x1080 resolution
 
     THROW(g_CommandList->Reset(g_InitCommandAllocator.Get(), nullptr));
     g_Skymap1.Upload(g_Device, g_CommandList, skymap1);
@@ -971,6 +1510,15 @@ int main()
     bool show_another_window = false;
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
+    // camera paths step once per rendered frame, they stay in WM_PAINT
+    if (g_Threaded && !g_CameraPathPlayer.Active())
+    {
+        g_UiWormhole = g_Wormhole;
+        g_Snapshots.Back() = TakeSnapshot(g_Wormhole);
+        g_Snapshots.Publish();
+        g_UpdateThread.Start(g_UpdateHz, UpdateTick);
+    }
+
     g_IsInitialized = true;
 
 
@@ -984,6 +1532,8 @@ int main()
         }
     }
 
+    g_UpdateThread.Stop();
+
     // Make sure the command queue has finished all commands before closing.
     Flush(g_CommandQueue, g_Fence, g_FenceValue, g_FenceEvent);
 
@@ -994,5 +1544,8 @@ int main()
 
     ::CloseHandle(g_FenceEvent);
 
+    if (!g_ProfileOutput.empty() && !Profiler::Get().WriteChromeTrace(NarrowString(g_ProfileOutput)))
+        std::printf("Failed to write %ls\n", g_ProfileOutput.c_str());
+
     return 0;
 }
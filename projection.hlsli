@@ -0,0 +1,51 @@
+// ProjectionDirection of OutputProjection.h: the ray direction of a pixel, in the camera frame
+// (x along right, y along up, z along forward). Returns false outside the fisheye circle.
+
+#define PROJECTION_PINHOLE 0
+#define PROJECTION_EQUIRECTANGULAR 1
+#define PROJECTION_CUBEMAP 2
+#define PROJECTION_FISHEYE 3
+
+bool projection_direction(uint projection, float2 pixel, float2 size, float2 fov, float fisheye_fov, out float3 dir)
+{
+	if (projection == PROJECTION_PINHOLE)
+	{
+		dir = float3(fov * (pixel / size * 2.0f - 1.0f) * 0.5f, 1.0f);
+		return true;
+	}
+
+	float2 uv = (pixel + 0.5f) / size;
+	if (projection == PROJECTION_EQUIRECTANGULAR)
+	{
+		float longitude = (uv.x * 2.0f - 1.0f) * g_PI;
+		float latitude = (uv.y * 2.0f - 1.0f) * g_PI * 0.5f;
+		dir = float3(cos(latitude) * sin(longitude), sin(latitude), cos(latitude) * cos(longitude));
+		return true;
+	}
+	if (projection == PROJECTION_CUBEMAP)
+	{
+		float2 f = uv * float2(3.0f, 2.0f);
+		uint2 cell = min(uint2(f), uint2(2, 1));
+		float2 st = (f - float2(cell)) * 2.0f - 1.0f;
+		float3 n, s, t;
+		switch (cell.y * 3 + cell.x)
+		{
+		case 0: n = float3( 1, 0, 0); s = float3( 0, 0, -1); t = float3(0, 1,  0); break;	// right
+		case 1: n = float3(-1, 0, 0); s = float3( 0, 0,  1); t = float3(0, 1,  0); break;	// left
+		case 2: n = float3(0,  1, 0); s = float3( 1, 0,  0); t = float3(0, 0, -1); break;	// up
+		case 3: n = float3(0, -1, 0); s = float3( 1, 0,  0); t = float3(0, 0,  1); break;	// down
+		case 4: n = float3(0, 0,  1); s = float3( 1, 0,  0); t = float3(0, 1,  0); break;	// forward
+		default: n = float3(0, 0, -1); s = float3(-1, 0, 0); t = float3(0, 1,  0); break;	// back
+		}
+		dir = n + s * st.x + t * st.y;
+		return true;
+	}
+
+	// fisheye
+	float2 p = (uv * 2.0f - 1.0f) * float2(size.x / size.y, 1.0f);
+	float d = length(p);
+	float angle = min(d * fisheye_fov * 0.5f, g_PI);
+	float2 side = d < 1e-6f ? float2(0.0f, 0.0f) : p / d;
+	dir = float3(sin(angle) * side, cos(angle));
+	return d <= 1.0f;
+}
@@ -7,9 +7,18 @@ struct VS_OUT
 	float2 texcoord	: TEXCOORD;
 };
 
+struct Viewport
+{
+	float2 uvScale;
+	float2 uvMax;
+};
+
+ConstantBuffer<Viewport> g_Viewport : register(b0);
+
 float4 main(VS_OUT input) : SV_TARGET
 {
 	//return float4(1,0,0,1);
     // return interpolated color
-    return t1.Sample(s1, input.texcoord);
+    // the texels past uvMax are left over from larger frames, keep the filter off them
+    return t1.Sample(s1, min(input.texcoord, g_Viewport.uvMax));
 }
@@ -11,10 +11,19 @@ struct VS_OUT
 	float2 texcoord	: TEXCOORD;
 };
 
+// part of the texture holding the image when rendering below full resolution
+struct Viewport
+{
+	float2 uvScale;
+	float2 uvMax;
+};
+
+ConstantBuffer<Viewport> g_Viewport : register(b0);
+
 VS_OUT main(VS_IN input)
 {
 	VS_OUT output;
 	output.pos = float4(input.pos, 0.0f, 1.0f);
-	output.texcoord = input.texcoord;
+	output.texcoord = input.texcoord * g_Viewport.uvScale;
 	return output;
 }
@@ -6,3 +6,12 @@ float2 dir2uv(float3 dir)
 
 	return float2(phi, (dir.y + 1.0f) * 0.5f);
 }
+
+// inverse of dir2uv
+float3 uv2dir(float2 uv)
+{
+	float y = uv.y * 2.0f - 1.0f;
+	float phi = uv.x * g_2PI;
+	float s = sqrt(max(1.0f - y * y, 0.0f));
+	return float3(s * sin(phi), y, s * cos(phi));
+}
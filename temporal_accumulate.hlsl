@@ -0,0 +1,25 @@
+// Blends the frame just traced into the accumulation history (TemporalAccumulator.h): a weight
+// of 1 after a reset replaces the history, then 1 / n for a running mean of the jittered frames.
+
+Texture2D<float4> g_frame : register(t0);
+RWTexture2D<float4> g_history : register(u0);
+
+struct AccumulateData
+{
+	uint width;		// part of the textures holding the image
+	uint height;
+	float weight;	// of the frame
+	uint pad;
+};
+
+ConstantBuffer<AccumulateData> g_Accumulate : register(b0);
+
+[numthreads(32, 32, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+	if (tid.x >= g_Accumulate.width || tid.y >= g_Accumulate.height)
+		return;
+	float4 frame = g_frame[tid.xy];
+	// the history may hold anything, NaN included, before the first frame replaces it
+	g_history[tid.xy] = g_Accumulate.weight >= 1.0f ? frame : lerp(g_history[tid.xy], frame, g_Accumulate.weight);
+}
@@ -0,0 +1,110 @@
+// Upscales a low resolution render of the lensed sky to the full resolution, guided by the
+// deflection field. The phi table gives, for a single lookup, where every ray ends up (the
+// traced angle in its plane and the side of the throat), so each output pixel compares its own
+// deflection with that of the four low resolution samples around it and only blends those that
+// landed close to it on the same side. Across the Einstein ring and the throat boundary the
+// deflection jumps and the samples on the other side are dropped; a pixel left with no usable
+// sample is traced exactly, which only happens along those edges.
+
+Texture2D t1 : register(t0);
+Texture2D t2 : register(t1);
+StructuredBuffer<float2> g_phi : register(t2);
+Texture2D<float4> g_low : register(t3);
+SamplerState s1 : register(s0);
+RWTexture2D<float4> g_dst : register(u0);
+
+struct CameraData
+{
+	float4 position;
+	float4 forward;
+	float4 up;
+	float4 right;
+	float fovX;
+	float fovY;
+	float width;	// of the output
+	float height;
+};
+
+struct UpscaleData
+{
+	float lowWidth;		// part of g_low holding the image
+	float lowHeight;
+	float sigma;		// deflection difference tolerated, in low resolution pixels
+	float minWeight;	// below this the pixel is traced
+};
+
+struct CacheSize
+{
+	uint size;
+	uint3 pad;
+};
+
+#define g_PI 3.141592653589793238462643383279502884197169399375105820974
+#define g_2PI 6.283185307179586476925286766559005768394338798750211641949
+
+ConstantBuffer<CameraData> g_Camera			: register(b0);
+ConstantBuffer<UpscaleData> g_Upscale		: register(b1);
+ConstantBuffer<CacheSize> g_PhiCahceSize	: register(b2);
+
+#include "skymap_panoramic.hlsli"
+#include "matrix_ops.hlsli"
+#include "lensed_sky.hlsli"
+
+// same rays as wormhole.hlsl for pixel p of a width x height image
+float3 camera_ray(float2 p, float width, float height)
+{
+	float x = p.x / width * 2.0f - 1.0f;
+	float y = p.y / height * 2.0f - 1.0f;
+
+	float3 r = g_Camera.right.xyz * g_Camera.fovX * x * 0.5f;
+	float3 u = g_Camera.up.xyz * g_Camera.fovY * y * 0.5f;
+	return normalize(r + u + g_Camera.forward.xyz);
+}
+
+// traced angle and l of a ray, the angle to the throat direction is the phi of lensed_sky
+float2 deflection(float3 throat_dir, float3 ray_dir)
+{
+	return phi_mapping(acos(clamp(dot(throat_dir, ray_dir), -1.0f, 1.0f)));
+}
+
+[numthreads(32, 32, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+	if (tid.x >= uint(g_Camera.width) || tid.y >= uint(g_Camera.height))
+		return;
+
+	float3 ray_pos = g_Camera.position.xyz;
+	float3 throat_dir = normalize(ray_pos);
+	float3 ray_dir = camera_ray(float2(tid.xy), g_Camera.width, g_Camera.height);
+	float2 guide = deflection(throat_dir, ray_dir);
+
+	// position in the low resolution image, pixel i of it sits at i / lowWidth like tid.x / width
+	float2 low_size = float2(g_Upscale.lowWidth, g_Upscale.lowHeight);
+	float2 p = float2(tid.xy) * low_size / float2(g_Camera.width, g_Camera.height);
+	float2 p0 = min(floor(p), low_size - 1.0f);
+	float2 f = p - p0;
+
+	// one low resolution pixel of view angle, the scale of the deflection differences
+	float tolerance = g_Upscale.sigma * g_Camera.fovX / g_Upscale.lowWidth;
+
+	float4 color = 0.0f;
+	float weight = 0.0f;
+	[unroll]
+	for (int i = 0; i < 4; ++i)
+	{
+		float2 o = float2(i & 1, i >> 1);
+		float2 q = min(p0 + o, low_size - 1.0f);
+		float2 d = deflection(throat_dir, camera_ray(q, g_Upscale.lowWidth, g_Upscale.lowHeight));
+		float2 bilinear = lerp(1.0f - f, f, o);
+		float e = (d.x - guide.x) / tolerance;
+		float similarity = (d.y < 0) == (guide.y < 0) ? exp(-e * e) : 0.0f;
+		float w = bilinear.x * bilinear.y * similarity;
+		color += w * g_low[uint2(q)];
+		weight += w;
+	}
+
+	if (weight < g_Upscale.minWeight)
+		g_dst[tid.xy] = lensed_sky(ray_pos, ray_dir);
+	else
+		g_dst[tid.xy] = color / weight;
+}
@@ -14,6 +14,9 @@ struct CameraData
 	float fovY;
 	float width;
 	float height;
+	uint projection;	// OutputProjection
+	float fisheyeFov;
+	float2 jitter;		// sub-pixel offset of the sample, TemporalAccumulator.h
 };
 
 struct Wormhole
@@ -39,6 +42,8 @@ ConstantBuffer<CacheSize> g_PhiCahceSize	: register(b2);
 
 #include "skymap_panoramic.hlsli"
 #include "matrix_ops.hlsli"
+#include "lensed_sky.hlsli"
+#include "projection.hlsli"
 
 float3 null_geodesic_2d(float3 l_phi_pl, float a, float M, float rho, float B_sqr, float b)
 {
@@ -67,14 +72,6 @@ float3 null_geodesic_2d(float3 l_phi_pl, float a, float M, float rho, float B_sq
 	return float3(dl_dt, dphi_dt, dpl_dt);
 }
 
-float2 phi_mapping(float phi)
-{
-	phi = fmod(phi + g_2PI, g_2PI);
-	float phi_lookup = phi / g_2PI;
-	uint lookup_idx = min(uint(phi_lookup * g_PhiCahceSize.size), g_PhiCahceSize.size - 1);
-	return g_phi[lookup_idx];
-}
-
 float2 phi_mapping_old(float phi, float l)
 {
 	phi = fmod(phi + g_2PI, g_2PI);
@@ -128,55 +125,9 @@ void main(uint3 tid : SV_DispatchThreadID)
 	float3 up = g_Camera.up.xyz;
 	float3 right = g_Camera.right.xyz;
 
-	float x = float(tid.x) / float(g_Camera.width) * 2.0f - 1.0f;
-	float y = float(tid.y) / float(g_Camera.height) * 2.0f - 1.0f;
-
-	float3 r = right * g_Camera.fovX * x * 0.5f;
-	float3 u = up * g_Camera.fovY * y * 0.5f;
-	float3 ray_dir = normalize(r + u + dir);
-
-	float3 new_x = normalize(ray_pos);
-	float3 new_y;
-	float3 new_z = float3(0, 0, 1);
-
-	if (abs(abs(dot(ray_dir, new_x)) - 1.0f) < 1e-8f)
-	{
-		new_y = cross(new_x, new_z);
-		new_z = cross(new_y, new_x);
-	}
-	else
-	{
-		new_z = cross(ray_dir, new_x);
-		new_y = cross(new_x, new_z);
-	}
-	new_y = normalize(new_y);
-	new_z = normalize(new_z);
-
-	// get inverse transformation
-	float4x4 local2global;
-	local2global._11 = new_x.x; local2global._12 = new_x.y; local2global._13 = new_x.z; local2global._14 = 0;
-	local2global._21 = new_y.x; local2global._22 = new_y.y; local2global._23 = new_y.z; local2global._24 = 0;
-	local2global._31 = new_z.x; local2global._32 = new_z.y; local2global._33 = new_z.z; local2global._34 = 0;
-	local2global._41 = 0; local2global._42 = 0; local2global._43 = 0; local2global._44 = 1.0;
-
-	float4x4 global2local = inverse(local2global); // matrix inverse to get forward transformation
-
-	float3 ray_dir_local_frame = mul(float4(ray_dir, 0.0f), global2local).xyz;
-	float ray_phi_camera = atan2(ray_dir_local_frame.y, ray_dir_local_frame.x);
-
-	float2 traced_result = phi_mapping(ray_phi_camera); // phi mapping
-	float phi_traced = traced_result.x;
-	float l_traced = traced_result.y;
-
-	float local_x, local_y, local_z = 0.0f;
-	sincos(phi_traced, local_y, local_x);
-
-	float3 traced_ray_dir = float3(local_x, local_y, local_z);
-	float3 traced_ray_global_frame = mul(float4(traced_ray_dir, 0.0f), local2global).xyz;
+	float3 d;
+	bool covered = projection_direction(g_Camera.projection, float2(tid.xy) + g_Camera.jitter, float2(width, height), float2(fovX, fovY), g_Camera.fisheyeFov, d);
+	float3 ray_dir = normalize(right * d.x + up * d.y + dir * d.z);
 
-	float2 texCoord = dir2uv(traced_ray_global_frame);
-	if (l_traced < 0)
-		g_dst[tid.xy] = t2.SampleLevel(s1, texCoord, 0);
-	else
-		g_dst[tid.xy] = t1.SampleLevel(s1, texCoord, 0);
+	g_dst[tid.xy] = covered ? lensed_sky(ray_pos, ray_dir) : float4(0.0f, 0.0f, 0.0f, 0.0f);
 }
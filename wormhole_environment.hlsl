@@ -0,0 +1,58 @@
+// Lensed sky over the whole sphere for the current camera position, one texel per direction in
+// the dir2uv parameterization, a band of rows starting at firstRow per dispatch. Same bindings
+// as wormhole.hlsl, the camera constants only hold the position, the band and the size of the
+// environment map.
+
+Texture2D t1 : register(t0);
+Texture2D t2 : register(t1);
+StructuredBuffer<float2> g_phi : register(t2);
+SamplerState s1 : register(s0);
+RWTexture2D<unorm float4> g_dst : register(u0);
+
+struct CameraData
+{
+	float4 position;
+	uint firstRow;
+	uint3 pad0;
+	uint4 pad1;
+	uint4 pad2;
+	float2 pad3;
+	float width;
+	float height;
+};
+
+struct Wormhole
+{
+	float mass;
+	float radius;
+	float length;
+	float pad;
+};
+
+struct CacheSize
+{
+	uint size;
+	uint3 pad;
+};
+
+#define g_PI 3.141592653589793238462643383279502884197169399375105820974
+#define g_2PI 6.283185307179586476925286766559005768394338798750211641949
+
+ConstantBuffer<CameraData> g_Camera			: register(b0);
+ConstantBuffer<Wormhole> g_Wormhole			: register(b1);
+ConstantBuffer<CacheSize> g_PhiCahceSize	: register(b2);
+
+#include "skymap_panoramic.hlsli"
+#include "matrix_ops.hlsli"
+#include "lensed_sky.hlsli"
+
+[numthreads(32, 32, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+	uint2 texel = uint2(tid.x, tid.y + g_Camera.firstRow);
+	if (texel.x >= uint(g_Camera.width) || texel.y >= uint(g_Camera.height))
+		return;
+
+	float2 uv = (float2(texel) + 0.5f) / float2(g_Camera.width, g_Camera.height);
+	g_dst[texel] = lensed_sky(g_Camera.position.xyz, uv2dir(uv));
+}
@@ -0,0 +1,152 @@
+// wormhole.hlsl with a shading rate per 8x8 tile (Foveation.h, TileRenderer.h for the CPU
+// version). A group is one tile. Coarse tiles trace the lattice of samples spaced by the rate,
+// including the first row and column of the next tiles, with the first threads of the group and
+// interpolate bilinearly; the other waves of the group skip the trace. When the samples straddle
+// the throat edge or the Einstein ring the whole tile is traced at full rate.
+
+Texture2D t1 : register(t0);
+Texture2D t2 : register(t1);
+StructuredBuffer<float2> g_phi : register(t2);
+SamplerState s1 : register(s0);
+RWTexture2D<float4> g_dst : register(u0);
+
+struct CameraData
+{
+	float4 position;
+	float4 forward;
+	float4 up;
+	float4 right;
+	float fovX;
+	float fovY;
+	float width;
+	float height;
+};
+
+struct Wormhole
+{
+	float mass;
+	float radius;
+	float length;
+	float pad;
+};
+
+struct CacheSize
+{
+	uint size;
+	uint3 pad;
+};
+
+struct FoveationData
+{
+	float centerX;		// fractions of the width and height
+	float centerY;
+	float innerRadius;	// fractions of the height
+	float outerRadius;
+	float refineAngle;	// in sample spacings
+	float3 pad;
+};
+
+#define g_PI 3.141592653589793238462643383279502884197169399375105820974
+#define g_2PI 6.283185307179586476925286766559005768394338798750211641949
+
+#define TILE_SIZE 8
+#define MAX_LATTICE (TILE_SIZE / 2 + 1)
+
+ConstantBuffer<CameraData> g_Camera			: register(b0);
+ConstantBuffer<Wormhole> g_Wormhole			: register(b1);
+ConstantBuffer<CacheSize> g_PhiCahceSize	: register(b2);
+ConstantBuffer<FoveationData> g_Foveation	: register(b3);
+
+#include "skymap_panoramic.hlsli"
+#include "matrix_ops.hlsli"
+#include "lensed_sky.hlsli"
+
+groupshared float4 g_samples[MAX_LATTICE][MAX_LATTICE];
+groupshared float2 g_traced[MAX_LATTICE][MAX_LATTICE];
+groupshared uint g_straddles;
+
+float3 camera_ray(uint2 p)
+{
+	float x = float(p.x) / float(g_Camera.width) * 2.0f - 1.0f;
+	float y = float(p.y) / float(g_Camera.height) * 2.0f - 1.0f;
+
+	float3 r = g_Camera.right.xyz * g_Camera.fovX * x * 0.5f;
+	float3 u = g_Camera.up.xyz * g_Camera.fovY * y * 0.5f;
+	return normalize(r + u + g_Camera.forward.xyz);
+}
+
+// Foveation::Rate
+uint tile_rate(uint2 tile_origin)
+{
+	float2 d = (float2(tile_origin + TILE_SIZE / 2) - float2(g_Foveation.centerX * g_Camera.width, g_Foveation.centerY * g_Camera.height)) / g_Camera.height;
+	float r = length(d);
+	return r < g_Foveation.innerRadius ? 1 : (r < g_Foveation.outerRadius ? 2 : 4);
+}
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint3 gid : SV_GroupID, uint3 gtid : SV_GroupThreadID, uint gi : SV_GroupIndex)
+{
+	uint2 size = uint2(g_Camera.width, g_Camera.height);
+	uint2 origin = gid.xy * TILE_SIZE;
+	uint2 pixel = origin + gtid.xy;
+	float3 ray_pos = g_Camera.position.xyz;
+	uint rate = tile_rate(origin);
+
+	if (rate > 1)
+	{
+		uint n = TILE_SIZE / rate;
+		if (gi == 0)
+			g_straddles = 0;
+		GroupMemoryBarrierWithGroupSync();
+
+		if (gi < (n + 1) * (n + 1))
+		{
+			uint2 ij = uint2(gi % (n + 1), gi / (n + 1));
+			uint2 p = min(origin + ij * rate, size - 1);
+			float2 traced;
+			g_samples[ij.y][ij.x] = lensed_sky_traced(ray_pos, camera_ray(p), traced);
+			g_traced[ij.y][ij.x] = traced;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (gi < (n + 1) * (n + 1))
+		{
+			uint2 ij = uint2(gi % (n + 1), gi / (n + 1));
+			float2 t = g_traced[ij.y][ij.x];
+			float tolerance = g_Foveation.refineAngle * float(rate) * g_Camera.fovX / g_Camera.width;
+			bool straddles = false;
+			if (ij.x > 0)
+			{
+				float2 o = g_traced[ij.y][ij.x - 1];
+				straddles = straddles || (o.y < 0) != (t.y < 0) || abs(o.x - t.x) > tolerance;
+			}
+			if (ij.y > 0)
+			{
+				float2 o = g_traced[ij.y - 1][ij.x];
+				straddles = straddles || (o.y < 0) != (t.y < 0) || abs(o.x - t.x) > tolerance;
+			}
+			if (straddles)
+				InterlockedOr(g_straddles, 1);
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (g_straddles == 0)
+		{
+			if (all(pixel < size))
+			{
+				// same lattice positions as the trace, clamped at the image edge
+				uint2 ij = min(gtid.xy / rate, n - 1);
+				float2 p0 = float2(min(origin + ij * rate, size - 1));
+				float2 p1 = float2(min(origin + (ij + 1) * rate, size - 1));
+				float2 t = (float2(pixel) - p0) / max(p1 - p0, 1.0f);
+				float4 top = lerp(g_samples[ij.y][ij.x], g_samples[ij.y][ij.x + 1], t.x);
+				float4 bottom = lerp(g_samples[ij.y + 1][ij.x], g_samples[ij.y + 1][ij.x + 1], t.x);
+				g_dst[pixel] = lerp(top, bottom, t.y);
+			}
+			return;
+		}
+	}
+
+	if (all(pixel < size))
+		g_dst[pixel] = lensed_sky(ray_pos, camera_ray(pixel));
+}
@@ -0,0 +1,78 @@
+// wormhole.hlsl for up to four views that differ only in position (MultiViewRender.h). A thread
+// shades its pixel in every view, one after another: the views look in the same direction from
+// nearby points, so their skymap fetches mostly hit the texels the previous view just loaded.
+// View v is written to columns [v * width, (v + 1) * width) of g_dst.
+
+Texture2D t1 : register(t0);
+Texture2D t2 : register(t1);
+StructuredBuffer<float2> g_phi : register(t2);
+SamplerState s1 : register(s0);
+RWTexture2D<float4> g_dst : register(u0);
+
+struct CameraData
+{
+	float4 position;	// unused, see ViewData
+	float4 forward;
+	float4 up;
+	float4 right;
+	float fovX;
+	float fovY;
+	float width;
+	float height;
+};
+
+struct Wormhole
+{
+	float mass;
+	float radius;
+	float length;
+	float pad;
+};
+
+struct CacheSize
+{
+	uint size;
+	uint3 pad;
+};
+
+struct ViewData
+{
+	float4 position[4];	// xyz, w is the table of the view
+	uint views;
+	uint3 pad;
+};
+
+#define g_PI 3.141592653589793238462643383279502884197169399375105820974
+#define g_2PI 6.283185307179586476925286766559005768394338798750211641949
+
+ConstantBuffer<CameraData> g_Camera			: register(b0);
+ConstantBuffer<Wormhole> g_Wormhole			: register(b1);
+ConstantBuffer<CacheSize> g_PhiCahceSize	: register(b2);
+ConstantBuffer<ViewData> g_Views			: register(b3);
+
+#include "skymap_panoramic.hlsli"
+#include "matrix_ops.hlsli"
+#include "lensed_sky.hlsli"
+
+[numthreads(32, 32, 1)]
+void main(uint3 tid : SV_DispatchThreadID)
+{
+	uint width = uint(g_Camera.width);
+	if (tid.x >= width || tid.y >= uint(g_Camera.height))
+		return;
+
+	float x = float(tid.x) / float(g_Camera.width) * 2.0f - 1.0f;
+	float y = float(tid.y) / float(g_Camera.height) * 2.0f - 1.0f;
+
+	float3 r = g_Camera.right.xyz * g_Camera.fovX * x * 0.5f;
+	float3 u = g_Camera.up.xyz * g_Camera.fovY * y * 0.5f;
+	float3 ray_dir = normalize(r + u + g_Camera.forward.xyz);
+
+	uint stored = g_PhiCahceSize.size / 2 + 1;
+	for (uint v = 0; v < g_Views.views; ++v)
+	{
+		float2 traced;
+		float4 view = g_Views.position[v];
+		g_dst[uint2(tid.x + v * width, tid.y)] = lensed_sky_table(view.xyz, ray_dir, uint(view.w) * stored, traced);
+	}
+}